@@ -0,0 +1,390 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Software audio helpers implemented on top of the wrangled SDL API.
+ * All of them require a successful sdlewInit().
+ */
+
+#ifndef __SDL_EW_AUDIO_H__
+#define __SDL_EW_AUDIO_H__
+
+#include "SDL/SDL.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Mixing. */
+
+/* Mix n source buffers of len bytes into dst in a single pass, like
+ * calling SDL_MixAudio() for each of them. Volumes range from 0 to
+ * SDL_MIX_MAXVOLUME, NULL meaning full volume for all sources, and NULL
+ * sources are skipped. Unlike repeated SDL_MixAudio() the sum is kept at
+ * full precision and only clipped once at the end, so the result does not
+ * depend on the order of the sources. All AUDIO_* sample formats are
+ * supported. Returns 0 on success and -1 with the SDL error set otherwise.
+ */
+int sdlewMixAudioMulti(Uint8 *dst, const Uint8 *const *srcs,
+                       const int *volumes, int n, Uint32 len,
+                       Uint16 format);
+
+/* Sample rate conversion. */
+
+enum {
+  SDLEW_RESAMPLE_LINEAR = 0,
+  SDLEW_RESAMPLE_SINC = 1,
+};
+
+typedef struct SDLEW_Resampler SDLEW_Resampler;
+
+/* Create a streaming converter of interleaved audio in an AUDIO_* format
+ * from src_rate to dst_rate, which may have any ratio. Filter state is
+ * carried from one call to the next, so consecutive buffers join without
+ * clicks. The sinc filter looks ahead by a few dozen input frames, which
+ * are only output once the following buffer arrives. Returns NULL with
+ * the SDL error set on failure.
+ */
+SDLEW_Resampler *sdlewResamplerCreate(Uint16 format, int channels,
+                                      int src_rate, int dst_rate,
+                                      int quality);
+void sdlewResamplerFree(SDLEW_Resampler *resampler);
+
+/* Forget buffered input, as when starting a new stream. */
+void sdlewResamplerReset(SDLEW_Resampler *resampler);
+
+/* Upper bound of the bytes output for src_len input bytes. */
+int sdlewResamplerMaxOutput(const SDLEW_Resampler *resampler, int src_len);
+
+/* Convert src_len bytes, writing all output available so far to dst and
+ * returning its size in bytes, or -1 with the SDL error set. dst must hold
+ * sdlewResamplerMaxOutput() bytes and may be the same as src.
+ */
+int sdlewResamplerProcess(SDLEW_Resampler *resampler, const Uint8 *src,
+                          int src_len, Uint8 *dst);
+
+/* Fill cvt like SDL_BuildAudioCVT() would for a rate-only conversion, so
+ * buffers can be sized from len_mult and len_ratio as usual.
+ */
+void sdlewResamplerBuildCVT(const SDLEW_Resampler *resampler,
+                            SDL_AudioCVT *cvt);
+
+/* Drop-in for SDL_ConvertAudio(): convert cvt->len bytes at cvt->buf in
+ * place and set cvt->len_cvt. Returns 0 on success and -1 with the SDL
+ * error set otherwise.
+ */
+int sdlewResamplerConvert(SDLEW_Resampler *resampler, SDL_AudioCVT *cvt);
+
+/* Format conversion. */
+
+typedef struct SDLEW_AudioConverter SDLEW_AudioConverter;
+
+/* Create a converter between two (format, channels, rate) triples, the
+ * replacement of an SDL_AudioCVT. Sample format and channel changes are
+ * done by one kernel in a single pass over the data, giving the same
+ * bytes as SDL_ConvertAudio(). 5.1 and quad layouts are left to the
+ * SDL_AudioCVT filters. Rate changes go through an SDLEW_Resampler of
+ * the given quality. Returns NULL with the SDL error set on failure.
+ */
+SDLEW_AudioConverter *sdlewAudioConverterCreate(Uint16 src_format,
+                                                int src_channels,
+                                                int src_rate,
+                                                Uint16 dst_format,
+                                                int dst_channels,
+                                                int dst_rate, int quality);
+void sdlewAudioConverterFree(SDLEW_AudioConverter *converter);
+
+/* Upper bound of the bytes output for src_len input bytes. */
+int sdlewAudioConverterMaxOutput(const SDLEW_AudioConverter *converter,
+                                 int src_len);
+
+/* Convert src_len bytes of src into dst, which must hold
+ * sdlewAudioConverterMaxOutput() bytes and must not overlap src. Returns
+ * the number of bytes written or -1 with the SDL error set.
+ */
+int sdlewAudioConverterProcess(SDLEW_AudioConverter *converter,
+                               const Uint8 *src, int src_len, Uint8 *dst);
+
+/* Audio streams. */
+
+typedef struct SDLEW_AudioStream SDLEW_AudioStream;
+
+typedef struct SDLEW_AudioStreamStats {
+  /* Reads which could not be satisfied, and the silence filled in. */
+  Uint32 underruns;
+  Uint32 underrun_bytes;
+  /* Writes which did not fit, and the bytes dropped. */
+  Uint32 overruns;
+  Uint32 overrun_bytes;
+} SDLEW_AudioStreamStats;
+
+/* Create a lock-free ring of at least capacity bytes between one producer
+ * thread and the audio callback, for audio in the format of spec, which
+ * must have its silence value computed as SDL_OpenAudio() does. Returns
+ * NULL with the SDL error set on failure.
+ */
+SDLEW_AudioStream *sdlewAudioStreamCreate(const SDL_AudioSpec *spec,
+                                          int capacity);
+void sdlewAudioStreamFree(SDLEW_AudioStream *stream);
+
+/* Producer side: queue up to len bytes, whole sample frames only, and
+ * return how many were queued. What does not fit is dropped and counted
+ * as an overrun.
+ */
+int sdlewAudioStreamWrite(SDLEW_AudioStream *stream, const void *data,
+                          int len);
+
+/* Bytes which can be written without overrunning. */
+int sdlewAudioStreamSpace(const SDLEW_AudioStream *stream);
+
+/* Consumer side: take up to len bytes and return how many were taken. */
+int sdlewAudioStreamRead(SDLEW_AudioStream *stream, void *data, int len);
+
+/* Bytes queued for the consumer. */
+int sdlewAudioStreamAvailable(const SDLEW_AudioStream *stream);
+
+/* SDL_AudioSpec callback with the stream as userdata. Missing audio is
+ * filled with silence and counted as an underrun.
+ */
+void SDLCALL sdlewAudioStreamCallback(void *userdata, Uint8 *stream,
+                                      int len);
+
+/* Counters since creation, safe to call from any thread. */
+void sdlewAudioStreamGetStats(const SDLEW_AudioStream *stream,
+                              SDLEW_AudioStreamStats *stats);
+
+/* WAV streaming. */
+
+typedef struct SDLEW_WavReader SDLEW_WavReader;
+
+/* Parse the headers of a WAV file and fill spec like SDL_LoadWAV_RW(),
+ * silence included, without reading the audio data. PCM and MS and IMA
+ * ADPCM are supported, ADPCM decoding to AUDIO_S16LSB. Memory use is
+ * bounded by one ADPCM block. Returns NULL with the SDL error set on
+ * failure, src is closed then too when freesrc is set.
+ */
+SDLEW_WavReader *sdlewWavOpen(SDL_RWops *src, int freesrc,
+                              SDL_AudioSpec *spec);
+void sdlewWavClose(SDLEW_WavReader *reader);
+
+/* Decode up to len bytes, whole sample frames only, into buf. Returns the
+ * number of bytes decoded, 0 at the end of the data, or -1 with the SDL
+ * error set.
+ */
+int sdlewWavRead(SDLEW_WavReader *reader, Uint8 *buf, int len);
+
+/* Decode as much as fits into the stream from the producer thread.
+ * Returns the number of bytes queued or -1 with the SDL error set. When
+ * nothing is queued although sdlewAudioStreamSpace() is not 0, the end of
+ * the data has been reached.
+ */
+int sdlewWavFillStream(SDLEW_WavReader *reader, SDLEW_AudioStream *stream);
+
+/* Go back to the first sample, for instance to loop. Needs a seekable
+ * source. Returns 0 on success and -1 with the SDL error set otherwise.
+ */
+int sdlewWavRewind(SDLEW_WavReader *reader);
+
+/* Callback timing.
+ *
+ * A monitor wraps the callback of an SDL_AudioSpec and records, for every
+ * call, the time since the previous call, the time spent in the callback
+ * and the time left of the buffer period, which is the duration of the
+ * audio requested. Histograms are only written by the audio thread and
+ * can be read from any thread without locking.
+ */
+
+/* Bins 0 to 3 hold 0 to 3 microseconds, each following power of two
+ * range is split into 4 bins. The last bin also holds everything longer.
+ */
+#define SDLEW_AUDIO_HISTOGRAM_BINS 96
+
+typedef struct SDLEW_AudioHistogram {
+  Uint32 bins[SDLEW_AUDIO_HISTOGRAM_BINS];
+  Uint32 count;
+  /* In microseconds, 0 while empty. */
+  Uint32 min_us;
+  Uint32 max_us;
+} SDLEW_AudioHistogram;
+
+typedef struct SDLEW_AudioMonitorStats {
+  Uint32 callbacks;
+  /* Buffer period of the last callback, in microseconds. */
+  Uint32 period_us;
+  /* Callbacks which took longer than the buffer period. */
+  Uint32 overtime;
+  /* Underruns of the watched stream while monitored. */
+  Uint32 underruns;
+  SDLEW_AudioHistogram interval;
+  SDLEW_AudioHistogram busy;
+  SDLEW_AudioHistogram slack;
+} SDLEW_AudioMonitorStats;
+
+typedef struct SDLEW_AudioMonitor SDLEW_AudioMonitor;
+
+/* Called from the audio thread right after a callback which ran overtime
+ * or underran the watched stream, so it should be quick, like copying the
+ * stats for another thread to dump.
+ */
+typedef void (*SDLEW_AudioMonitorHook)(const SDLEW_AudioMonitorStats *stats,
+                                       void *userdata);
+
+/* Create a monitor for spec, which must have its callback set, and
+ * replace the callback and userdata of spec by the monitor ones. spec can
+ * then be passed to SDL_OpenAudio(). Returns NULL with the SDL error set
+ * on failure.
+ */
+SDLEW_AudioMonitor *sdlewAudioMonitorCreate(SDL_AudioSpec *spec);
+
+/* Must only be called once the audio device is closed. */
+void sdlewAudioMonitorFree(SDLEW_AudioMonitor *monitor);
+
+/* The functions below change what the callback uses, so they must be
+ * called before audio is unpaused or with the audio locked.
+ */
+
+/* Use the obtained spec of SDL_OpenAudio() for the buffer period. */
+void sdlewAudioMonitorSetSpec(SDLEW_AudioMonitor *monitor,
+                              const SDL_AudioSpec *obtained);
+
+/* Count the underruns of stream, NULL to stop. */
+void sdlewAudioMonitorWatchStream(SDLEW_AudioMonitor *monitor,
+                                  const SDLEW_AudioStream *stream);
+
+void sdlewAudioMonitorSetUnderrunHook(SDLEW_AudioMonitor *monitor,
+                                      SDLEW_AudioMonitorHook hook,
+                                      void *userdata);
+
+/* The callback installed by sdlewAudioMonitorCreate(). */
+void SDLCALL sdlewAudioMonitorCallback(void *userdata, Uint8 *stream,
+                                       int len);
+
+/* Safe to call from any thread. The histograms may be off by the callback
+ * running concurrently.
+ */
+void sdlewAudioMonitorGetStats(const SDLEW_AudioMonitor *monitor,
+                               SDLEW_AudioMonitorStats *stats);
+
+/* Clear the stats, done by the audio thread at the next callback. */
+void sdlewAudioMonitorResetStats(SDLEW_AudioMonitor *monitor);
+
+/* Upper bound in microseconds of the given fraction of values, e.g. 0.99
+ * for the 99th percentile. Returns 0 for an empty histogram.
+ */
+Uint32 sdlewAudioHistogramPercentile(const SDLEW_AudioHistogram *hist,
+                                     double fraction);
+
+/* Voice mixer.
+ *
+ * A fixed number of voices playing sounds of signed 16 bit samples in
+ * host byte order, mono or interleaved stereo, at the output rate. Voices
+ * are controlled from any thread through a lock-free command queue which
+ * the mixer drains at the start of every buffer, so SDL_LockAudio() is
+ * never needed. Times are counted in output sample frames since the
+ * mixer was created, see sdlewMixerGetTime().
+ */
+
+typedef struct SDLEW_Mixer SDLEW_Mixer;
+
+typedef struct SDLEW_MixerStats {
+  /* Voices playing or waiting for their start time. */
+  int voices;
+  /* Commands which did not fit into the queue. */
+  Uint32 dropped_commands;
+  /* Voices not started because all of them were in use. */
+  Uint32 dropped_voices;
+} SDLEW_MixerStats;
+
+/* Create a mixer for the format and channels of spec, which must be mono
+ * or stereo. max_commands bounds the commands queued between two buffers.
+ * Returns NULL with the SDL error set on failure.
+ */
+SDLEW_Mixer *sdlewMixerCreate(const SDL_AudioSpec *spec, int max_voices,
+                              int max_commands);
+
+/* Must only be called once the audio device is closed. */
+void sdlewMixerFree(SDLEW_Mixer *mixer);
+
+/* Play frames sample frames of sound, which must stay valid until the
+ * voice is done, starting at time when or as soon as possible when it has
+ * passed. A gain of 1 is full volume, pan goes from -1 for left to 1 for
+ * right with an equal power law. Returns the voice handle, never 0, or 0
+ * with the SDL error set when the queue is full.
+ */
+Uint32 sdlewMixerPlay(SDLEW_Mixer *mixer, const Sint16 *sound, int frames,
+                      int channels, int loop, float gain, float pan,
+                      Uint32 when);
+
+/* Stop a voice at time when, or at the next buffer when it has passed.
+ * Returns 0 on success and -1 with the SDL error set when the queue is
+ * full. Stopping a voice which is already done does nothing.
+ */
+int sdlewMixerStop(SDLEW_Mixer *mixer, Uint32 voice, Uint32 when);
+
+/* Move gain and pan linearly to new values over ramp sample frames from
+ * the next buffer on. Returns 0 on success and -1 with the SDL error set
+ * when the queue is full.
+ */
+int sdlewMixerSetGain(SDLEW_Mixer *mixer, Uint32 voice, float gain,
+                      float pan, int ramp);
+
+/* Sample frames rendered so far, which is when the next buffer starts. */
+Uint32 sdlewMixerGetTime(const SDLEW_Mixer *mixer);
+
+/* Render len bytes, for driving the mixer without an audio device. */
+void sdlewMixerRender(SDLEW_Mixer *mixer, Uint8 *stream, int len);
+
+/* SDL_AudioSpec callback with the mixer as userdata. */
+void SDLCALL sdlewMixerCallback(void *userdata, Uint8 *stream, int len);
+
+/* Safe to call from any thread. */
+void sdlewMixerGetStats(const SDLEW_Mixer *mixer, SDLEW_MixerStats *stats);
+
+/* Offline rendering.
+ *
+ * Run the callback of an SDL_AudioSpec without an audio device, as fast as
+ * it goes, for batch rendering and for timing audio code. spec must hold
+ * the format, channels, freq and samples the callback expects, like the
+ * obtained spec of SDL_OpenAudio(). The callback gets buffers of samples
+ * frames prefilled with silence, as it would from SDL.
+ */
+
+typedef struct SDLEW_OfflineStats {
+  Uint32 frames;
+  Uint32 callbacks;
+  /* Wall clock time in total and inside the callback, in microseconds. */
+  Uint64 elapsed_us;
+  Uint64 callback_us;
+  /* Seconds of audio rendered per second of wall clock time. */
+  double realtime_factor;
+} SDLEW_OfflineStats;
+
+/* Render frames sample frames into buf. stats may be NULL. Returns 0 on
+ * success and -1 with the SDL error set otherwise.
+ */
+int sdlewAudioRenderOffline(const SDL_AudioSpec *spec, Uint8 *buf,
+                            Uint32 frames, SDLEW_OfflineStats *stats);
+
+/* Render frames sample frames and write them to dst as they come. Stats
+ * cover what was rendered, also on failure.
+ */
+int sdlewAudioRenderOfflineRW(const SDL_AudioSpec *spec, SDL_RWops *dst,
+                              Uint32 frames, SDLEW_OfflineStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SDL_EW_AUDIO_H__ */
@@ -0,0 +1,375 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Event and input helpers implemented on top of the wrangled SDL API.
+ * All of them require a successful sdlewInit().
+ */
+
+#ifndef __SDL_EW_EVENTS_H__
+#define __SDL_EW_EVENTS_H__
+
+#include "SDL/SDL.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Batched event draining.
+ *
+ * Instead of one SDL_PollEvent() call per event, all pending events are
+ * taken from the SDL queue at once and grouped by kind, so input can be
+ * processed kind by kind in bulk.
+ */
+
+enum {
+  /* SDL_KEYDOWN and SDL_KEYUP. */
+  SDLEW_EVENTS_KEY = 0,
+  /* SDL_MOUSEMOTION. */
+  SDLEW_EVENTS_MOTION = 1,
+  /* SDL_MOUSEBUTTONDOWN and SDL_MOUSEBUTTONUP. */
+  SDLEW_EVENTS_BUTTON = 2,
+  /* All SDL_JOY* events. */
+  SDLEW_EVENTS_JOYSTICK = 3,
+  /* SDL_ACTIVEEVENT, SDL_VIDEORESIZE and SDL_VIDEOEXPOSE. */
+  SDLEW_EVENTS_WINDOW = 4,
+  /* SDL_USEREVENT and above. */
+  SDLEW_EVENTS_USER = 5,
+  /* SDL_QUIT, SDL_SYSWMEVENT and reserved types. */
+  SDLEW_EVENTS_OTHER = 6,
+};
+
+#define SDLEW_NUM_EVENT_KINDS 7
+
+typedef struct SDLEW_EventBuffer SDLEW_EventBuffer;
+
+/* Create a reusable buffer for up to capacity events per drain. Returns
+ * NULL with the SDL error set on failure.
+ */
+SDLEW_EventBuffer *sdlewEventBufferCreate(int capacity);
+void sdlewEventBufferFree(SDLEW_EventBuffer *buffer);
+
+/* Pump events once and take up to cap pending events matching mask, like
+ * SDL_ALLEVENTS, with a single SDL_PeepEvents() call. A cap of 0 or above
+ * the buffer capacity means the capacity. Returns the number of events
+ * left after coalescing, or -1 with the SDL error set.
+ */
+int sdlewDrainEvents(SDLEW_EventBuffer *buffer, int cap, Uint32 mask);
+
+/* Coalescing, done on drained events before they are grouped. */
+enum {
+  /* Merge runs of consecutive SDL_MOUSEMOTION events, not separated by
+   * any other event, into one with the last position and state and the
+   * summed relative motion.
+   */
+  SDLEW_COALESCE_MOTION = 0x1,
+  /* Keep only the last SDL_VIDEORESIZE and SDL_VIDEOEXPOSE event. */
+  SDLEW_COALESCE_WINDOW = 0x2,
+  /* Keep only the last value of every joystick axis between joystick
+   * ball, hat and button events.
+   */
+  SDLEW_COALESCE_JOYAXIS = 0x4,
+  SDLEW_COALESCE_ALL = 0x7,
+};
+
+/* Enable the SDLEW_COALESCE_* stages given in flags, 0 by default. Merged
+ * events take the place of the first event they were merged from, the
+ * order of all other events is kept.
+ */
+void sdlewEventBufferSetCoalesce(SDLEW_EventBuffer *buffer, int flags);
+
+/* Events removed by coalescing in the last drain. */
+int sdlewEventBufferCoalesced(const SDLEW_EventBuffer *buffer);
+
+/* Events of one SDLEW_EVENTS_* kind from the last drain, in the order they
+ * arrived, valid until the next drain.
+ */
+const SDL_Event *sdlewEventSpan(const SDLEW_EventBuffer *buffer, int kind,
+                                int *count);
+
+/* All events from the last drain in the order they arrived. */
+const SDL_Event *sdlewEventsOrdered(const SDLEW_EventBuffer *buffer,
+                                    int *count);
+
+/* User event queue.
+ *
+ * A lock-free queue for SDL_USEREVENT and above, which any number of
+ * threads can push to without the mutex and the 128 event limit of the
+ * SDL queue. Queued events are merged into the drains of an event buffer
+ * the queue is attached to.
+ */
+
+typedef struct SDLEW_UserEventQueue SDLEW_UserEventQueue;
+
+/* Returns NULL with the SDL error set on failure. */
+SDLEW_UserEventQueue *sdlewUserEventQueueCreate(int capacity);
+
+/* Must only be called once no thread pushes anymore and the queue is
+ * detached.
+ */
+void sdlewUserEventQueueFree(SDLEW_UserEventQueue *queue);
+
+/* Queue a copy of event, whose type must be SDL_USEREVENT or above. Safe
+ * to call from any thread. Returns 0 on success and -1 with the SDL error
+ * set when the queue is full, which is counted as an overflow.
+ */
+int sdlewPushUserEvent(SDLEW_UserEventQueue *queue, const SDL_Event *event);
+
+/* Events dropped because the queue was full. */
+Uint32 sdlewUserEventQueueOverflows(const SDLEW_UserEventQueue *queue);
+
+/* Merge queue into the drains of buffer, NULL to detach. Queued events
+ * come after the events from SDL in the ordered list, taken while they
+ * match the drain mask and fit into its cap.
+ */
+void sdlewEventBufferAttachQueue(SDLEW_EventBuffer *buffer,
+                                 SDLEW_UserEventQueue *queue);
+
+/* Recording and replay.
+ *
+ * Recordings are a compact byte stream: a header followed by one record
+ * per event holding the microseconds since the previous record, the event
+ * type and its fields as variable length integers, mouse positions as
+ * differences to the previous ones. Records of batch ends mark the events
+ * which were handled together, like the ones of one drain. Pointers, the
+ * data of user events and the message of SDL_SYSWMEVENT, are not recorded
+ * and replay as NULL.
+ */
+
+typedef struct SDLEW_EventRecorder SDLEW_EventRecorder;
+typedef struct SDLEW_EventReplay SDLEW_EventReplay;
+
+/* Start a recording written to dst, which is closed with the recorder
+ * when freedst is set. Returns NULL with the SDL error set on failure.
+ */
+SDLEW_EventRecorder *sdlewEventRecorderCreate(SDL_RWops *dst, int freedst);
+
+/* Flush and free the recorder. Returns 0 on success and -1 with the SDL
+ * error set when any write failed.
+ */
+int sdlewEventRecorderClose(SDLEW_EventRecorder *recorder);
+
+/* Record an event stamped with the current time. Output is buffered, a
+ * failed write is reported by sdlewEventRecorderClose().
+ */
+void sdlewEventRecord(SDLEW_EventRecorder *recorder, const SDL_Event *event);
+
+/* Record the end of a batch of events. */
+void sdlewEventRecordBatch(SDLEW_EventRecorder *recorder);
+
+/* Record the events of every drain of buffer as a batch, before they are
+ * coalesced. NULL stops recording.
+ */
+void sdlewEventBufferAttachRecorder(SDLEW_EventBuffer *buffer,
+                                    SDLEW_EventRecorder *recorder);
+
+enum {
+  /* Replay events at the pace they were recorded instead of one batch
+   * per call.
+   */
+  SDLEW_REPLAY_REALTIME = 0x1,
+};
+
+/* Replay the recording in data, which must stay valid until the replay is
+ * freed and can be a mapped file. Returns NULL with the SDL error set
+ * when it is not a recording.
+ */
+SDLEW_EventReplay *sdlewEventReplayCreate(const void *data, size_t size,
+                                          int flags);
+
+/* Same as sdlewEventReplayCreate() for the rest of src, read into memory
+ * first.
+ */
+SDLEW_EventReplay *sdlewEventReplayCreateRW(SDL_RWops *src, int freesrc,
+                                            int flags);
+void sdlewEventReplayFree(SDLEW_EventReplay *replay);
+
+/* 1 once all events were replayed, -1 when the recording turned out to be
+ * truncated or corrupt, 0 otherwise.
+ */
+int sdlewEventReplayDone(const SDLEW_EventReplay *replay);
+
+/* Push the next batch of events, or those due in realtime mode, with
+ * SDL_PushEvent(). Stops early when the SDL queue is full, the rest
+ * follows with the next call. Returns the number of events pushed.
+ */
+int sdlewEventReplayPush(SDLEW_EventReplay *replay);
+
+/* Make the drains of buffer take events from replay instead of the SDL
+ * queue, the mask is ignored then. NULL goes back to the SDL queue.
+ */
+void sdlewEventBufferAttachReplay(SDLEW_EventBuffer *buffer,
+                                  SDLEW_EventReplay *replay);
+
+/* Input snapshots.
+ *
+ * The keyboard, mouse and joystick state SDL returns is only safe to use
+ * on the thread handling events. The event thread publishes copies of it
+ * once per pump, which any thread can read without locks, always getting
+ * the state of a single pump.
+ */
+
+#define SDLEW_INPUT_MAX_JOYSTICKS 4
+#define SDLEW_INPUT_MAX_AXES 8
+
+typedef struct SDLEW_InputSnapshot {
+  /* Counts publications, 0 before the first one. */
+  Uint32 sequence;
+  /* SDL_GetTicks() when published. */
+  Uint32 ticks;
+  /* One bit per SDLKey, see sdlewInputKeyDown(). */
+  Uint32 keys[(SDLK_LAST + 31) / 32];
+  SDLMod mod;
+  int mouse_x, mouse_y;
+  /* As returned by SDL_GetMouseState(). */
+  Uint8 mouse_buttons;
+  int num_joysticks;
+  int num_axes[SDLEW_INPUT_MAX_JOYSTICKS];
+  Sint16 axes[SDLEW_INPUT_MAX_JOYSTICKS][SDLEW_INPUT_MAX_AXES];
+} SDLEW_InputSnapshot;
+
+typedef struct SDLEW_InputState SDLEW_InputState;
+
+/* Returns NULL with the SDL error set on failure. */
+SDLEW_InputState *sdlewInputStateCreate(void);
+void sdlewInputStateFree(SDLEW_InputState *state);
+
+/* Opened joysticks whose axes go into the snapshots, up to
+ * SDLEW_INPUT_MAX_JOYSTICKS. Event thread only.
+ */
+void sdlewInputStateSetJoysticks(SDLEW_InputState *state,
+                                 SDL_Joystick *const *joysticks, int num);
+
+/* Capture the current SDL state and publish it. Event thread only. */
+void sdlewInputStatePublish(SDLEW_InputState *state);
+
+/* Publish after every drain of buffer, NULL to stop. */
+void sdlewEventBufferAttachInput(SDLEW_EventBuffer *buffer,
+                                 SDLEW_InputState *state);
+
+/* Copy the last published snapshot, safe to call from any thread. */
+void sdlewInputStateRead(const SDLEW_InputState *state,
+                         SDLEW_InputSnapshot *snapshot);
+
+/* Whether key was down in snapshot. */
+int sdlewInputKeyDown(const SDLEW_InputSnapshot *snapshot, SDLKey key);
+
+/* Joystick snapshots.
+ *
+ * The state of all open joysticks gathered after a single
+ * SDL_JoystickUpdate(), one array per control so the axes of every
+ * joystick can be processed in one pass. Controls past the limits below
+ * are left out.
+ */
+
+#define SDLEW_JOYSTICK_MAX 8
+#define SDLEW_JOYSTICK_MAX_AXES 8
+#define SDLEW_JOYSTICK_MAX_HATS 4
+#define SDLEW_JOYSTICK_MAX_BALLS 2
+/* Buttons past this are left out of the masks. */
+#define SDLEW_JOYSTICK_MAX_BUTTONS 32
+
+typedef struct SDLEW_JoystickSnapshot {
+  /* Axis magnitudes up to this read as 0 in values, set by
+   * sdlewJoystickSnapshotInit().
+   */
+  int deadzone;
+
+  /* Open joysticks, in device index order. */
+  int num_joysticks;
+  int index[SDLEW_JOYSTICK_MAX];
+  SDL_Joystick *joystick[SDLEW_JOYSTICK_MAX];
+  int num_axes[SDLEW_JOYSTICK_MAX];
+  int num_hats[SDLEW_JOYSTICK_MAX];
+  int num_balls[SDLEW_JOYSTICK_MAX];
+  int num_buttons[SDLEW_JOYSTICK_MAX];
+
+  /* Raw axes, and the same with the deadzone removed and scaled to
+   * [-1, 1]. Entries past num_axes are 0.
+   */
+  Sint16 axes[SDLEW_JOYSTICK_MAX][SDLEW_JOYSTICK_MAX_AXES];
+  float values[SDLEW_JOYSTICK_MAX][SDLEW_JOYSTICK_MAX_AXES];
+  /* Bit i set when button i is down. */
+  Uint32 buttons[SDLEW_JOYSTICK_MAX];
+  Uint8 hats[SDLEW_JOYSTICK_MAX][SDLEW_JOYSTICK_MAX_HATS];
+  /* Motion since the previous snapshot. */
+  int ball_dx[SDLEW_JOYSTICK_MAX][SDLEW_JOYSTICK_MAX_BALLS];
+  int ball_dy[SDLEW_JOYSTICK_MAX][SDLEW_JOYSTICK_MAX_BALLS];
+} SDLEW_JoystickSnapshot;
+
+/* Clear snapshot, deadzone being clamped to [0, 32766]. */
+void sdlewJoystickSnapshotInit(SDLEW_JoystickSnapshot *snapshot,
+                               int deadzone);
+
+/* Update the joysticks and fill snapshot with the state of all open
+ * ones, returns their number. Call from the thread handling events.
+ */
+int sdlewJoystickSnapshotAll(SDLEW_JoystickSnapshot *snapshot);
+
+/* Event routing.
+ *
+ * Handlers registered per event type and per key are compiled into flat
+ * tables, so routing an event is a table lookup and one call. Installed
+ * as the SDL event filter the router runs before events are queued and
+ * events its handlers reject never reach the queue.
+ */
+
+typedef struct SDLEW_EventRouter SDLEW_EventRouter;
+
+/* Return 1 to keep event, 0 to drop it. */
+typedef int (*SDLEW_EventHandler)(const SDL_Event *event, void *userdata);
+
+/* Returns NULL with the SDL error set on failure. Without handlers every
+ * event is kept.
+ */
+SDLEW_EventRouter *sdlewEventRouterCreate(void);
+/* Uninstalls router first when installed. */
+void sdlewEventRouterFree(SDLEW_EventRouter *router);
+
+/* Whether events without a handler are kept, 1 by default. */
+void sdlewEventRouterSetDefault(SDLEW_EventRouter *router, int keep);
+
+/* Route events of type to handler, NULL to remove it. Key handlers take
+ * precedence over the SDL_KEYDOWN and SDL_KEYUP handlers for their key,
+ * and get both. Changes take effect on the next compile. Return 0 on
+ * success, -1 with the SDL error set.
+ */
+int sdlewEventRouterOnType(SDLEW_EventRouter *router, Uint8 type,
+                           SDLEW_EventHandler handler, void *userdata);
+int sdlewEventRouterOnKey(SDLEW_EventRouter *router, SDLKey key,
+                          SDLEW_EventHandler handler, void *userdata);
+
+/* Rebuild the tables from the registered handlers. Not while router may
+ * be dispatching events.
+ */
+void sdlewEventRouterCompile(SDLEW_EventRouter *router);
+
+/* Route event as compiled, returns what its handler returned. */
+int sdlewEventRouterDispatch(const SDLEW_EventRouter *router,
+                             const SDL_Event *event);
+
+/* Compile router and make it the SDL event filter, NULL restores the
+ * filter which was set before. One router is installed at a time. Call
+ * while no events are pumped.
+ */
+void sdlewEventRouterInstall(SDLEW_EventRouter *router);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SDL_EW_EVENTS_H__ */
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* OpenGL texture uploads of SDL surfaces.
+ *
+ * GL entry points are resolved with SDL_GL_GetProcAddress(), so neither
+ * sdlew nor this header depend on the GL headers: GL types are spelled as
+ * the C types they are defined to. All functions must be called from the
+ * thread owning the current GL context.
+ */
+
+#ifndef __SDL_EW_GL_H__
+#define __SDL_EW_GL_H__
+
+#include "SDL/SDL.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#  define SDLEW_GLAPI __stdcall
+#else
+#  define SDLEW_GLAPI
+#endif
+
+/* Entry points used for uploading, with the GL names minus the gl
+ * prefix. The buffer object ones are only used when all of them are set
+ * and GL_ARB_pixel_buffer_object is in the extension string.
+ */
+typedef struct SDLEW_GLFunctions {
+  const unsigned char *(SDLEW_GLAPI *GetString)(unsigned int name);
+  void (SDLEW_GLAPI *GetIntegerv)(unsigned int pname, int *params);
+  void (SDLEW_GLAPI *PixelStorei)(unsigned int pname, int param);
+  void (SDLEW_GLAPI *BindTexture)(unsigned int target, unsigned int texture);
+  void (SDLEW_GLAPI *TexSubImage2D)(unsigned int target, int level,
+                                    int xoffset, int yoffset,
+                                    int width, int height,
+                                    unsigned int format, unsigned int type,
+                                    const void *pixels);
+
+  void (SDLEW_GLAPI *GenBuffersARB)(int n, unsigned int *buffers);
+  void (SDLEW_GLAPI *DeleteBuffersARB)(int n, const unsigned int *buffers);
+  void (SDLEW_GLAPI *BindBufferARB)(unsigned int target, unsigned int buffer);
+  void (SDLEW_GLAPI *BufferDataARB)(unsigned int target, ptrdiff_t size,
+                                    const void *data, unsigned int usage);
+  void *(SDLEW_GLAPI *MapBufferARB)(unsigned int target, unsigned int access);
+  unsigned char (SDLEW_GLAPI *UnmapBufferARB)(unsigned int target);
+} SDLEW_GLFunctions;
+
+/* Use the given entry points instead of the ones of the current context,
+ * for instance a mock or a software implementation. NULL goes back to
+ * resolving them on the next upload. Staging buffers are released first.
+ */
+void sdlewGLSetFunctions(const SDLEW_GLFunctions *functions);
+
+/* Internal format to allocate textures for surface with, GL_RGB8 for
+ * surfaces without alpha so padding bits uploaded with them never show
+ * up as alpha, GL_RGBA8 otherwise.
+ */
+unsigned int sdlewGLInternalFormat(const SDL_Surface *surface);
+
+/* Upload rect of the surface, NULL meaning all of it, into the same
+ * position of the 2D texture, which must already be allocated large
+ * enough with sdlewGLInternalFormat(). Surfaces whose masks match a GL
+ * packed pixel format are uploaded as they are, others are converted to
+ * RGBA bytes on the way. Staging
+ * happens in a ring of pixel buffer objects when available, otherwise
+ * matching surfaces are passed to GL directly. Texture binding and unpack
+ * state are restored afterwards. Returns 0 on success and -1 with the SDL
+ * error set otherwise.
+ */
+int sdlewGLUploadSurface(SDL_Surface *surface, unsigned int texture,
+                         const SDL_Rect *rect);
+
+/* Delete the staging buffers, to be called while the context is still
+ * current before it gets destroyed, SDL_SetVideoMode() included.
+ */
+void sdlewGLReleaseBuffers(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SDL_EW_GL_H__ */
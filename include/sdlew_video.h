@@ -0,0 +1,321 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Software video helpers implemented on top of the wrangled SDL API.
+ * All of them require a successful sdlewInit().
+ */
+
+#ifndef __SDL_EW_VIDEO_H__
+#define __SDL_EW_VIDEO_H__
+
+#include "SDL/SDL.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Surface stretching. */
+
+enum {
+  SDLEW_STRETCH_NEAREST = 0,
+  SDLEW_STRETCH_BILINEAR = 1,
+  SDLEW_STRETCH_BOX = 2,
+
+  /* May be OR'ed with the filter to split the work into row bands
+   * processed by the sdlew thread pool.
+   */
+  SDLEW_STRETCH_PARALLEL = 0x100,
+};
+
+/* Stretch srcrect of src into dstrect of dst, NULL meaning the whole
+ * surface. Unlike SDL_SoftStretch() the surfaces may have different
+ * pixel formats. Filtering happens in 8 bit RGBA, colour keys are not
+ * taken into account. Returns 0 on success and -1 with the SDL error
+ * set otherwise.
+ */
+int sdlewStretch(SDL_Surface *src, const SDL_Rect *srcrect,
+                 SDL_Surface *dst, const SDL_Rect *dstrect,
+                 int filter);
+
+/* Release the cached filter coefficient tables. */
+void sdlewStretchFlushCache(void);
+
+/* YUV overlay conversion. */
+
+enum {
+  SDLEW_YUV_BT601 = 0,
+  SDLEW_YUV_BT709 = 1,
+
+  /* May be OR'ed with the matrix to convert row bands in parallel. */
+  SDLEW_YUV_PARALLEL = 0x100,
+};
+
+/* Convert an overlay in any of the SDL_*_OVERLAY formats into dst with
+ * the top-left corner at dstrect (NULL meaning the origin), without
+ * scaling. Limited range input is assumed. 32 bit destinations with 8 bit
+ * channels and 16 bit RGB destinations take the SIMD path, other formats
+ * are supported but slower. The last pixel of an odd row or column reuses
+ * the chroma before it, overlays smaller than one chroma sample are
+ * rejected. Returns 0 on success and -1 with the SDL error set otherwise.
+ */
+int sdlewConvertYUVOverlay(SDL_Overlay *overlay, SDL_Surface *dst,
+                           const SDL_Rect *dstrect, int flags);
+
+/* Surface pool.
+ *
+ * Recycles scratch surfaces keyed by size, depth and channel masks. Pixel
+ * storage is aligned to 64 bytes with rows padded to 16 bytes. Surfaces
+ * stay owned by the pool: hand them back with sdlewSurfacePoolRelease()
+ * or sdlewSurfacePoolReset(), never with SDL_FreeSurface(). Colour key,
+ * per-surface alpha and clip rectangle are restored on recycling, palettes
+ * of 8 bit surfaces are not. A pool must only be used from one thread.
+ */
+
+typedef struct SDLEW_SurfacePool SDLEW_SurfacePool;
+
+typedef struct SDLEW_SurfacePoolStats {
+  unsigned int acquires;
+  /* Acquires served from a recycled surface, and the ones which were not. */
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int releases;
+  unsigned int evictions;
+  unsigned int frames;
+  unsigned int surfaces_in_use;
+  unsigned int surfaces_free;
+  size_t bytes_allocated;
+} SDLEW_SurfacePoolStats;
+
+/* Free surfaces not requested for more than max_idle_frames resets are
+ * destroyed, 0 keeps them forever.
+ */
+SDLEW_SurfacePool *sdlewSurfacePoolCreate(unsigned int max_idle_frames);
+void sdlewSurfacePoolDestroy(SDLEW_SurfacePool *pool);
+
+SDL_Surface *sdlewSurfacePoolAcquire(SDLEW_SurfacePool *pool,
+                                     int width, int height, int depth,
+                                     Uint32 Rmask, Uint32 Gmask,
+                                     Uint32 Bmask, Uint32 Amask);
+void sdlewSurfacePoolRelease(SDLEW_SurfacePool *pool, SDL_Surface *surface);
+
+/* End of frame: every surface still acquired returns to the pool. */
+void sdlewSurfacePoolReset(SDLEW_SurfacePool *pool);
+
+void sdlewSurfacePoolGetStats(const SDLEW_SurfacePool *pool,
+                              SDLEW_SurfacePoolStats *stats);
+
+/* Dirty region tracking.
+ *
+ * Rectangles marked while drawing are accumulated in a bitmap of
+ * tile_size square tiles and turned into a small set of merged
+ * rectangles once per frame. Two rectangles are merged when their union
+ * adds fewer clean pixels than the merge cost, which stands for the
+ * overhead of pushing one more rectangle.
+ */
+
+typedef struct SDLEW_DirtyRegion SDLEW_DirtyRegion;
+
+typedef struct SDLEW_DirtyStats {
+  unsigned int frames;
+  unsigned int rects_marked;
+  unsigned int rects_pushed;
+  /* Pixels of dirty tiles when flushed, however often they were marked,
+   * so pixels_pushed - pixels_marked is what merging added.
+   */
+  Uint64 pixels_marked;
+  Uint64 pixels_pushed;
+} SDLEW_DirtyStats;
+
+/* A tile_size of 0 picks the default of 16 pixels. */
+SDLEW_DirtyRegion *sdlewDirtyCreate(int width, int height, int tile_size);
+void sdlewDirtyDestroy(SDLEW_DirtyRegion *region);
+
+/* Pixels a rectangle is worth, 1024 by default. */
+void sdlewDirtySetMergeCost(SDLEW_DirtyRegion *region, int pixels);
+
+/* Mark a rectangle as dirty, NULL marks everything. */
+void sdlewDirtyMark(SDLEW_DirtyRegion *region, const SDL_Rect *rect);
+
+/* Compute the merged rectangles and clear the region. The array stays
+ * owned by the region and is valid until the next call. Returns the
+ * number of rectangles, or -1 with the SDL error set.
+ */
+int sdlewDirtyGetRects(SDLEW_DirtyRegion *region, SDL_Rect **rects);
+
+/* sdlewDirtyGetRects() followed by one SDL_UpdateRects() call. */
+int sdlewDirtyFlush(SDLEW_DirtyRegion *region, SDL_Surface *screen);
+
+void sdlewDirtyGetStats(const SDLEW_DirtyRegion *region,
+                        SDLEW_DirtyStats *stats);
+void sdlewDirtyResetStats(SDLEW_DirtyRegion *region);
+
+/* Batch colour mapping.
+ *
+ * Colours are passed as count groups of R, G, B, A bytes and pixels as
+ * Uint32 values, like SDL_MapRGBA() returns them. Truecolour results are
+ * identical to the libSDL calls. Palettized surfaces map through an
+ * inverse palette with 5 bits per channel, built on first use and rebuilt
+ * once the surface format_version or palette changes, so results may
+ * differ from SDL_MapRGB() for colours in between palette entries.
+ */
+
+/* Like SDL_MapRGB(), alpha bytes are ignored. */
+void sdlewMapRGBArray(const SDL_Surface *surface, const Uint8 *rgba,
+                      Uint32 *pixels, int count);
+void sdlewMapRGBAArray(const SDL_Surface *surface, const Uint8 *rgba,
+                       Uint32 *pixels, int count);
+void sdlewGetRGBAArray(const SDL_Surface *surface, const Uint32 *pixels,
+                       Uint8 *rgba, int count);
+
+/* Release the cached inverse palettes. */
+void sdlewColorFlushCache(void);
+
+/* Memory mapped BMP loading.
+ *
+ * Uncompressed 8, 16, 24 and 32 bit files are mapped copy-on-write and
+ * the surface pixels point into the mapping. Bottom-up files are flipped
+ * once inside the mapping, since a surface pitch can not be negative.
+ * Other files are loaded with SDL_LoadBMP_RW(). Either way the surface
+ * must be freed with sdlewFreeMappedSurface(), which unmaps the file once
+ * the last reference is gone.
+ */
+SDL_Surface *sdlewLoadBMPMapped(const char *path);
+void sdlewFreeMappedSurface(SDL_Surface *surface);
+
+/* Asynchronous loading.
+ *
+ * A loader thread reads requested files or RWops into memory ahead of a
+ * set of worker threads which decode them and convert them to the pixel
+ * format given at creation, like SDL_DisplayFormat() would. Finished
+ * surfaces are handed to the application by sdlewLoaderDrain(), usually
+ * called once per frame. Higher priorities are read and decoded first.
+ */
+
+typedef struct SDLEW_Loader SDLEW_Loader;
+
+/* Decode a file read into memory, called from worker threads. */
+typedef SDL_Surface *(*SDLEW_LoaderDecodeFunc)(const void *data, size_t size,
+                                               void *userdata);
+
+/* Receives the surface, owned by the callback from now on, or NULL and
+ * the error message when loading failed.
+ */
+typedef void (*SDLEW_LoaderCallback)(int id, SDL_Surface *surface,
+                                     const char *error, void *userdata);
+
+/* The format is copied, palettes are referenced and must outlive the
+ * loader. A NULL format keeps surfaces as decoded, num_workers of 0 uses
+ * one worker per core.
+ */
+SDLEW_Loader *sdlewLoaderCreate(const SDL_PixelFormat *format,
+                                int num_workers);
+
+/* Pending requests are cancelled, undrained surfaces freed. */
+void sdlewLoaderDestroy(SDLEW_Loader *loader);
+
+/* Replace the BMP decoder, NULL restores it. */
+void sdlewLoaderSetDecoder(SDLEW_Loader *loader, SDLEW_LoaderDecodeFunc decode,
+                           void *userdata);
+
+/* Returns the request id, or -1 with the SDL error set. RWops are read
+ * from the loader thread and must not be used until the request is
+ * drained or cancelled.
+ */
+int sdlewLoaderRequest(SDLEW_Loader *loader, const char *path, int priority,
+                       void *userdata);
+int sdlewLoaderRequestRW(SDLEW_Loader *loader, SDL_RWops *rw, int freesrc,
+                         int priority, void *userdata);
+
+/* Only affects requests still waiting to be read or decoded. */
+int sdlewLoaderSetPriority(SDLEW_Loader *loader, int id, int priority);
+
+/* Cancelled requests are never drained. A request being read is waited
+ * for, so its RWops is no longer used once this returns. Returns -1 for
+ * requests already drained or cancelled.
+ */
+int sdlewLoaderCancel(SDLEW_Loader *loader, int id);
+
+/* Invoke the callback for finished requests until none is left or
+ * budget_ms passed, 0 meaning no limit. At least one request is drained if
+ * any finished. Returns the number of requests drained.
+ */
+int sdlewLoaderDrain(SDLEW_Loader *loader, Uint32 budget_ms,
+                     SDLEW_LoaderCallback callback);
+
+/* Requests neither drained nor cancelled yet. */
+int sdlewLoaderPending(SDLEW_Loader *loader);
+
+/* Pre-encoded sprites.
+ *
+ * A sprite stores the visible pixels of a surface as runs per row,
+ * converted to the destination format once. Colour keyed pixels and
+ * pixels with zero alpha are skipped, translucent ones are blended using
+ * per-pixel alpha, or the per-surface alpha of surfaces without an alpha
+ * channel. Unlike SDL_RLEACCEL the encoding survives locking, and it can
+ * be saved to disk. Sprites only blit onto surfaces with the pixel format
+ * they were encoded for, the palette included.
+ */
+
+typedef struct SDLEW_Sprite SDLEW_Sprite;
+
+/* Returns NULL with the SDL error set on failure. */
+SDLEW_Sprite *sdlewSpriteCreate(SDL_Surface *src,
+                                const SDL_PixelFormat *format);
+void sdlewSpriteFree(SDLEW_Sprite *sprite);
+
+void sdlewSpriteGetSize(const SDLEW_Sprite *sprite, int *w, int *h);
+
+/* Same clipping and dstrect update as SDL_BlitSurface(). Opaque and
+ * translucent pixels both keep the destination alpha channel. Returns 0 on
+ * success and -1 with the SDL error set otherwise.
+ */
+int sdlewSpriteBlit(const SDLEW_Sprite *sprite, const SDL_Rect *srcrect,
+                    SDL_Surface *dst, SDL_Rect *dstrect);
+
+/* Files only load on hosts with the byte order they were saved on. */
+int sdlewSpriteSave(const SDLEW_Sprite *sprite, SDL_RWops *dst);
+SDLEW_Sprite *sdlewSpriteLoad(SDL_RWops *src, int freesrc);
+
+/* Software gamma.
+ *
+ * Applies ramps in the format of SDL_SetGammaRamp() to pixels, for video
+ * drivers without hardware gamma. A NULL ramp leaves its channel alone and
+ * alpha is never changed. Only the high 8 bits of ramp entries are used.
+ * Palettized surfaces are corrected in place by remapping every index to
+ * the closest corrected palette colour.
+ */
+
+/* Correct rect of surface in place, NULL meaning the clip rectangle.
+ * Returns 0 on success and -1 with the SDL error set otherwise.
+ */
+int sdlewApplyGammaRamp(SDL_Surface *surface, const SDL_Rect *rect,
+                        const Uint16 *red, const Uint16 *green,
+                        const Uint16 *blue);
+
+/* Copy like SDL_BlitSurface() without colour key or alpha blending,
+ * correcting the pixels on the way. The surfaces may have different
+ * formats but must not be the same.
+ */
+int sdlewBlitGammaRamp(SDL_Surface *src, const SDL_Rect *srcrect,
+                       SDL_Surface *dst, SDL_Rect *dstrect,
+                       const Uint16 *red, const Uint16 *green,
+                       const Uint16 *blue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __SDL_EW_VIDEO_H__ */
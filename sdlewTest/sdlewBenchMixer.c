@@ -0,0 +1,114 @@
+/* Mixer benchmark.
+ *
+ * Renders ten seconds of an increasing number of looping voices through
+ * sdlewAudioRenderOffline() with the mixer callback, half of them mono and
+ * half stereo, all at different gains and pans. Prints the time spent per
+ * buffer and the voice milliseconds mixed per millisecond of callback time,
+ * which is also how many voices would play in real time on one core. No
+ * SDL library is needed.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdlew_audio.h"
+
+#ifndef M_PI
+#  define M_PI 3.14159265358979323846
+#endif
+
+#define FREQ 44100
+#define SAMPLES 512
+#define SECONDS 10
+#define SOUND_FRAMES 44100
+#define MAX_VOICES 256
+
+static Sint16 mono[SOUND_FRAMES];
+static Sint16 stereo[SOUND_FRAMES * 2];
+
+static void make_sounds(void) {
+  int i;
+
+  for (i = 0; i < SOUND_FRAMES; i++) {
+    const double t = (double)i / FREQ;
+    mono[i] = (Sint16)(8000.0 * sin(2.0 * M_PI * 440.0 * t));
+    stereo[i * 2] = (Sint16)(8000.0 * sin(2.0 * M_PI * 660.0 * t));
+    stereo[i * 2 + 1] = (Sint16)(8000.0 * sin(2.0 * M_PI * 880.0 * t));
+  }
+}
+
+static int run(int voices, Uint8 *buf) {
+  SDL_AudioSpec spec;
+  SDLEW_Mixer *mixer;
+  SDLEW_OfflineStats stats;
+  double callback_ms, voices_per_ms;
+  int i;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.freq = FREQ;
+  spec.format = AUDIO_S16SYS;
+  spec.channels = 2;
+  spec.samples = SAMPLES;
+
+  mixer = sdlewMixerCreate(&spec, voices, voices);
+  if (mixer == NULL) {
+    printf("%d voices: could not create the mixer\n", voices);
+    return -1;
+  }
+  spec.callback = sdlewMixerCallback;
+  spec.userdata = mixer;
+
+  for (i = 0; i < voices; i++) {
+    const float gain = 0.5f + 0.5f * i / voices;
+    const float pan = 2.0f * i / voices - 1.0f;
+    /* Staggered so voices do not all wrap around in the same buffer. */
+    const Uint32 when = (Uint32)(i * 97 % SAMPLES);
+
+    if (i & 1) {
+      sdlewMixerPlay(mixer, stereo, SOUND_FRAMES, 2, 1, gain, pan, when);
+    }
+    else {
+      sdlewMixerPlay(mixer, mono, SOUND_FRAMES, 1, 1, gain, pan, when);
+    }
+  }
+
+  if (sdlewAudioRenderOffline(&spec, buf, FREQ * SECONDS, &stats) != 0) {
+    printf("%d voices: rendering failed\n", voices);
+    sdlewMixerFree(mixer);
+    return -1;
+  }
+  sdlewMixerFree(mixer);
+
+  callback_ms = stats.callback_us > 0 ? stats.callback_us / 1000.0 : 0.001;
+  voices_per_ms = voices * (SECONDS * 1000.0) / callback_ms;
+  printf("%6d %10.2f %14.0f %14.0f\n", voices,
+         stats.callback_us / (double)stats.callbacks,
+         stats.realtime_factor, voices_per_ms);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  Uint8 *buf;
+  int voices;
+
+  (void)argc;
+  (void)argv;
+
+  make_sounds();
+  buf = (Uint8 *)malloc(FREQ * SECONDS * 4);
+
+  printf("%d Hz stereo S16, %d frame buffers, %d s\n", FREQ, SAMPLES,
+         SECONDS);
+  printf("%6s %10s %14s %14s\n", "voices", "us/buffer", "realtime",
+         "voice ms/ms");
+  for (voices = 1; voices <= MAX_VOICES; voices *= 4) {
+    if (run(voices, buf) != 0) {
+      free(buf);
+      return EXIT_FAILURE;
+    }
+  }
+
+  free(buf);
+  return EXIT_SUCCESS;
+}
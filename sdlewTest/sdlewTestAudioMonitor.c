@@ -0,0 +1,125 @@
+/* Headless check of the audio callback monitor.
+ *
+ * Runs a monitored stream callback on SDL's dummy audio driver, which
+ * calls back once per buffer period without any sound hardware. The
+ * stream is fed one second of audio and then runs dry, so underruns must
+ * be counted and reported through the hook. Exits with 77, counted as
+ * skipped, when SDL 1.2 is not available.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdlew.h"
+#include "sdlew_audio.h"
+
+#define SKIP 77
+
+#define FREQ 22050
+#define SAMPLES 512
+#define FEED_MS 1000
+#define RUN_MS 1500
+
+static volatile int hook_calls = 0;
+static volatile Uint32 hook_underruns = 0;
+
+static void underrun_hook(const SDLEW_AudioMonitorStats *stats,
+                          void *userdata) {
+  (void)userdata;
+  hook_calls++;
+  hook_underruns = stats->underruns;
+}
+
+static int failures = 0;
+
+static void expect(const char *name, int ok) {
+  printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+int main(int argc, char **argv) {
+  static char driver[] = "SDL_AUDIODRIVER=dummy";
+  SDL_AudioSpec spec;
+  SDLEW_AudioStream *stream;
+  SDLEW_AudioMonitor *monitor;
+  SDLEW_AudioMonitorStats stats;
+  Sint16 *feed;
+  Uint32 expected_period, median;
+  int feed_bytes;
+
+  (void)argc;
+  (void)argv;
+
+  if (sdlewInit() != SDLEW_SUCCESS) {
+    printf("SDL-1.2 was not found, skipping\n");
+    return SKIP;
+  }
+  SDL_putenv(driver);
+  if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+    printf("No dummy audio driver (%s), skipping\n", SDL_GetError());
+    return SKIP;
+  }
+
+  memset(&spec, 0, sizeof(spec));
+  spec.freq = FREQ;
+  spec.format = AUDIO_S16SYS;
+  spec.channels = 2;
+  spec.samples = SAMPLES;
+  spec.silence = 0;
+  spec.callback = sdlewAudioStreamCallback;
+
+  feed_bytes = FREQ * FEED_MS / 1000 * 4;
+  stream = sdlewAudioStreamCreate(&spec, feed_bytes);
+  spec.userdata = stream;
+  monitor = stream != NULL ? sdlewAudioMonitorCreate(&spec) : NULL;
+  if (monitor == NULL) {
+    printf("Setup failed: %s\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+  sdlewAudioMonitorWatchStream(monitor, stream);
+  sdlewAudioMonitorSetUnderrunHook(monitor, underrun_hook, NULL);
+
+  if (SDL_OpenAudio(&spec, NULL) < 0) {
+    printf("No dummy audio driver (%s), skipping\n", SDL_GetError());
+    SDL_Quit();
+    return SKIP;
+  }
+  /* NULL obtained, SDL converts to spec and fills in its buffer size. */
+  sdlewAudioMonitorSetSpec(monitor, &spec);
+  expected_period = (Uint32)((Uint64)spec.samples * 1000000 / spec.freq);
+
+  feed = (Sint16 *)calloc(1, feed_bytes);
+  sdlewAudioStreamWrite(stream, feed, feed_bytes);
+  free(feed);
+
+  SDL_PauseAudio(0);
+  SDL_Delay(RUN_MS);
+  SDL_CloseAudio();
+
+  sdlewAudioMonitorGetStats(monitor, &stats);
+  median = sdlewAudioHistogramPercentile(&stats.interval, 0.5);
+  printf("callbacks %u period %u us median interval %u us "
+         "underruns %u hook calls %d\n",
+         stats.callbacks, stats.period_us, median, stats.underruns,
+         hook_calls);
+
+  /* Callbacks follow the buffer period, leaving room for a loaded
+   * machine and the driver filling its first buffers early.
+   */
+  expect("callback count",
+         stats.callbacks >= (Uint32)(RUN_MS * 1000 / expected_period / 2) &&
+         stats.callbacks <= (Uint32)(RUN_MS * 1000 / expected_period * 2));
+  expect("period", stats.period_us == expected_period);
+  expect("median interval",
+         median >= expected_period / 2 && median <= expected_period * 2);
+  expect("underruns counted", stats.underruns > 0);
+  expect("underrun hook", hook_calls > 0 && hook_underruns > 0);
+
+  sdlewAudioMonitorFree(monitor);
+  sdlewAudioStreamFree(stream);
+  SDL_Quit();
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,305 @@
+/* Texture upload check against a mock GL.
+ *
+ * Surfaces are built by hand so no SDL library is needed. The mock
+ * records the format and type of every glTexSubImage2D() call together
+ * with the rows it was given, following the unpack row length and the
+ * bound pixel buffer like GL does.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdlew_gl.h"
+
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#define GL_EXTENSIONS 0x1F03
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_RGBA 0x1908
+#define GL_BGRA 0x80E1
+#define GL_RGB8 0x8051
+#define GL_RGBA8 0x8058
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#define GL_UNSIGNED_SHORT_1_5_5_5_REV 0x8366
+
+#define WIDTH 8
+#define HEIGHT 4
+
+static const char *extensions;
+static int row_length;
+static Uint8 *buffer;
+static unsigned int bound_buffer;
+
+static unsigned int upload_format, upload_type;
+static int upload_w, upload_h;
+static Uint8 uploaded[WIDTH * HEIGHT * 4];
+
+static const unsigned char *SDLEW_GLAPI mock_GetString(unsigned int name) {
+  return (const unsigned char *)(name == GL_EXTENSIONS ? extensions : "");
+}
+
+static void SDLEW_GLAPI mock_GetIntegerv(unsigned int pname, int *params) {
+  *params = pname == GL_UNPACK_ROW_LENGTH ? row_length : 0;
+}
+
+static void SDLEW_GLAPI mock_PixelStorei(unsigned int pname, int param) {
+  if (pname == GL_UNPACK_ROW_LENGTH) {
+    row_length = param;
+  }
+}
+
+static void SDLEW_GLAPI mock_BindTexture(unsigned int target,
+                                         unsigned int texture) {
+  (void)target;
+  (void)texture;
+}
+
+static void SDLEW_GLAPI mock_TexSubImage2D(unsigned int target, int level,
+                                           int xoffset, int yoffset,
+                                           int width, int height,
+                                           unsigned int format,
+                                           unsigned int type,
+                                           const void *pixels) {
+  const int bpp = type == GL_UNSIGNED_SHORT_1_5_5_5_REV ? 2 : 4;
+  const Uint8 *src = bound_buffer != 0 ? buffer : (const Uint8 *)pixels;
+  const int pitch = (row_length != 0 ? row_length : width) * bpp;
+  int y;
+
+  (void)target;
+  (void)level;
+  (void)xoffset;
+  (void)yoffset;
+
+  upload_format = format;
+  upload_type = type;
+  upload_w = width;
+  upload_h = height;
+  for (y = 0; y < height; y++) {
+    memcpy(uploaded + y * width * bpp, src + y * pitch, width * bpp);
+  }
+}
+
+static void SDLEW_GLAPI mock_GenBuffersARB(int n, unsigned int *buffers) {
+  int i;
+  for (i = 0; i < n; i++) {
+    buffers[i] = i + 1;
+  }
+}
+
+static void SDLEW_GLAPI mock_DeleteBuffersARB(int n,
+                                              const unsigned int *buffers) {
+  (void)n;
+  (void)buffers;
+}
+
+static void SDLEW_GLAPI mock_BindBufferARB(unsigned int target,
+                                           unsigned int id) {
+  (void)target;
+  bound_buffer = id;
+}
+
+static void SDLEW_GLAPI mock_BufferDataARB(unsigned int target,
+                                           ptrdiff_t size, const void *data,
+                                           unsigned int usage) {
+  (void)target;
+  (void)data;
+  (void)usage;
+  free(buffer);
+  buffer = (Uint8 *)malloc(size);
+}
+
+static void *SDLEW_GLAPI mock_MapBufferARB(unsigned int target,
+                                           unsigned int access) {
+  (void)target;
+  (void)access;
+  return buffer;
+}
+
+static unsigned char SDLEW_GLAPI mock_UnmapBufferARB(unsigned int target) {
+  (void)target;
+  return 1;
+}
+
+static int mask_shift(Uint32 mask) {
+  int shift = 0;
+  while (mask != 0 && (mask & 1) == 0) {
+    mask >>= 1;
+    shift++;
+  }
+  return shift;
+}
+
+static int mask_loss(Uint32 mask) {
+  int bits = 0;
+  mask >>= mask_shift(mask);
+  while (mask & 1) {
+    mask >>= 1;
+    bits++;
+  }
+  return 8 - bits;
+}
+
+static void make_surface(SDL_Surface *surface, SDL_PixelFormat *format,
+                         Uint8 *pixels, int bpp, Uint32 Rmask, Uint32 Gmask,
+                         Uint32 Bmask, Uint32 Amask) {
+  int i;
+
+  memset(format, 0, sizeof(*format));
+  format->BitsPerPixel = (Uint8)(bpp * 8);
+  format->BytesPerPixel = (Uint8)bpp;
+  format->Rmask = Rmask;
+  format->Gmask = Gmask;
+  format->Bmask = Bmask;
+  format->Amask = Amask;
+  format->Rshift = (Uint8)mask_shift(Rmask);
+  format->Gshift = (Uint8)mask_shift(Gmask);
+  format->Bshift = (Uint8)mask_shift(Bmask);
+  format->Ashift = (Uint8)mask_shift(Amask);
+  format->Rloss = (Uint8)mask_loss(Rmask);
+  format->Gloss = (Uint8)mask_loss(Gmask);
+  format->Bloss = (Uint8)mask_loss(Bmask);
+  format->Aloss = (Uint8)(Amask != 0 ? mask_loss(Amask) : 8);
+
+  memset(surface, 0, sizeof(*surface));
+  surface->format = format;
+  surface->w = WIDTH;
+  surface->h = HEIGHT;
+  /* Padded rows, so direct uploads need the unpack row length. */
+  surface->pitch = (Uint16)((WIDTH + 2) * bpp);
+  surface->pixels = pixels;
+  for (i = 0; i < surface->pitch * HEIGHT; i++) {
+    pixels[i] = (Uint8)(i * 7 + 3);
+  }
+  surface->clip_rect.w = WIDTH;
+  surface->clip_rect.h = HEIGHT;
+}
+
+/* Uploaded rows must be the surface rows of rect as they are. */
+static int check_direct(const SDL_Surface *surface, const SDL_Rect *rect) {
+  const int bpp = surface->format->BytesPerPixel;
+  int y;
+
+  for (y = 0; y < rect->h; y++) {
+    const Uint8 *src = (const Uint8 *)surface->pixels +
+                       (rect->y + y) * surface->pitch + rect->x * bpp;
+    if (memcmp(uploaded + y * rect->w * bpp, src, rect->w * bpp) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Uploaded rows must be RGBA bytes with opaque alpha. */
+static int check_rgba(const SDL_Surface *surface, const SDL_Rect *rect) {
+  const SDL_PixelFormat *format = surface->format;
+  int x, y;
+
+  for (y = 0; y < rect->h; y++) {
+    const Uint32 *src = (const Uint32 *)((const Uint8 *)surface->pixels +
+                                         (rect->y + y) * surface->pitch);
+    for (x = 0; x < rect->w; x++) {
+      const Uint32 pixel = src[rect->x + x];
+      const Uint8 *dst = uploaded + (y * rect->w + x) * 4;
+      if (dst[0] != (Uint8)(pixel >> format->Rshift) ||
+          dst[1] != (Uint8)(pixel >> format->Gshift) ||
+          dst[2] != (Uint8)(pixel >> format->Bshift) || dst[3] != 255)
+      {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int failures = 0;
+
+static void expect(const char *name, int ok) {
+  printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void run(const char *path) {
+  static Uint32 storage[(WIDTH + 2) * HEIGHT];
+  SDL_Surface surface;
+  SDL_PixelFormat format;
+  SDL_Rect rect;
+  char name[64];
+
+  rect.x = 1;
+  rect.y = 1;
+  rect.w = WIDTH - 3;
+  rect.h = HEIGHT - 1;
+
+  /* XRGB8888, what SDL_DisplayFormat() gives on most displays. */
+  make_surface(&surface, &format, (Uint8 *)storage, 4,
+               0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  sprintf(name, "%s xrgb8888 direct", path);
+  expect(name, sdlewGLUploadSurface(&surface, 1, &rect) == 0 &&
+               upload_format == GL_BGRA &&
+               upload_type == GL_UNSIGNED_INT_8_8_8_8_REV &&
+               upload_w == rect.w && upload_h == rect.h &&
+               check_direct(&surface, &rect) &&
+               sdlewGLInternalFormat(&surface) == GL_RGB8);
+
+  /* ARGB8888 keeps its alpha. */
+  make_surface(&surface, &format, (Uint8 *)storage, 4,
+               0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+  sprintf(name, "%s argb8888 direct", path);
+  expect(name, sdlewGLUploadSurface(&surface, 1, &rect) == 0 &&
+               upload_format == GL_BGRA &&
+               upload_type == GL_UNSIGNED_INT_8_8_8_8_REV &&
+               check_direct(&surface, &rect) &&
+               sdlewGLInternalFormat(&surface) == GL_RGBA8);
+
+  /* X1R5G5B5. */
+  make_surface(&surface, &format, (Uint8 *)storage, 2,
+               0x7c00, 0x03e0, 0x001f, 0);
+  sprintf(name, "%s x1r5g5b5 direct", path);
+  expect(name, sdlewGLUploadSurface(&surface, 1, &rect) == 0 &&
+               upload_format == GL_BGRA &&
+               upload_type == GL_UNSIGNED_SHORT_1_5_5_5_REV &&
+               check_direct(&surface, &rect));
+
+  /* No GL packed format matches, converted to opaque RGBA bytes. */
+  make_surface(&surface, &format, (Uint8 *)storage, 4,
+               0x000000ff, 0x00ff0000, 0x0000ff00, 0);
+  sprintf(name, "%s rbgx8888 converted", path);
+  expect(name, sdlewGLUploadSurface(&surface, 1, &rect) == 0 &&
+               upload_format == GL_RGBA &&
+               upload_type == GL_UNSIGNED_BYTE &&
+               check_rgba(&surface, &rect));
+}
+
+int main(int argc, char **argv) {
+  SDLEW_GLFunctions gl;
+
+  (void)argc;
+  (void)argv;
+
+  memset(&gl, 0, sizeof(gl));
+  gl.GetString = mock_GetString;
+  gl.GetIntegerv = mock_GetIntegerv;
+  gl.PixelStorei = mock_PixelStorei;
+  gl.BindTexture = mock_BindTexture;
+  gl.TexSubImage2D = mock_TexSubImage2D;
+  gl.GenBuffersARB = mock_GenBuffersARB;
+  gl.DeleteBuffersARB = mock_DeleteBuffersARB;
+  gl.BindBufferARB = mock_BindBufferARB;
+  gl.BufferDataARB = mock_BufferDataARB;
+  gl.MapBufferARB = mock_MapBufferARB;
+  gl.UnmapBufferARB = mock_UnmapBufferARB;
+
+  extensions = "GL_EXT_bgra";
+  sdlewGLSetFunctions(&gl);
+  run("client");
+
+  extensions = "GL_EXT_bgra GL_ARB_pixel_buffer_object";
+  sdlewGLSetFunctions(&gl);
+  run("pbo");
+
+  sdlewGLSetFunctions(NULL);
+  free(buffer);
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* BMP loading straight from a private file mapping.
+ *
+ * Uncompressed 8, 16, 24 and 32 bit files already store rows padded to
+ * four bytes, which is a valid surface pitch, so the surface is created
+ * over the mapped pixel array. Bottom-up files are flipped in place with
+ * a single pass of row swaps, which only touches copy-on-write pages of
+ * the mapping. Everything else goes through SDL_LoadBMP_RW().
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define VC_EXTRALEAN
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+#define FILE_HEADER_SIZE 14
+#define INFO_HEADER_SIZE 40
+
+typedef struct FileMapping {
+  void *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file, mapping;
+#endif
+} FileMapping;
+
+/* Surfaces living on top of a mapping, to unmap them once freed. */
+typedef struct MappedSurface {
+  SDL_Surface *surface;
+  FileMapping mapping;
+  struct MappedSurface *next;
+} MappedSurface;
+
+static struct {
+  SDLEW_SpinLock lock;
+  MappedSurface *list;
+} mapped;
+
+/* File mapping. */
+
+static int mapping_open(const char *path, FileMapping *mapping) {
+  memset(mapping, 0, sizeof(*mapping));
+#ifdef _WIN32
+  {
+    LARGE_INTEGER size;
+
+    mapping->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapping->file == INVALID_HANDLE_VALUE) {
+      return 0;
+    }
+    if (!GetFileSizeEx(mapping->file, &size) || size.QuadPart == 0) {
+      CloseHandle(mapping->file);
+      return 0;
+    }
+    mapping->mapping = CreateFileMappingA(mapping->file, NULL, PAGE_WRITECOPY,
+                                          0, 0, NULL);
+    if (mapping->mapping == NULL) {
+      CloseHandle(mapping->file);
+      return 0;
+    }
+    mapping->data = MapViewOfFile(mapping->mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (mapping->data == NULL) {
+      CloseHandle(mapping->mapping);
+      CloseHandle(mapping->file);
+      return 0;
+    }
+    mapping->size = (size_t)size.QuadPart;
+  }
+#else
+  {
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return 0;
+    }
+    /* Private and writable: surface pixels may be modified, which only
+     * ever copies the touched pages.
+     */
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      return 0;
+    }
+    mapping->data = data;
+    mapping->size = (size_t)st.st_size;
+  }
+#endif
+  return 1;
+}
+
+static void mapping_close(FileMapping *mapping) {
+#ifdef _WIN32
+  UnmapViewOfFile(mapping->data);
+  CloseHandle(mapping->mapping);
+  CloseHandle(mapping->file);
+#else
+  munmap(mapping->data, mapping->size);
+#endif
+}
+
+/* Header parsing. */
+
+SDLEW_INLINE Uint32 read_le16(const Uint8 *p) {
+  return p[0] | (p[1] << 8);
+}
+
+SDLEW_INLINE Uint32 read_le32(const Uint8 *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((Uint32)p[3] << 24);
+}
+
+typedef struct BMPInfo {
+  int width, height;
+  int top_down;
+  int bpp;
+  Uint32 Rmask, Gmask, Bmask, Amask;
+  Uint32 pixel_offset;
+  int pitch;
+  const Uint8 *palette;
+  int num_colors;
+} BMPInfo;
+
+/* Parse a file which can be wrapped without decoding, returns 0 for
+ * anything that needs the libSDL loader.
+ */
+static int parse_mappable(const Uint8 *data, size_t size, BMPInfo *info) {
+  Uint32 header_size, compression;
+  Sint32 height;
+
+#if SDL_BYTEORDER != SDL_LIL_ENDIAN
+  /* Multi-byte pixels are stored little endian. */
+  (void)data;
+  (void)size;
+  (void)info;
+  return 0;
+#endif
+
+  if (size < FILE_HEADER_SIZE + INFO_HEADER_SIZE ||
+      data[0] != 'B' || data[1] != 'M')
+  {
+    return 0;
+  }
+  memset(info, 0, sizeof(*info));
+  info->pixel_offset = read_le32(data + 10);
+
+  /* OS/2 core headers use a different layout, leave them to libSDL. */
+  header_size = read_le32(data + FILE_HEADER_SIZE);
+  if (header_size < INFO_HEADER_SIZE) {
+    return 0;
+  }
+
+  info->width = (Sint32)read_le32(data + FILE_HEADER_SIZE + 4);
+  height = (Sint32)read_le32(data + FILE_HEADER_SIZE + 8);
+  info->bpp = read_le16(data + FILE_HEADER_SIZE + 14);
+  compression = read_le32(data + FILE_HEADER_SIZE + 16);
+
+  /* SDL surfaces are at most 0xffff wide and high, which also keeps the
+   * pitch computation below from overflowing.
+   */
+  if (info->width <= 0 || info->width > 0xffff ||
+      height == 0 || height < -0xffff || height > 0xffff)
+  {
+    return 0;
+  }
+  info->top_down = height < 0;
+  info->height = height < 0 ? -height : height;
+
+  switch (info->bpp) {
+    case 8:
+      if (compression != BI_RGB) {
+        return 0;
+      }
+      info->num_colors = read_le32(data + FILE_HEADER_SIZE + 32);
+      if (info->num_colors == 0 || info->num_colors > 256) {
+        info->num_colors = 256;
+      }
+      info->palette = data + FILE_HEADER_SIZE + header_size;
+      if ((size_t)(info->palette - data) + info->num_colors * 4 > size) {
+        return 0;
+      }
+      break;
+    case 16:
+    case 32:
+      if (compression == BI_RGB) {
+        if (info->bpp == 16) {
+          info->Rmask = 0x7c00;
+          info->Gmask = 0x03e0;
+          info->Bmask = 0x001f;
+        }
+        else {
+          info->Rmask = 0x00ff0000;
+          info->Gmask = 0x0000ff00;
+          info->Bmask = 0x000000ff;
+        }
+      }
+      else if (compression == BI_BITFIELDS) {
+        /* Masks follow a plain info header, newer headers embed them
+         * together with the alpha mask.
+         */
+        const Uint8 *masks = data + FILE_HEADER_SIZE + INFO_HEADER_SIZE;
+        if (FILE_HEADER_SIZE + INFO_HEADER_SIZE + 16 > size) {
+          return 0;
+        }
+        info->Rmask = read_le32(masks);
+        info->Gmask = read_le32(masks + 4);
+        info->Bmask = read_le32(masks + 8);
+        if (header_size >= INFO_HEADER_SIZE + 16) {
+          info->Amask = read_le32(masks + 12);
+        }
+      }
+      else {
+        return 0;
+      }
+      break;
+    case 24:
+      if (compression != BI_RGB) {
+        return 0;
+      }
+      info->Rmask = 0x00ff0000;
+      info->Gmask = 0x0000ff00;
+      info->Bmask = 0x000000ff;
+      break;
+    default:
+      return 0;
+  }
+
+  info->pitch = ((info->width * info->bpp + 31) / 32) * 4;
+  if (info->pitch > 0xffff ||
+      (size_t)info->pixel_offset + (size_t)info->pitch * info->height > size)
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+static void flip_rows(Uint8 *pixels, int pitch, int height) {
+  Uint8 tmp[1024];
+  int top, bottom;
+
+  for (top = 0, bottom = height - 1; top < bottom; top++, bottom--) {
+    Uint8 *a = pixels + top * pitch;
+    Uint8 *b = pixels + bottom * pitch;
+    int done = 0;
+
+    while (done < pitch) {
+      const int chunk = pitch - done < (int)sizeof(tmp) ? pitch - done
+                                                        : (int)sizeof(tmp);
+      memcpy(tmp, a + done, chunk);
+      memcpy(a + done, b + done, chunk);
+      memcpy(b + done, tmp, chunk);
+      done += chunk;
+    }
+  }
+}
+
+static SDL_Surface *load_fallback(const char *path) {
+  SDL_RWops *rw = SDL_RWFromFile(path, "rb");
+  if (rw == NULL) {
+    return NULL;
+  }
+  return SDL_LoadBMP_RW(rw, 1);
+}
+
+SDL_Surface *sdlewLoadBMPMapped(const char *path) {
+  FileMapping mapping;
+  MappedSurface *entry;
+  SDL_Surface *surface;
+  Uint8 *pixels;
+  BMPInfo info;
+
+  if (!mapping_open(path, &mapping)) {
+    return load_fallback(path);
+  }
+  if (!parse_mappable((const Uint8 *)mapping.data, mapping.size, &info)) {
+    mapping_close(&mapping);
+    return load_fallback(path);
+  }
+
+  entry = (MappedSurface *)malloc(sizeof(MappedSurface));
+  if (entry == NULL) {
+    mapping_close(&mapping);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+
+  pixels = (Uint8 *)mapping.data + info.pixel_offset;
+  if (!info.top_down) {
+    flip_rows(pixels, info.pitch, info.height);
+  }
+
+  surface = SDL_CreateRGBSurfaceFrom(pixels, info.width, info.height,
+                                     info.bpp, info.pitch, info.Rmask,
+                                     info.Gmask, info.Bmask, info.Amask);
+  if (surface == NULL) {
+    free(entry);
+    mapping_close(&mapping);
+    return NULL;
+  }
+
+  if (info.palette != NULL && surface->format->palette != NULL) {
+    SDL_Color colors[256];
+    int i;
+    for (i = 0; i < info.num_colors; i++) {
+      colors[i].b = info.palette[i * 4 + 0];
+      colors[i].g = info.palette[i * 4 + 1];
+      colors[i].r = info.palette[i * 4 + 2];
+      colors[i].unused = 0;
+    }
+    SDL_SetColors(surface, colors, 0, info.num_colors);
+  }
+
+  entry->surface = surface;
+  entry->mapping = mapping;
+
+  sdlew_spin_lock(&mapped.lock);
+  entry->next = mapped.list;
+  mapped.list = entry;
+  sdlew_spin_unlock(&mapped.lock);
+
+  return surface;
+}
+
+void sdlewFreeMappedSurface(SDL_Surface *surface) {
+  MappedSurface *entry = NULL, **link;
+
+  if (surface == NULL) {
+    return;
+  }
+
+  /* Only the last reference releases the mapping. */
+  if (surface->refcount <= 1) {
+    sdlew_spin_lock(&mapped.lock);
+    for (link = &mapped.list; *link != NULL; link = &(*link)->next) {
+      if ((*link)->surface == surface) {
+        entry = *link;
+        *link = entry->next;
+        break;
+      }
+    }
+    sdlew_spin_unlock(&mapped.lock);
+  }
+
+  SDL_FreeSurface(surface);
+
+  if (entry != NULL) {
+    mapping_close(&entry->mapping);
+    free(entry);
+  }
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Batch colour mapping.
+ *
+ * Truecolour formats use the same shift and mask arithmetic as
+ * SDL_MapRGBA() and SDL_GetRGBA(), four pixels at a time with SSE2.
+ * Palettized formats map through an inverse palette table indexed by
+ * colours quantized to 5 bits per channel, cached per surface and rebuilt
+ * whenever the surface format_version or the palette contents change.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CUBE_BITS 5
+#define CUBE_SIZE (1 << (CUBE_BITS * 3))
+#define CACHE_SIZE 4
+
+typedef struct InversePalette {
+  const SDL_PixelFormat *format;
+  unsigned int format_version;
+  Uint32 checksum;
+  int users;
+  int cached;
+  Uint8 index[CUBE_SIZE];
+} InversePalette;
+
+static struct {
+  SDLEW_SpinLock lock;
+  InversePalette *tables[CACHE_SIZE];
+  int next_evict;
+} cache;
+
+/* Inverse palette. */
+
+static Uint32 palette_checksum(const SDL_Palette *palette) {
+  /* FNV-1a, guards against a recycled format pointer matching an old
+   * entry with the same version.
+   */
+  const Uint8 *bytes = (const Uint8 *)palette->colors;
+  const int size = palette->ncolors * (int)sizeof(SDL_Color);
+  Uint32 hash = 2166136261u;
+  int i;
+
+  for (i = 0; i < size; i++) {
+    if ((i & 3) != 3) {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+static InversePalette *inverse_build(const SDL_Surface *surface,
+                                     Uint32 checksum) {
+  const SDL_Palette *palette = surface->format->palette;
+  InversePalette *table;
+  int r, g, b, i;
+
+  table = (InversePalette *)malloc(sizeof(InversePalette));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->format = surface->format;
+  table->format_version = surface->format_version;
+  table->checksum = checksum;
+  table->users = 1;
+  table->cached = 0;
+
+  /* Nearest palette entry to the centre of every cell, same metric as
+   * SDL_MapRGB() uses for palettes.
+   */
+  for (r = 0; r < (1 << CUBE_BITS); r++) {
+    const int rv = (r << 3) | (r >> 2);
+    for (g = 0; g < (1 << CUBE_BITS); g++) {
+      const int gv = (g << 3) | (g >> 2);
+      for (b = 0; b < (1 << CUBE_BITS); b++) {
+        const int bv = (b << 3) | (b >> 2);
+        int best = 0, best_distance = 0x7fffffff;
+        for (i = 0; i < palette->ncolors; i++) {
+          const SDL_Color *c = &palette->colors[i];
+          const int dr = c->r - rv, dg = c->g - gv, db = c->b - bv;
+          const int distance = dr * dr + dg * dg + db * db;
+          if (distance < best_distance) {
+            best = i;
+            best_distance = distance;
+            if (distance == 0) {
+              break;
+            }
+          }
+        }
+        table->index[(r << (CUBE_BITS * 2)) | (g << CUBE_BITS) | b] =
+                (Uint8)best;
+      }
+    }
+  }
+
+  return table;
+}
+
+static InversePalette *inverse_acquire(const SDL_Surface *surface) {
+  const Uint32 checksum = palette_checksum(surface->format->palette);
+  InversePalette *table, *evicted = NULL;
+  int i;
+
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    table = cache.tables[i];
+    if (table != NULL && table->format == surface->format &&
+        table->format_version == surface->format_version &&
+        table->checksum == checksum)
+    {
+      table->users++;
+      sdlew_spin_unlock(&cache.lock);
+      return table;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  table = inverse_build(surface, checksum);
+  if (table == NULL) {
+    return NULL;
+  }
+
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    const int slot = (cache.next_evict + i) % CACHE_SIZE;
+    InversePalette *old = cache.tables[slot];
+    if (old == NULL || old->users == 0) {
+      evicted = old;
+      cache.tables[slot] = table;
+      cache.next_evict = (slot + 1) % CACHE_SIZE;
+      table->cached = 1;
+      break;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  free(evicted);
+
+  return table;
+}
+
+static void inverse_release(InversePalette *table) {
+  int destroy;
+
+  sdlew_spin_lock(&cache.lock);
+  table->users--;
+  destroy = (!table->cached && table->users == 0);
+  sdlew_spin_unlock(&cache.lock);
+
+  if (destroy) {
+    free(table);
+  }
+}
+
+void sdlewColorFlushCache(void) {
+  InversePalette *unused[CACHE_SIZE];
+  int i, num_unused = 0;
+
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    InversePalette *table = cache.tables[i];
+    if (table == NULL) {
+      continue;
+    }
+    cache.tables[i] = NULL;
+    table->cached = 0;
+    if (table->users == 0) {
+      unused[num_unused++] = table;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  for (i = 0; i < num_unused; i++) {
+    free(unused[i]);
+  }
+}
+
+static void map_palette(const SDL_Surface *surface, const Uint8 *rgba,
+                        Uint32 *pixels, int count) {
+  InversePalette *table = inverse_acquire(surface);
+  int i;
+
+  if (table == NULL) {
+    /* Out of memory, fall back to libSDL one colour at a time. */
+    for (i = 0; i < count; i++, rgba += 4) {
+      pixels[i] = SDL_MapRGB(surface->format, rgba[0], rgba[1], rgba[2]);
+    }
+    return;
+  }
+
+  for (i = 0; i < count; i++, rgba += 4) {
+    pixels[i] = table->index[((rgba[0] >> 3) << (CUBE_BITS * 2)) |
+                             ((rgba[1] >> 3) << CUBE_BITS) |
+                             (rgba[2] >> 3)];
+  }
+
+  inverse_release(table);
+}
+
+/* Truecolour. */
+
+static void map_truecolor(const SDL_PixelFormat *format, const Uint8 *rgba,
+                          Uint32 *pixels, int count, int use_alpha) {
+  const Uint32 amask = format->Amask;
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  const __m128i byte = _mm_set1_epi32(0xff);
+  const __m128i alpha = _mm_set1_epi32((int)amask);
+  const __m128i rloss = _mm_cvtsi32_si128(format->Rloss);
+  const __m128i gloss = _mm_cvtsi32_si128(format->Gloss);
+  const __m128i bloss = _mm_cvtsi32_si128(format->Bloss);
+  const __m128i aloss = _mm_cvtsi32_si128(format->Aloss);
+  const __m128i rshift = _mm_cvtsi32_si128(format->Rshift);
+  const __m128i gshift = _mm_cvtsi32_si128(format->Gshift);
+  const __m128i bshift = _mm_cvtsi32_si128(format->Bshift);
+  const __m128i ashift = _mm_cvtsi32_si128(format->Ashift);
+
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(rgba + i * 4));
+    const __m128i r = _mm_and_si128(v, byte);
+    const __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), byte);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), byte);
+    __m128i result;
+
+    result = _mm_sll_epi32(_mm_srl_epi32(r, rloss), rshift);
+    result = _mm_or_si128(result,
+                          _mm_sll_epi32(_mm_srl_epi32(g, gloss), gshift));
+    result = _mm_or_si128(result,
+                          _mm_sll_epi32(_mm_srl_epi32(b, bloss), bshift));
+    if (use_alpha) {
+      const __m128i a = _mm_srli_epi32(v, 24);
+      result = _mm_or_si128(result, _mm_and_si128(
+              _mm_sll_epi32(_mm_srl_epi32(a, aloss), ashift), alpha));
+    }
+    else {
+      result = _mm_or_si128(result, alpha);
+    }
+    _mm_storeu_si128((__m128i *)(pixels + i), result);
+  }
+#endif
+
+  for (; i < count; i++) {
+    const Uint8 *c = rgba + i * 4;
+    Uint32 pixel = ((Uint32)(c[0] >> format->Rloss) << format->Rshift) |
+                   ((Uint32)(c[1] >> format->Gloss) << format->Gshift) |
+                   ((Uint32)(c[2] >> format->Bloss) << format->Bshift);
+    if (use_alpha) {
+      pixel |= ((Uint32)(c[3] >> format->Aloss) << format->Ashift) & amask;
+    }
+    else {
+      pixel |= amask;
+    }
+    pixels[i] = pixel;
+  }
+}
+
+/* Channel widening of SDL_GetRGBA(), exact for channels of at least four
+ * bits.
+ */
+SDLEW_INLINE Uint8 widen_channel(Uint32 pixel, Uint32 mask, int shift,
+                                 int loss) {
+  const Uint32 v = (pixel & mask) >> shift;
+  return (Uint8)((v << loss) + (loss * 2 <= 8 ? v >> (8 - loss * 2) : 0));
+}
+
+static void get_truecolor(const SDL_PixelFormat *format,
+                          const Uint32 *pixels, Uint8 *rgba, int count) {
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  /* Only when every channel widens the way SDL does in the scalar loop. */
+  if (format->Rloss <= 4 && format->Gloss <= 4 && format->Bloss <= 4 &&
+      (format->Amask == 0 || format->Aloss <= 4))
+  {
+    const __m128i byte = _mm_set1_epi32(0xff);
+    const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+    const __m128i masks[4] = {
+      _mm_set1_epi32((int)format->Rmask),
+      _mm_set1_epi32((int)format->Gmask),
+      _mm_set1_epi32((int)format->Bmask),
+      _mm_set1_epi32((int)format->Amask),
+    };
+    const __m128i shifts[4] = {
+      _mm_cvtsi32_si128(format->Rshift),
+      _mm_cvtsi32_si128(format->Gshift),
+      _mm_cvtsi32_si128(format->Bshift),
+      _mm_cvtsi32_si128(format->Ashift),
+    };
+    const __m128i losses[4] = {
+      _mm_cvtsi32_si128(format->Rloss),
+      _mm_cvtsi32_si128(format->Gloss),
+      _mm_cvtsi32_si128(format->Bloss),
+      _mm_cvtsi32_si128(format->Aloss),
+    };
+    const __m128i widen[4] = {
+      _mm_cvtsi32_si128(8 - format->Rloss * 2),
+      _mm_cvtsi32_si128(8 - format->Gloss * 2),
+      _mm_cvtsi32_si128(8 - format->Bloss * 2),
+      _mm_cvtsi32_si128(8 - format->Aloss * 2),
+    };
+    const int channels = format->Amask ? 4 : 3;
+
+    for (; i + 4 <= count; i += 4) {
+      const __m128i p = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i result = format->Amask ? _mm_setzero_si128() : opaque;
+      int c;
+
+      for (c = 0; c < channels; c++) {
+        __m128i v = _mm_srl_epi32(_mm_and_si128(p, masks[c]), shifts[c]);
+        v = _mm_add_epi32(_mm_sll_epi32(v, losses[c]),
+                          _mm_srl_epi32(v, widen[c]));
+        result = _mm_or_si128(result,
+                              _mm_slli_epi32(_mm_and_si128(v, byte), c * 8));
+      }
+      _mm_storeu_si128((__m128i *)(rgba + i * 4), result);
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    const Uint32 p = pixels[i];
+    Uint8 *c = rgba + i * 4;
+    c[0] = widen_channel(p, format->Rmask, format->Rshift, format->Rloss);
+    c[1] = widen_channel(p, format->Gmask, format->Gshift, format->Gloss);
+    c[2] = widen_channel(p, format->Bmask, format->Bshift, format->Bloss);
+    c[3] = format->Amask ? widen_channel(p, format->Amask, format->Ashift,
+                                         format->Aloss)
+                         : SDL_ALPHA_OPAQUE;
+  }
+}
+
+/* Public API. */
+
+void sdlewMapRGBArray(const SDL_Surface *surface, const Uint8 *rgba,
+                      Uint32 *pixels, int count) {
+  if (surface->format->palette != NULL) {
+    map_palette(surface, rgba, pixels, count);
+  }
+  else {
+    map_truecolor(surface->format, rgba, pixels, count, 0);
+  }
+}
+
+void sdlewMapRGBAArray(const SDL_Surface *surface, const Uint8 *rgba,
+                       Uint32 *pixels, int count) {
+  if (surface->format->palette != NULL) {
+    map_palette(surface, rgba, pixels, count);
+  }
+  else {
+    map_truecolor(surface->format, rgba, pixels, count, 1);
+  }
+}
+
+void sdlewGetRGBAArray(const SDL_Surface *surface, const Uint32 *pixels,
+                       Uint8 *rgba, int count) {
+  const SDL_PixelFormat *format = surface->format;
+  int i;
+
+  if (format->palette != NULL) {
+    const SDL_Palette *palette = format->palette;
+    for (i = 0; i < count; i++, rgba += 4) {
+      const SDL_Color *color = &palette->colors[pixels[i] & 0xff];
+      rgba[0] = color->r;
+      rgba[1] = color->g;
+      rgba[2] = color->b;
+      rgba[3] = SDL_ALPHA_OPAQUE;
+    }
+  }
+  else {
+    get_truecolor(format, pixels, rgba, count);
+  }
+}
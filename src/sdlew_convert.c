@@ -0,0 +1,456 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Single pass audio format conversion.
+ *
+ * The filters SDL_BuildAudioCVT() chains up amount to a fixed function of
+ * each sample: byte swap, sign flip at the source width, widening or
+ * narrowing by 8 bits, then the channel filters. SDL_ConvertStereo()
+ * doubles every sample and SDL_ConvertMono() sums neighbouring pairs with
+ * saturation, so any chain of those maps an output sample to a fixed group
+ * of input samples. The converter works out the same chain on creation
+ * and evaluates it per output sample, keeping SDL's quirks: mono sums are
+ * not halved, and after narrowing to 8 bits SDL tracks the data as
+ * unsigned whatever the destination sign.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest group of input samples summed into one output sample, 2^7 as
+ * SDL channel counts fit into a byte.
+ */
+#define MAX_DOWNMIX 7
+
+struct SDLEW_AudioConverter {
+  /* Fused sample format and channel conversion. */
+  int src_bytes, dst_bytes;
+  int src_big_endian, dst_big_endian;
+  Uint32 sign_toggle;
+  int widen, narrow;
+  int mix_signed;
+  Uint32 mix_max;
+
+  /* Passes of SDL_ConvertStereo() and SDL_ConvertMono(). */
+  int duplicate, downmix;
+
+  int src_frame, mid_frame;
+
+  /* Layouts done by SDL_ConvertAudio(). */
+  int use_cvt;
+  SDL_AudioCVT cvt;
+
+  SDLEW_Resampler *resampler;
+
+  Uint8 *scratch;
+  size_t scratch_size;
+};
+
+/* Follow the channel logic of SDL_BuildAudioCVT(). Returns 1 when only
+ * stereo and mono passes are involved, 0 for surround ones and -1 when
+ * SDL would not reach the requested count either.
+ */
+static int plan_channels(int src, int dst, int *duplicate, int *downmix) {
+  *duplicate = 0;
+  *downmix = 0;
+  if (src == dst) {
+    return 1;
+  }
+
+  if (src == 1 && dst > 1) {
+    (*duplicate)++;
+    src = 2;
+  }
+  if (src == 2 && (dst == 6 || dst == 4)) {
+    return 0;
+  }
+  while (src * 2 <= dst) {
+    (*duplicate)++;
+    src *= 2;
+  }
+  if (src == 6 && (dst <= 2 || dst == 4)) {
+    return 0;
+  }
+  while (src % 2 == 0 && src / 2 >= dst) {
+    (*downmix)++;
+    src /= 2;
+  }
+  return src == dst ? 1 : -1;
+}
+
+/* Scalar kernel. */
+
+SDLEW_INLINE Uint32 read_sample(const SDLEW_AudioConverter *c,
+                                const Uint8 *p) {
+  Uint32 u;
+
+  if (c->src_bytes == 1) {
+    u = p[0];
+  }
+  else if (c->src_big_endian) {
+    u = (p[0] << 8) | p[1];
+  }
+  else {
+    u = p[0] | (p[1] << 8);
+  }
+
+  u ^= c->sign_toggle;
+  if (c->widen) {
+    u <<= 8;
+  }
+  else if (c->narrow) {
+    u >>= 8;
+  }
+  return u;
+}
+
+SDLEW_INLINE void write_sample(const SDLEW_AudioConverter *c, Uint8 *p,
+                               Uint32 u) {
+  if (c->dst_bytes == 1) {
+    p[0] = (Uint8)u;
+  }
+  else if (c->dst_big_endian) {
+    p[0] = (Uint8)(u >> 8);
+    p[1] = (Uint8)u;
+  }
+  else {
+    p[0] = (Uint8)u;
+    p[1] = (Uint8)(u >> 8);
+  }
+}
+
+/* One SDL_ConvertMono() sum. */
+SDLEW_INLINE Uint32 mix_pair(const SDLEW_AudioConverter *c,
+                             Uint32 a, Uint32 b) {
+  if (c->mix_signed) {
+    const Sint32 half = (Sint32)(c->mix_max >> 1) + 1;
+    Sint32 sum = (Sint32)((a ^ half) + (b ^ half)) - 2 * half;
+    sum = sum < -half ? -half : sum > half - 1 ? half - 1 : sum;
+    return (Uint32)sum & c->mix_max;
+  }
+  else {
+    const Uint32 sum = a + b;
+    return sum > c->mix_max ? c->mix_max : sum;
+  }
+}
+
+static void convert_generic(const SDLEW_AudioConverter *c, const Uint8 *src,
+                            Uint8 *dst, int begin, int end) {
+  Uint32 group[1 << MAX_DOWNMIX];
+  const int group_size = 1 << c->downmix;
+  int o, k, n;
+
+  for (o = begin; o < end; o++) {
+    Uint32 value;
+
+    if (c->downmix > 0) {
+      const Uint8 *s = src + (size_t)o * group_size * c->src_bytes;
+      for (k = 0; k < group_size; k++) {
+        group[k] = read_sample(c, s + k * c->src_bytes);
+      }
+      for (n = group_size; n > 1; n /= 2) {
+        for (k = 0; k < n / 2; k++) {
+          group[k] = mix_pair(c, group[k * 2], group[k * 2 + 1]);
+        }
+      }
+      value = group[0];
+    }
+    else {
+      value = read_sample(c, src + (size_t)(o >> c->duplicate) *
+                                   c->src_bytes);
+    }
+
+    write_sample(c, dst + (size_t)o * c->dst_bytes, value);
+  }
+}
+
+/* SSE2 kernels for the common cases, returning the number of output
+ * samples done. SSE2 hosts are little endian.
+ */
+
+#ifdef SDLEW_HAVE_SSE2
+SDLEW_INLINE __m128i swap16(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static int convert_sse2(const SDLEW_AudioConverter *c, const Uint8 *src,
+                        Uint8 *dst, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+
+  if (c->duplicate != 0) {
+    return 0;
+  }
+
+  if (c->downmix == 1) {
+    /* Native signed 16 bit stereo to mono: pairwise sums and signed
+     * saturation are exactly madd and packs.
+     */
+    const __m128i ones = _mm_set1_epi16(1);
+    if (c->src_bytes != 2 || c->dst_bytes != 2 || c->src_big_endian ||
+        c->dst_big_endian || c->sign_toggle != 0 || !c->mix_signed)
+    {
+      return 0;
+    }
+    for (; i + 8 <= n; i += 8) {
+      const __m128i s0 = _mm_loadu_si128((const __m128i *)(src + i * 4));
+      const __m128i s1 = _mm_loadu_si128((const __m128i *)(src + i * 4 + 16));
+      _mm_storeu_si128((__m128i *)(dst + i * 2),
+                       _mm_packs_epi32(_mm_madd_epi16(s0, ones),
+                                       _mm_madd_epi16(s1, ones)));
+    }
+    return i;
+  }
+  if (c->downmix != 0) {
+    return 0;
+  }
+
+  if (c->src_bytes == 2 && c->dst_bytes == 2) {
+    const __m128i toggle = _mm_set1_epi16((short)c->sign_toggle);
+    for (; i + 8 <= n; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      if (c->src_big_endian) {
+        v = swap16(v);
+      }
+      v = _mm_xor_si128(v, toggle);
+      if (c->dst_big_endian) {
+        v = swap16(v);
+      }
+      _mm_storeu_si128((__m128i *)(dst + i * 2), v);
+    }
+  }
+  else if (c->src_bytes == 1 && c->dst_bytes == 2) {
+    const __m128i toggle = _mm_set1_epi8((char)c->sign_toggle);
+    for (; i + 16 <= n; i += 16) {
+      const __m128i b = _mm_xor_si128(
+          _mm_loadu_si128((const __m128i *)(src + i)), toggle);
+      __m128i lo, hi;
+      if (c->dst_big_endian) {
+        lo = _mm_unpacklo_epi8(b, zero);
+        hi = _mm_unpackhi_epi8(b, zero);
+      }
+      else {
+        lo = _mm_unpacklo_epi8(zero, b);
+        hi = _mm_unpackhi_epi8(zero, b);
+      }
+      _mm_storeu_si128((__m128i *)(dst + i * 2), lo);
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), hi);
+    }
+  }
+  else if (c->src_bytes == 2 && c->dst_bytes == 1) {
+    const __m128i toggle = _mm_set1_epi8((char)(c->sign_toggle >> 8));
+    const __m128i low = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n; i += 16) {
+      __m128i v0 = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+      if (c->src_big_endian) {
+        v0 = _mm_and_si128(v0, low);
+        v1 = _mm_and_si128(v1, low);
+      }
+      else {
+        v0 = _mm_srli_epi16(v0, 8);
+        v1 = _mm_srli_epi16(v1, 8);
+      }
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_xor_si128(_mm_packus_epi16(v0, v1), toggle));
+    }
+  }
+  else {
+    const __m128i toggle = _mm_set1_epi8((char)c->sign_toggle);
+    for (; i + 16 <= n; i += 16) {
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(
+          _mm_loadu_si128((const __m128i *)(src + i)), toggle));
+    }
+  }
+
+  return i;
+}
+#endif
+
+static void convert(const SDLEW_AudioConverter *c, const Uint8 *src,
+                    Uint8 *dst, int n) {
+  int done = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  done = convert_sse2(c, src, dst, n);
+#endif
+
+  convert_generic(c, src, dst, done, n);
+}
+
+/* API. */
+
+static int scratch_reserve(SDLEW_AudioConverter *c, size_t size) {
+  if (size > c->scratch_size) {
+    Uint8 *scratch = (Uint8 *)malloc(size);
+    if (scratch == NULL) {
+      SDL_OutOfMemory();
+      return 0;
+    }
+    free(c->scratch);
+    c->scratch = scratch;
+    c->scratch_size = size;
+  }
+  return 1;
+}
+
+SDLEW_AudioConverter *sdlewAudioConverterCreate(Uint16 src_format,
+                                                int src_channels,
+                                                int src_rate,
+                                                Uint16 dst_format,
+                                                int dst_channels,
+                                                int dst_rate, int quality) {
+  SDLEW_AudioConverter *c;
+  SDLEW_SampleFormat sf, df;
+  int plan;
+
+  if (!sdlew_sample_format(src_format, &sf) ||
+      !sdlew_sample_format(dst_format, &df))
+  {
+    SDL_SetError("sdlewAudioConverterCreate: unknown audio format");
+    return NULL;
+  }
+  if (src_channels <= 0 || src_channels > 255 || dst_channels <= 0 ||
+      dst_channels > 255 || src_rate <= 0 || dst_rate <= 0)
+  {
+    SDL_SetError("sdlewAudioConverterCreate: invalid parameters");
+    return NULL;
+  }
+
+  c = (SDLEW_AudioConverter *)calloc(1, sizeof(SDLEW_AudioConverter));
+  if (c == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+
+  plan = plan_channels(src_channels, dst_channels, &c->duplicate,
+                       &c->downmix);
+  if (plan < 0) {
+    SDL_SetError("sdlewAudioConverterCreate: cannot convert %d channels "
+                 "to %d", src_channels, dst_channels);
+    goto error;
+  }
+  if (plan == 0) {
+    if (SDL_BuildAudioCVT(&c->cvt, src_format, (Uint8)src_channels,
+                          src_rate, dst_format, (Uint8)dst_channels,
+                          src_rate) < 0)
+    {
+      goto error;
+    }
+    c->use_cvt = 1;
+  }
+
+  c->src_bytes = sf.bytes;
+  c->dst_bytes = df.bytes;
+  c->src_big_endian = sf.big_endian;
+  c->dst_big_endian = df.big_endian;
+  if ((sf.bias != 0) != (df.bias != 0)) {
+    c->sign_toggle = sf.bytes == 2 ? 0x8000 : 0x80;
+  }
+  c->widen = sf.bytes < df.bytes;
+  c->narrow = sf.bytes > df.bytes;
+  /* SDL_Convert8() marks its output as AUDIO_U8 regardless of sign. */
+  c->mix_signed = df.bias == 0 && !c->narrow;
+  c->mix_max = df.bytes == 2 ? 0xffff : 0xff;
+
+  c->src_frame = sf.bytes * src_channels;
+  c->mid_frame = df.bytes * dst_channels;
+
+  if (src_rate != dst_rate) {
+    c->resampler = sdlewResamplerCreate(dst_format, dst_channels, src_rate,
+                                        dst_rate, quality);
+    if (c->resampler == NULL) {
+      goto error;
+    }
+  }
+
+  return c;
+
+error:
+  free(c);
+  return NULL;
+}
+
+void sdlewAudioConverterFree(SDLEW_AudioConverter *converter) {
+  if (converter != NULL) {
+    sdlewResamplerFree(converter->resampler);
+    free(converter->scratch);
+    free(converter);
+  }
+}
+
+int sdlewAudioConverterMaxOutput(const SDLEW_AudioConverter *converter,
+                                 int src_len) {
+  const int frames = src_len > 0 ? src_len / converter->src_frame : 0;
+  const int mid_len = frames * converter->mid_frame;
+
+  if (converter->resampler != NULL) {
+    return sdlewResamplerMaxOutput(converter->resampler, mid_len);
+  }
+  return mid_len;
+}
+
+int sdlewAudioConverterProcess(SDLEW_AudioConverter *converter,
+                               const Uint8 *src, int src_len, Uint8 *dst) {
+  SDLEW_AudioConverter *c = converter;
+  const int frames = src_len / c->src_frame;
+  Uint8 *mid;
+  int mid_len;
+
+  if (frames <= 0) {
+    return 0;
+  }
+  if (src == NULL || dst == NULL) {
+    SDL_SetError("sdlewAudioConverterProcess: passed a NULL pointer");
+    return -1;
+  }
+
+  if (c->use_cvt) {
+    const int len = frames * c->src_frame;
+    if (!scratch_reserve(c, (size_t)len * c->cvt.len_mult)) {
+      return -1;
+    }
+    memcpy(c->scratch, src, len);
+    c->cvt.buf = c->scratch;
+    c->cvt.len = len;
+    if (SDL_ConvertAudio(&c->cvt) < 0) {
+      return -1;
+    }
+    mid = c->scratch;
+    mid_len = c->cvt.len_cvt;
+    if (c->resampler == NULL) {
+      memcpy(dst, mid, mid_len);
+      return mid_len;
+    }
+  }
+  else {
+    mid_len = frames * c->mid_frame;
+    if (c->resampler == NULL) {
+      convert(c, src, dst, mid_len / c->dst_bytes);
+      return mid_len;
+    }
+    if (!scratch_reserve(c, mid_len)) {
+      return -1;
+    }
+    mid = c->scratch;
+    convert(c, src, mid, mid_len / c->dst_bytes);
+  }
+
+  return sdlewResamplerProcess(c->resampler, mid, mid_len, dst);
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Dirty region accumulation for SDL_UpdateRects().
+ *
+ * Marked rectangles set bits in a tile bitmap. On flush every tile row is
+ * scanned for runs of dirty tiles, runs spanning the same columns in
+ * consecutive rows are stacked into one rectangle, and rectangles are
+ * then merged pairwise whenever pushing the extra clean pixels is cheaper
+ * than the per rectangle cost.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_TILE_SIZE 16
+#define DEFAULT_MERGE_COST 1024
+
+/* Above this many rectangles only neighbours in flush order are
+ * considered for merging, keeping the cost linear.
+ */
+#define MAX_PAIRWISE 256
+
+typedef struct TileRun {
+  int c0, c1;
+  int r0;
+} TileRun;
+
+struct SDLEW_DirtyRegion {
+  int width, height;
+  int tile_size;
+  int cols, rows;
+  int words_per_row;
+  Uint32 *bits;
+  int any_dirty;
+  int merge_cost;
+
+  /* Scratch for flushing, grown on demand. */
+  TileRun *open, *current;
+  SDL_Rect *rects;
+  int rects_capacity;
+
+  SDLEW_DirtyStats stats;
+};
+
+SDLEW_DirtyRegion *sdlewDirtyCreate(int width, int height, int tile_size) {
+  SDLEW_DirtyRegion *region;
+
+  if (width <= 0 || height <= 0) {
+    SDL_SetError("sdlewDirtyCreate: invalid size");
+    return NULL;
+  }
+  if (tile_size <= 0) {
+    tile_size = DEFAULT_TILE_SIZE;
+  }
+
+  region = (SDLEW_DirtyRegion *)calloc(1, sizeof(SDLEW_DirtyRegion));
+  if (region == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  region->width = width;
+  region->height = height;
+  region->tile_size = tile_size;
+  region->cols = (width + tile_size - 1) / tile_size;
+  region->rows = (height + tile_size - 1) / tile_size;
+  region->words_per_row = (region->cols + 31) / 32;
+  region->merge_cost = DEFAULT_MERGE_COST;
+
+  region->bits = (Uint32 *)calloc(region->words_per_row * region->rows,
+                                  sizeof(Uint32));
+  /* A row holds at most one run for every other column. */
+  region->open = (TileRun *)malloc(sizeof(TileRun) *
+                                   (region->cols / 2 + 1));
+  region->current = (TileRun *)malloc(sizeof(TileRun) *
+                                      (region->cols / 2 + 1));
+  if (region->bits == NULL || region->open == NULL ||
+      region->current == NULL)
+  {
+    sdlewDirtyDestroy(region);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+
+  return region;
+}
+
+void sdlewDirtyDestroy(SDLEW_DirtyRegion *region) {
+  if (region == NULL) {
+    return;
+  }
+  free(region->bits);
+  free(region->open);
+  free(region->current);
+  free(region->rects);
+  free(region);
+}
+
+void sdlewDirtySetMergeCost(SDLEW_DirtyRegion *region, int pixels) {
+  region->merge_cost = pixels < 0 ? 0 : pixels;
+}
+
+void sdlewDirtyMark(SDLEW_DirtyRegion *region, const SDL_Rect *rect) {
+  int x0, y0, x1, y1, c0, c1, w0, w1, r;
+  Uint32 first_mask, last_mask;
+
+  if (rect == NULL) {
+    x0 = y0 = 0;
+    x1 = region->width;
+    y1 = region->height;
+  }
+  else {
+    x0 = rect->x < 0 ? 0 : rect->x;
+    y0 = rect->y < 0 ? 0 : rect->y;
+    x1 = rect->x + rect->w > region->width ? region->width
+                                             : rect->x + rect->w;
+    y1 = rect->y + rect->h > region->height ? region->height
+                                              : rect->y + rect->h;
+  }
+  if (x1 <= x0 || y1 <= y0) {
+    return;
+  }
+
+  region->stats.rects_marked++;
+  region->any_dirty = 1;
+
+  c0 = x0 / region->tile_size;
+  c1 = (x1 - 1) / region->tile_size;
+  w0 = c0 / 32;
+  w1 = c1 / 32;
+  first_mask = 0xffffffffu << (c0 % 32);
+  last_mask = 0xffffffffu >> (31 - c1 % 32);
+
+  for (r = y0 / region->tile_size; r <= (y1 - 1) / region->tile_size; r++) {
+    Uint32 *row = region->bits + r * region->words_per_row;
+    int w;
+    if (w0 == w1) {
+      row[w0] |= first_mask & last_mask;
+      continue;
+    }
+    row[w0] |= first_mask;
+    for (w = w0 + 1; w < w1; w++) {
+      row[w] = 0xffffffffu;
+    }
+    row[w1] |= last_mask;
+  }
+}
+
+/* Flushing. */
+
+static int rects_reserve(SDLEW_DirtyRegion *region, int count) {
+  SDL_Rect *rects;
+  int capacity;
+
+  if (count <= region->rects_capacity) {
+    return 1;
+  }
+  capacity = region->rects_capacity ? region->rects_capacity * 2 : 64;
+  while (capacity < count) {
+    capacity *= 2;
+  }
+  rects = (SDL_Rect *)realloc(region->rects, sizeof(SDL_Rect) * capacity);
+  if (rects == NULL) {
+    return 0;
+  }
+  region->rects = rects;
+  region->rects_capacity = capacity;
+  return 1;
+}
+
+/* Turn tile run [c0, c1] of rows [r0, r1) into a pixel rectangle. */
+static int emit_run(SDLEW_DirtyRegion *region, int *num_rects,
+                    const TileRun *run, int r1) {
+  const int ts = region->tile_size;
+  SDL_Rect *rect;
+  int x1, y1;
+
+  if (!rects_reserve(region, *num_rects + 1)) {
+    return 0;
+  }
+  x1 = (run->c1 + 1) * ts;
+  y1 = r1 * ts;
+  rect = &region->rects[(*num_rects)++];
+  rect->x = (Sint16)(run->c0 * ts);
+  rect->y = (Sint16)(run->r0 * ts);
+  rect->w = (Uint16)((x1 > region->width ? region->width : x1) - rect->x);
+  rect->h = (Uint16)((y1 > region->height ? region->height : y1) - rect->y);
+  return 1;
+}
+
+/* Collect runs of set bits in a tile row. */
+static int row_runs(const SDLEW_DirtyRegion *region, const Uint32 *row,
+                    TileRun *runs, int r) {
+  int num_runs = 0, c = 0;
+
+  while (c < region->cols) {
+    const Uint32 word = row[c / 32] >> (c % 32);
+    if (word == 0) {
+      /* Skip the rest of an empty word. */
+      c = (c / 32 + 1) * 32;
+      continue;
+    }
+    if ((word & 1) == 0) {
+      c++;
+      continue;
+    }
+    runs[num_runs].c0 = c;
+    while (c < region->cols && (row[c / 32] >> (c % 32)) & 1) {
+      c++;
+    }
+    runs[num_runs].c1 = c - 1;
+    runs[num_runs].r0 = r;
+    num_runs++;
+  }
+  return num_runs;
+}
+
+static int rect_area(const SDL_Rect *rect) {
+  return rect->w * rect->h;
+}
+
+static void rect_union(const SDL_Rect *a, const SDL_Rect *b,
+                       SDL_Rect *result) {
+  const int x0 = a->x < b->x ? a->x : b->x;
+  const int y0 = a->y < b->y ? a->y : b->y;
+  const int x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+  const int y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+  result->x = (Sint16)x0;
+  result->y = (Sint16)y0;
+  result->w = (Uint16)(x1 - x0);
+  result->h = (Uint16)(y1 - y0);
+}
+
+/* Greedily merge pairs whose union wastes less than merge_cost pixels. */
+static int merge_rects(SDLEW_DirtyRegion *region, int num_rects) {
+  SDL_Rect *rects = region->rects;
+  int merged = 1, i, j;
+
+  if (num_rects > MAX_PAIRWISE) {
+    for (i = 1, j = 0; i < num_rects; i++) {
+      SDL_Rect u;
+      rect_union(&rects[j], &rects[i], &u);
+      if (rect_area(&u) - rect_area(&rects[j]) - rect_area(&rects[i]) <
+          region->merge_cost)
+      {
+        rects[j] = u;
+      }
+      else {
+        rects[++j] = rects[i];
+      }
+    }
+    return j + 1;
+  }
+
+  while (merged) {
+    merged = 0;
+    for (i = 0; i < num_rects; i++) {
+      for (j = i + 1; j < num_rects; j++) {
+        SDL_Rect u;
+        rect_union(&rects[i], &rects[j], &u);
+        if (rect_area(&u) - rect_area(&rects[i]) - rect_area(&rects[j]) <
+            region->merge_cost)
+        {
+          rects[i] = u;
+          rects[j] = rects[--num_rects];
+          merged = 1;
+          j = i;
+        }
+      }
+    }
+  }
+  return num_rects;
+}
+
+int sdlewDirtyGetRects(SDLEW_DirtyRegion *region, SDL_Rect **rects) {
+  TileRun *open = region->open, *current = region->current, *swap;
+  int num_open = 0, num_rects = 0, r, i, j, k;
+
+  *rects = region->rects;
+  if (!region->any_dirty) {
+    return 0;
+  }
+
+  for (r = 0; r <= region->rows; r++) {
+    int num_current = 0;
+
+    if (r < region->rows) {
+      num_current = row_runs(region,
+                             region->bits + r * region->words_per_row,
+                             current, r);
+    }
+
+    /* Both lists are sorted by column, extend runs covering the same
+     * columns as in the previous row and close the others.
+     */
+    i = j = 0;
+    while (i < num_open) {
+      while (j < num_current && current[j].c0 < open[i].c0) {
+        j++;
+      }
+      if (j < num_current && current[j].c0 == open[i].c0 &&
+          current[j].c1 == open[i].c1)
+      {
+        current[j].r0 = open[i].r0;
+      }
+      else if (!emit_run(region, &num_rects, &open[i], r)) {
+        goto out_of_memory;
+      }
+      i++;
+    }
+
+    swap = open;
+    open = current;
+    current = swap;
+    num_open = num_current;
+  }
+
+  /* The runs cover every dirty tile once, before merging adds any. */
+  for (k = 0; k < num_rects; k++) {
+    region->stats.pixels_marked += (Uint64)rect_area(&region->rects[k]);
+  }
+  num_rects = merge_rects(region, num_rects);
+
+  region->stats.frames++;
+  region->stats.rects_pushed += num_rects;
+  for (k = 0; k < num_rects; k++) {
+    region->stats.pixels_pushed += (Uint64)rect_area(&region->rects[k]);
+  }
+
+  memset(region->bits, 0,
+         sizeof(Uint32) * region->words_per_row * region->rows);
+  region->any_dirty = 0;
+
+  *rects = region->rects;
+  return num_rects;
+
+out_of_memory:
+  SDL_OutOfMemory();
+  *rects = NULL;
+  return -1;
+}
+
+int sdlewDirtyFlush(SDLEW_DirtyRegion *region, SDL_Surface *screen) {
+  SDL_Rect *rects;
+  const int num_rects = sdlewDirtyGetRects(region, &rects);
+
+  if (num_rects > 0) {
+    SDL_UpdateRects(screen, num_rects, rects);
+  }
+  return num_rects;
+}
+
+void sdlewDirtyGetStats(const SDLEW_DirtyRegion *region,
+                        SDLEW_DirtyStats *stats) {
+  *stats = region->stats;
+}
+
+void sdlewDirtyResetStats(SDLEW_DirtyRegion *region) {
+  memset(&region->stats, 0, sizeof(region->stats));
+}
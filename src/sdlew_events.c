@@ -0,0 +1,450 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Batched event draining.
+ *
+ * SDL_PeepEvents() copies the events into the buffer in arrival order
+ * under a single lock of the SDL event queue, events from an attached user
+ * queue are appended, then a counting sort by kind scatters them into the
+ * grouped array, keeping arrival order within every kind.
+ *
+ * The user queue is a bounded multi-producer, single consumer ring of
+ * slots carrying a sequence number. A producer claims a position with a
+ * compare and swap, fills the slot and publishes it by bumping the
+ * sequence, the draining thread takes published slots in order and hands
+ * them back by bumping the sequence by a full lap.
+ */
+
+#include "sdlew_events.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_QUEUE_CAPACITY (1 << 24)
+
+/* Joystick axes tracked at once while coalescing, more are left alone. */
+#define MAX_AXES 64
+
+typedef struct EventSlot {
+  Uint32 sequence;
+  SDL_Event event;
+} EventSlot;
+
+struct SDLEW_UserEventQueue {
+  /* Constant after creation. */
+  EventSlot *slots;
+  Uint32 mask;
+  char pad0[SDLEW_CACHELINE];
+
+  /* Written by any thread. */
+  Uint32 enqueue_pos;
+  Uint32 overflows;
+  char pad1[SDLEW_CACHELINE];
+
+  /* Written by the draining thread. */
+  Uint32 dequeue_pos;
+  char pad2[SDLEW_CACHELINE];
+};
+
+struct SDLEW_EventBuffer {
+  int capacity;
+  int count;
+  SDL_Event *ordered;
+  SDL_Event *grouped;
+  int span_start[SDLEW_NUM_EVENT_KINDS];
+  int span_count[SDLEW_NUM_EVENT_KINDS];
+  SDLEW_UserEventQueue *queue;
+  SDLEW_EventRecorder *recorder;
+  SDLEW_EventReplay *replay;
+  SDLEW_InputState *input;
+  int coalesce;
+  int coalesced;
+};
+
+static const Uint8 event_kind[SDL_NUMEVENTS] = {
+  SDLEW_EVENTS_OTHER,     /* SDL_NOEVENT */
+  SDLEW_EVENTS_WINDOW,    /* SDL_ACTIVEEVENT */
+  SDLEW_EVENTS_KEY,       /* SDL_KEYDOWN */
+  SDLEW_EVENTS_KEY,       /* SDL_KEYUP */
+  SDLEW_EVENTS_MOTION,    /* SDL_MOUSEMOTION */
+  SDLEW_EVENTS_BUTTON,    /* SDL_MOUSEBUTTONDOWN */
+  SDLEW_EVENTS_BUTTON,    /* SDL_MOUSEBUTTONUP */
+  SDLEW_EVENTS_JOYSTICK,  /* SDL_JOYAXISMOTION */
+  SDLEW_EVENTS_JOYSTICK,  /* SDL_JOYBALLMOTION */
+  SDLEW_EVENTS_JOYSTICK,  /* SDL_JOYHATMOTION */
+  SDLEW_EVENTS_JOYSTICK,  /* SDL_JOYBUTTONDOWN */
+  SDLEW_EVENTS_JOYSTICK,  /* SDL_JOYBUTTONUP */
+  SDLEW_EVENTS_OTHER,     /* SDL_QUIT */
+  SDLEW_EVENTS_OTHER,     /* SDL_SYSWMEVENT */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVEDA */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVEDB */
+  SDLEW_EVENTS_WINDOW,    /* SDL_VIDEORESIZE */
+  SDLEW_EVENTS_WINDOW,    /* SDL_VIDEOEXPOSE */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED2 */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED3 */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED4 */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED5 */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED6 */
+  SDLEW_EVENTS_OTHER,     /* SDL_EVENT_RESERVED7 */
+  SDLEW_EVENTS_USER, SDLEW_EVENTS_USER, SDLEW_EVENTS_USER,
+  SDLEW_EVENTS_USER, SDLEW_EVENTS_USER, SDLEW_EVENTS_USER,
+  SDLEW_EVENTS_USER, SDLEW_EVENTS_USER,
+};
+
+/* User event queue. */
+
+SDLEW_UserEventQueue *sdlewUserEventQueueCreate(int capacity) {
+  SDLEW_UserEventQueue *queue;
+  Uint32 size = 1, i;
+
+  if (capacity <= 0 || capacity > MAX_QUEUE_CAPACITY) {
+    SDL_SetError("sdlewUserEventQueueCreate: invalid capacity");
+    return NULL;
+  }
+  while (size < (Uint32)capacity) {
+    size *= 2;
+  }
+
+  queue = (SDLEW_UserEventQueue *)sdlew_aligned_malloc(
+      sizeof(SDLEW_UserEventQueue), SDLEW_CACHELINE);
+  if (queue == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(queue, 0, sizeof(SDLEW_UserEventQueue));
+
+  queue->slots = (EventSlot *)malloc(sizeof(EventSlot) * size);
+  if (queue->slots == NULL) {
+    sdlew_aligned_free(queue);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  for (i = 0; i < size; i++) {
+    queue->slots[i].sequence = i;
+  }
+  queue->mask = size - 1;
+  return queue;
+}
+
+void sdlewUserEventQueueFree(SDLEW_UserEventQueue *queue) {
+  if (queue != NULL) {
+    free(queue->slots);
+    sdlew_aligned_free(queue);
+  }
+}
+
+int sdlewPushUserEvent(SDLEW_UserEventQueue *queue, const SDL_Event *event) {
+  Uint32 pos;
+  EventSlot *slot;
+
+  if (event->type < SDL_USEREVENT || event->type >= SDL_NUMEVENTS) {
+    SDL_SetError("sdlewPushUserEvent: not a user event");
+    return -1;
+  }
+
+  pos = sdlew_atomic_load(&queue->enqueue_pos);
+  for (;;) {
+    Sint32 diff;
+
+    slot = &queue->slots[pos & queue->mask];
+    diff = (Sint32)(sdlew_atomic_load(&slot->sequence) - pos);
+    if (diff == 0) {
+      if (sdlew_atomic_cas(&queue->enqueue_pos, pos, pos + 1)) {
+        break;
+      }
+    }
+    else if (diff < 0) {
+      sdlew_atomic_add(&queue->overflows, 1);
+      SDL_SetError("sdlewPushUserEvent: queue is full");
+      return -1;
+    }
+    pos = sdlew_atomic_load(&queue->enqueue_pos);
+  }
+
+  slot->event = *event;
+  sdlew_atomic_store(&slot->sequence, pos + 1);
+  return 0;
+}
+
+Uint32 sdlewUserEventQueueOverflows(const SDLEW_UserEventQueue *queue) {
+  return sdlew_atomic_load(&queue->overflows);
+}
+
+/* Take up to n published events matching mask, stopping at the first one
+ * which does not so the queue stays in order.
+ */
+static int queue_take(SDLEW_UserEventQueue *queue, SDL_Event *events, int n,
+                      Uint32 mask) {
+  int count = 0;
+
+  while (count < n) {
+    const Uint32 pos = queue->dequeue_pos;
+    EventSlot *slot = &queue->slots[pos & queue->mask];
+
+    if ((Sint32)(sdlew_atomic_load(&slot->sequence) - (pos + 1)) < 0 ||
+        !(SDL_EVENTMASK(slot->event.type) & mask))
+    {
+      break;
+    }
+    events[count++] = slot->event;
+    sdlew_atomic_store(&slot->sequence, pos + queue->mask + 1);
+    queue->dequeue_pos = pos + 1;
+  }
+
+  return count;
+}
+
+/* Coalescing. */
+
+static Sint16 add_rel(Sint16 a, Sint16 b) {
+  const int sum = a + b;
+
+  return (Sint16)(sum < -32768 ? -32768 : sum > 32767 ? 32767 : sum);
+}
+
+/* Coalesce count events in place and return how many are left. Events are
+ * merged into the output slot of the first one, which is already written.
+ */
+static int coalesce_events(SDL_Event *events, int count, int flags) {
+  int axis_key[MAX_AXES], axis_slot[MAX_AXES];
+  int num_axes = 0, motion_slot = -1, last_resize = -1, last_expose = -1;
+  int i, j = 0, k;
+
+  if (flags & SDLEW_COALESCE_WINDOW) {
+    for (i = 0; i < count; i++) {
+      if (events[i].type == SDL_VIDEORESIZE) {
+        last_resize = i;
+      }
+      else if (events[i].type == SDL_VIDEOEXPOSE) {
+        last_expose = i;
+      }
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    const SDL_Event *event = &events[i];
+
+    /* Any other event in between ends a run of motion, so handlers never
+     * see the cursor position after it before it.
+     */
+    if (event->type != SDL_MOUSEMOTION) {
+      motion_slot = -1;
+    }
+
+    switch (event->type) {
+      case SDL_MOUSEMOTION:
+        if (flags & SDLEW_COALESCE_MOTION) {
+          if (motion_slot != -1) {
+            SDL_MouseMotionEvent *motion = &events[motion_slot].motion;
+
+            motion->state = event->motion.state;
+            motion->x = event->motion.x;
+            motion->y = event->motion.y;
+            motion->xrel = add_rel(motion->xrel, event->motion.xrel);
+            motion->yrel = add_rel(motion->yrel, event->motion.yrel);
+            continue;
+          }
+          motion_slot = j;
+        }
+        break;
+      case SDL_VIDEORESIZE:
+        if ((flags & SDLEW_COALESCE_WINDOW) && i != last_resize) {
+          continue;
+        }
+        break;
+      case SDL_VIDEOEXPOSE:
+        if ((flags & SDLEW_COALESCE_WINDOW) && i != last_expose) {
+          continue;
+        }
+        break;
+      case SDL_JOYAXISMOTION:
+        if (flags & SDLEW_COALESCE_JOYAXIS) {
+          const int key = (event->jaxis.which << 8) | event->jaxis.axis;
+
+          k = 0;
+          while (k < num_axes && axis_key[k] != key) {
+            k++;
+          }
+          if (k < num_axes) {
+            events[axis_slot[k]].jaxis.value = event->jaxis.value;
+            continue;
+          }
+          if (num_axes < MAX_AXES) {
+            axis_key[num_axes] = key;
+            axis_slot[num_axes] = j;
+            num_axes++;
+          }
+        }
+        break;
+      case SDL_JOYBALLMOTION:
+      case SDL_JOYHATMOTION:
+      case SDL_JOYBUTTONDOWN:
+      case SDL_JOYBUTTONUP:
+        num_axes = 0;
+        break;
+    }
+
+    if (j != i) {
+      events[j] = *event;
+    }
+    j++;
+  }
+
+  return j;
+}
+
+/* Event buffer. */
+
+SDLEW_EventBuffer *sdlewEventBufferCreate(int capacity) {
+  SDLEW_EventBuffer *buffer;
+
+  if (capacity <= 0) {
+    SDL_SetError("sdlewEventBufferCreate: invalid capacity");
+    return NULL;
+  }
+
+  buffer = (SDLEW_EventBuffer *)calloc(1, sizeof(SDLEW_EventBuffer));
+  if (buffer == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  buffer->ordered = (SDL_Event *)malloc(sizeof(SDL_Event) * capacity);
+  buffer->grouped = (SDL_Event *)malloc(sizeof(SDL_Event) * capacity);
+  if (buffer->ordered == NULL || buffer->grouped == NULL) {
+    sdlewEventBufferFree(buffer);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  buffer->capacity = capacity;
+  return buffer;
+}
+
+void sdlewEventBufferFree(SDLEW_EventBuffer *buffer) {
+  if (buffer != NULL) {
+    free(buffer->ordered);
+    free(buffer->grouped);
+    free(buffer);
+  }
+}
+
+void sdlewEventBufferSetCoalesce(SDLEW_EventBuffer *buffer, int flags) {
+  buffer->coalesce = flags & SDLEW_COALESCE_ALL;
+}
+
+int sdlewEventBufferCoalesced(const SDLEW_EventBuffer *buffer) {
+  return buffer->coalesced;
+}
+
+void sdlewEventBufferAttachQueue(SDLEW_EventBuffer *buffer,
+                                 SDLEW_UserEventQueue *queue) {
+  buffer->queue = queue;
+}
+
+void sdlewEventBufferAttachRecorder(SDLEW_EventBuffer *buffer,
+                                    SDLEW_EventRecorder *recorder) {
+  buffer->recorder = recorder;
+}
+
+void sdlewEventBufferAttachReplay(SDLEW_EventBuffer *buffer,
+                                  SDLEW_EventReplay *replay) {
+  buffer->replay = replay;
+}
+
+void sdlewEventBufferAttachInput(SDLEW_EventBuffer *buffer,
+                                 SDLEW_InputState *state) {
+  buffer->input = state;
+}
+
+int sdlewDrainEvents(SDLEW_EventBuffer *buffer, int cap, Uint32 mask) {
+  int offset[SDLEW_NUM_EVENT_KINDS];
+  int i, count, start = 0;
+
+  if (cap <= 0 || cap > buffer->capacity) {
+    cap = buffer->capacity;
+  }
+
+  buffer->count = 0;
+  buffer->coalesced = 0;
+  memset(buffer->span_count, 0, sizeof(buffer->span_count));
+  memset(buffer->span_start, 0, sizeof(buffer->span_start));
+
+  SDL_PumpEvents();
+  if (buffer->replay != NULL) {
+    count = sdlew_replay_take(buffer->replay, buffer->ordered, cap);
+  }
+  else {
+    count = SDL_PeepEvents(buffer->ordered, cap, SDL_GETEVENT, mask);
+    if (count < 0) {
+      /* SDL has set the error. */
+      return -1;
+    }
+  }
+  if (buffer->queue != NULL) {
+    count += queue_take(buffer->queue, buffer->ordered + count, cap - count,
+                        mask);
+  }
+  if (buffer->recorder != NULL) {
+    for (i = 0; i < count; i++) {
+      sdlewEventRecord(buffer->recorder, &buffer->ordered[i]);
+    }
+    sdlewEventRecordBatch(buffer->recorder);
+  }
+  if (buffer->coalesce) {
+    const int left = coalesce_events(buffer->ordered, count,
+                                     buffer->coalesce);
+
+    buffer->coalesced = count - left;
+    count = left;
+  }
+  buffer->count = count;
+
+  for (i = 0; i < count; i++) {
+    buffer->span_count[event_kind[buffer->ordered[i].type &
+                                  (SDL_NUMEVENTS - 1)]]++;
+  }
+  for (i = 0; i < SDLEW_NUM_EVENT_KINDS; i++) {
+    buffer->span_start[i] = start;
+    offset[i] = start;
+    start += buffer->span_count[i];
+  }
+  for (i = 0; i < count; i++) {
+    const int kind = event_kind[buffer->ordered[i].type &
+                                (SDL_NUMEVENTS - 1)];
+    buffer->grouped[offset[kind]++] = buffer->ordered[i];
+  }
+
+  if (buffer->input != NULL) {
+    sdlewInputStatePublish(buffer->input);
+  }
+  return count;
+}
+
+const SDL_Event *sdlewEventSpan(const SDLEW_EventBuffer *buffer, int kind,
+                                int *count) {
+  if (kind < 0 || kind >= SDLEW_NUM_EVENT_KINDS) {
+    *count = 0;
+    return buffer->grouped;
+  }
+  *count = buffer->span_count[kind];
+  return buffer->grouped + buffer->span_start[kind];
+}
+
+const SDL_Event *sdlewEventsOrdered(const SDLEW_EventBuffer *buffer,
+                                    int *count) {
+  *count = buffer->count;
+  return buffer->ordered;
+}
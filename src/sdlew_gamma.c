@@ -0,0 +1,342 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Software gamma ramps.
+ *
+ * The ramps are folded into one table per channel indexed by the raw
+ * channel bits of the pixel format and holding the corrected bits already
+ * shifted into place, so a truecolour pixel costs three lookups which stay
+ * in L1. SSE2 has no byte gather, and for 8 bit channels a table lookup is
+ * what a gather would boil down to anyway. Palettized surfaces remap their
+ * indices, conversions between formats go through RGBA.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <string.h>
+
+/* Pixels converted through RGBA at once. */
+#define RGBA_CHUNK 256
+
+enum {
+  MODE_DIRECT,
+  MODE_INDEXED,
+  MODE_RGBA,
+};
+
+typedef struct GammaTables {
+  /* Ramps reduced to 8 bits. */
+  Uint8 ramp[3][256];
+
+  /* Truecolour: raw channel bits to corrected bits in place. */
+  Uint32 channel[3][256];
+  Uint32 keep_mask;
+
+  /* Palettized: index of the closest corrected colour. */
+  Uint8 index[256];
+} GammaTables;
+
+static void tables_init_ramps(GammaTables *tables, const Uint16 *red,
+                              const Uint16 *green, const Uint16 *blue) {
+  const Uint16 *ramps[3];
+  int c, i;
+
+  ramps[0] = red;
+  ramps[1] = green;
+  ramps[2] = blue;
+  for (c = 0; c < 3; c++) {
+    for (i = 0; i < 256; i++) {
+      /* Like SDL_SetGammaRamp(), NULL leaves the channel alone. */
+      tables->ramp[c][i] = ramps[c] != NULL ? (Uint8)(ramps[c][i] >> 8)
+                                            : (Uint8)i;
+    }
+  }
+}
+
+/* Truecolour formats whose channels fit into the 256 entry tables. */
+static int format_direct(const SDL_PixelFormat *format) {
+  return format->BytesPerPixel >= 2 && format->palette == NULL &&
+         (format->Rmask >> format->Rshift) <= 0xff &&
+         (format->Gmask >> format->Gshift) <= 0xff &&
+         (format->Bmask >> format->Bshift) <= 0xff;
+}
+
+static void channel_table(const Uint8 *ramp, Uint32 mask, int shift,
+                          int loss, Uint32 *table) {
+  const Uint32 max = mask >> shift;
+  Uint32 v;
+
+  for (v = 0; v <= max; v++) {
+    const Uint8 value = ramp[sdlew_expand_channel(v, loss)];
+    table[v] = (Uint32)(value >> loss) << shift;
+  }
+}
+
+static void tables_init_direct(GammaTables *tables,
+                               const SDL_PixelFormat *format) {
+  channel_table(tables->ramp[0], format->Rmask, format->Rshift,
+                format->Rloss, tables->channel[0]);
+  channel_table(tables->ramp[1], format->Gmask, format->Gshift,
+                format->Gloss, tables->channel[1]);
+  channel_table(tables->ramp[2], format->Bmask, format->Bshift,
+                format->Bloss, tables->channel[2]);
+  tables->keep_mask = ~(format->Rmask | format->Gmask | format->Bmask);
+}
+
+static void tables_init_indexed(GammaTables *tables,
+                                const SDL_PixelFormat *format) {
+  const SDL_Palette *palette = format->palette;
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    if (i < palette->ncolors) {
+      const SDL_Color *color = &palette->colors[i];
+      tables->index[i] = (Uint8)SDL_MapRGB(format,
+                                           tables->ramp[0][color->r],
+                                           tables->ramp[1][color->g],
+                                           tables->ramp[2][color->b]);
+    }
+    else {
+      tables->index[i] = (Uint8)i;
+    }
+  }
+}
+
+/* Row kernels. */
+
+static void row_direct(const GammaTables *tables,
+                       const SDL_PixelFormat *format,
+                       const Uint8 *src, Uint8 *dst, int width) {
+  const Uint32 *rt = tables->channel[0];
+  const Uint32 *gt = tables->channel[1];
+  const Uint32 *bt = tables->channel[2];
+  const Uint32 rmask = format->Rmask, gmask = format->Gmask;
+  const Uint32 bmask = format->Bmask, keep = tables->keep_mask;
+  const int rshift = format->Rshift, gshift = format->Gshift;
+  const int bshift = format->Bshift;
+  const int bpp = format->BytesPerPixel;
+  int x;
+
+#define GAMMA_PIXEL(p) \
+  (rt[((p) & rmask) >> rshift] | gt[((p) & gmask) >> gshift] | \
+   bt[((p) & bmask) >> bshift] | ((p) & keep))
+
+  if (bpp == 4) {
+    const Uint32 *s = (const Uint32 *)src;
+    Uint32 *d = (Uint32 *)dst;
+    for (x = 0; x + 2 <= width; x += 2) {
+      const Uint32 p0 = s[x], p1 = s[x + 1];
+      d[x] = GAMMA_PIXEL(p0);
+      d[x + 1] = GAMMA_PIXEL(p1);
+    }
+    if (x < width) {
+      const Uint32 p = s[x];
+      d[x] = GAMMA_PIXEL(p);
+    }
+  }
+  else if (bpp == 2) {
+    const Uint16 *s = (const Uint16 *)src;
+    Uint16 *d = (Uint16 *)dst;
+    for (x = 0; x < width; x++) {
+      const Uint32 p = s[x];
+      d[x] = (Uint16)GAMMA_PIXEL(p);
+    }
+  }
+  else {
+    for (x = 0; x < width; x++, src += bpp, dst += bpp) {
+      const Uint32 p = sdlew_pixel_get(src, bpp);
+      sdlew_pixel_put(dst, bpp, GAMMA_PIXEL(p));
+    }
+  }
+
+#undef GAMMA_PIXEL
+}
+
+static void row_indexed(const GammaTables *tables, const Uint8 *src,
+                        Uint8 *dst, int width) {
+  int x;
+
+  for (x = 0; x < width; x++) {
+    dst[x] = tables->index[src[x]];
+  }
+}
+
+static void row_rgba(const GammaTables *tables,
+                     const SDL_PixelFormat *src_format, const Uint8 *src,
+                     const SDL_PixelFormat *dst_format, Uint8 *dst,
+                     int width) {
+  Uint8 rgba[RGBA_CHUNK * 4];
+
+  while (width > 0) {
+    const int n = width < RGBA_CHUNK ? width : RGBA_CHUNK;
+    int i;
+
+    sdlew_row_to_rgba(src_format, src, rgba, n);
+    for (i = 0; i < n; i++) {
+      rgba[i * 4 + 0] = tables->ramp[0][rgba[i * 4 + 0]];
+      rgba[i * 4 + 1] = tables->ramp[1][rgba[i * 4 + 1]];
+      rgba[i * 4 + 2] = tables->ramp[2][rgba[i * 4 + 2]];
+    }
+    sdlew_row_from_rgba(dst_format, rgba, dst, n);
+
+    src += n * src_format->BytesPerPixel;
+    dst += n * dst_format->BytesPerPixel;
+    width -= n;
+  }
+}
+
+/* Apply the ramps to a w by h block, src and dst may be the same. */
+static void gamma_block(const Uint16 *red, const Uint16 *green,
+                        const Uint16 *blue,
+                        const SDL_Surface *src, int srcx, int srcy,
+                        SDL_Surface *dst, int dstx, int dsty, int w, int h) {
+  const SDL_PixelFormat *sf = src->format, *df = dst->format;
+  const int same_format = sf->BytesPerPixel == df->BytesPerPixel &&
+                          sf->Rmask == df->Rmask && sf->Gmask == df->Gmask &&
+                          sf->Bmask == df->Bmask && sf->Amask == df->Amask;
+  GammaTables tables;
+  int mode, y;
+
+  tables_init_ramps(&tables, red, green, blue);
+  if (same_format && format_direct(df)) {
+    tables_init_direct(&tables, df);
+    mode = MODE_DIRECT;
+  }
+  else if (src == dst && df->BytesPerPixel == 1 && df->palette != NULL) {
+    tables_init_indexed(&tables, df);
+    mode = MODE_INDEXED;
+  }
+  else {
+    mode = MODE_RGBA;
+  }
+
+  for (y = 0; y < h; y++) {
+    const Uint8 *s = (const Uint8 *)src->pixels + (srcy + y) * src->pitch +
+                     srcx * sf->BytesPerPixel;
+    Uint8 *d = (Uint8 *)dst->pixels + (dsty + y) * dst->pitch +
+               dstx * df->BytesPerPixel;
+
+    switch (mode) {
+      case MODE_DIRECT:
+        row_direct(&tables, df, s, d, w);
+        break;
+      case MODE_INDEXED:
+        row_indexed(&tables, s, d, w);
+        break;
+      default:
+        row_rgba(&tables, sf, s, df, d, w);
+        break;
+    }
+  }
+}
+
+int sdlewApplyGammaRamp(SDL_Surface *surface, const SDL_Rect *rect,
+                        const Uint16 *red, const Uint16 *green,
+                        const Uint16 *blue) {
+  SDL_Rect area;
+  int x0, y0, x1, y1;
+
+  if (surface == NULL) {
+    SDL_SetError("sdlewApplyGammaRamp: passed a NULL pointer");
+    return -1;
+  }
+
+  /* Restricted to the clip rectangle, like SDL_FillRect(). */
+  area = surface->clip_rect;
+  x0 = area.x;
+  y0 = area.y;
+  x1 = area.x + area.w;
+  y1 = area.y + area.h;
+  if (rect != NULL) {
+    x0 = rect->x > x0 ? rect->x : x0;
+    y0 = rect->y > y0 ? rect->y : y0;
+    x1 = rect->x + rect->w < x1 ? rect->x + rect->w : x1;
+    y1 = rect->y + rect->h < y1 ? rect->y + rect->h : y1;
+  }
+  if (x1 <= x0 || y1 <= y0) {
+    return 0;
+  }
+
+  if (SDL_MUSTLOCK(surface)) {
+    if (SDL_LockSurface(surface) < 0) {
+      return -1;
+    }
+  }
+
+  gamma_block(red, green, blue, surface, x0, y0, surface, x0, y0,
+              x1 - x0, y1 - y0);
+
+  if (SDL_MUSTLOCK(surface)) {
+    SDL_UnlockSurface(surface);
+  }
+
+  return 0;
+}
+
+int sdlewBlitGammaRamp(SDL_Surface *src, const SDL_Rect *srcrect,
+                       SDL_Surface *dst, SDL_Rect *dstrect,
+                       const Uint16 *red, const Uint16 *green,
+                       const Uint16 *blue) {
+  SDL_Rect full;
+  int srcx, srcy, src_locked = 0;
+
+  if (src == NULL || dst == NULL) {
+    SDL_SetError("sdlewBlitGammaRamp: passed a NULL pointer");
+    return -1;
+  }
+  if (src == dst) {
+    SDL_SetError("sdlewBlitGammaRamp: source and destination are the same");
+    return -1;
+  }
+  if (dstrect == NULL) {
+    full.x = full.y = 0;
+    dstrect = &full;
+  }
+
+  if (!sdlew_clip_blit(src->w, src->h, srcrect, &dst->clip_rect, dstrect,
+                       &srcx, &srcy))
+  {
+    return 0;
+  }
+
+  if (SDL_MUSTLOCK(src)) {
+    if (SDL_LockSurface(src) < 0) {
+      return -1;
+    }
+    src_locked = 1;
+  }
+  if (SDL_MUSTLOCK(dst)) {
+    if (SDL_LockSurface(dst) < 0) {
+      if (src_locked) {
+        SDL_UnlockSurface(src);
+      }
+      return -1;
+    }
+  }
+
+  gamma_block(red, green, blue, src, srcx, srcy, dst, dstrect->x,
+              dstrect->y, dstrect->w, dstrect->h);
+
+  if (SDL_MUSTLOCK(dst)) {
+    SDL_UnlockSurface(dst);
+  }
+  if (src_locked) {
+    SDL_UnlockSurface(src);
+  }
+
+  return 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "sdlew_gl.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* GL enums used here, values as in SDL_opengl.h. */
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_RGB8 0x8051
+#define GL_RGBA8 0x8058
+#define GL_BGR 0x80E0
+#define GL_BGRA 0x80E1
+#define GL_UNSIGNED_SHORT_4_4_4_4 0x8033
+#define GL_UNSIGNED_SHORT_5_5_5_1 0x8034
+#define GL_UNSIGNED_INT_8_8_8_8 0x8035
+#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#define GL_UNSIGNED_SHORT_5_6_5_REV 0x8364
+#define GL_UNSIGNED_SHORT_4_4_4_4_REV 0x8365
+#define GL_UNSIGNED_SHORT_1_5_5_5_REV 0x8366
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_TEXTURE_BINDING_2D 0x8069
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#define GL_UNPACK_SKIP_ROWS 0x0CF3
+#define GL_UNPACK_SKIP_PIXELS 0x0CF4
+#define GL_UNPACK_ALIGNMENT 0x0CF5
+#define GL_EXTENSIONS 0x1F03
+#define GL_PIXEL_UNPACK_BUFFER_ARB 0x88EC
+#define GL_PIXEL_UNPACK_BUFFER_BINDING_ARB 0x88EF
+#define GL_STREAM_DRAW_ARB 0x88E0
+#define GL_WRITE_ONLY_ARB 0x88B9
+
+/* Pixel buffer objects cycled through, so an upload does not have to
+ * wait for the driver to finish reading the previous one.
+ */
+#define NUM_BUFFERS 3
+
+typedef struct GLPixelFormat {
+  int bpp;
+  Uint32 Rmask, Gmask, Bmask, Amask;
+  unsigned int format, type;
+} GLPixelFormat;
+
+/* Packed types are read as native integers, so apart from 24 bit these
+ * hold on either byte order.
+ */
+static const GLPixelFormat gl_formats[] = {
+  {4, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000,
+   GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV},
+  {4, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000,
+   GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV},
+  {4, 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff,
+   GL_RGBA, GL_UNSIGNED_INT_8_8_8_8},
+  {4, 0x0000ff00, 0x00ff0000, 0xff000000, 0x000000ff,
+   GL_BGRA, GL_UNSIGNED_INT_8_8_8_8},
+  /* The same without alpha, like SDL_DisplayFormat() surfaces. The
+   * padding is uploaded as alpha and must go into an RGB texture, see
+   * sdlewGLInternalFormat().
+   */
+  {4, 0x00ff0000, 0x0000ff00, 0x000000ff, 0,
+   GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV},
+  {4, 0x000000ff, 0x0000ff00, 0x00ff0000, 0,
+   GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV},
+  {4, 0xff000000, 0x00ff0000, 0x0000ff00, 0,
+   GL_RGBA, GL_UNSIGNED_INT_8_8_8_8},
+  {4, 0x0000ff00, 0x00ff0000, 0xff000000, 0,
+   GL_BGRA, GL_UNSIGNED_INT_8_8_8_8},
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+  {3, 0x000000ff, 0x0000ff00, 0x00ff0000, 0, GL_RGB, GL_UNSIGNED_BYTE},
+  {3, 0x00ff0000, 0x0000ff00, 0x000000ff, 0, GL_BGR, GL_UNSIGNED_BYTE},
+#else
+  {3, 0x00ff0000, 0x0000ff00, 0x000000ff, 0, GL_RGB, GL_UNSIGNED_BYTE},
+  {3, 0x000000ff, 0x0000ff00, 0x00ff0000, 0, GL_BGR, GL_UNSIGNED_BYTE},
+#endif
+  {2, 0xf800, 0x07e0, 0x001f, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5},
+  {2, 0x001f, 0x07e0, 0xf800, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5_REV},
+  {2, 0x7c00, 0x03e0, 0x001f, 0x8000,
+   GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV},
+  {2, 0x7c00, 0x03e0, 0x001f, 0, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV},
+  {2, 0xf800, 0x07c0, 0x003e, 0x0001, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1},
+  {2, 0x0f00, 0x00f0, 0x000f, 0xf000,
+   GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV},
+  {2, 0xf000, 0x0f00, 0x00f0, 0x000f, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4},
+};
+
+/* Anything else is converted to this. */
+static const GLPixelFormat gl_format_rgba = {
+  4, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE
+};
+
+static struct {
+  int initialized;
+  int user_functions;
+  SDLEW_GLFunctions gl;
+  int have_pbo;
+
+  unsigned int buffers[NUM_BUFFERS];
+  int num_buffers;
+  int next_buffer;
+
+  /* Client memory staging without buffer objects. */
+  Uint8 *staging;
+  size_t staging_size;
+} state;
+
+/* Initialization. */
+
+static int has_extension(const char *extensions, const char *name) {
+  const size_t len = strlen(name);
+  const char *p = extensions;
+
+  while ((p = strstr(p, name)) != NULL) {
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || !p[len])) {
+      return 1;
+    }
+    p += len;
+  }
+  return 0;
+}
+
+static void load_functions(SDLEW_GLFunctions *gl) {
+  memset(gl, 0, sizeof(*gl));
+  if (SDL_GL_GetProcAddress == NULL) {
+    return;
+  }
+
+#define LOAD(name) \
+  *(void **)&gl->name = SDL_GL_GetProcAddress("gl" #name)
+
+  LOAD(GetString);
+  LOAD(GetIntegerv);
+  LOAD(PixelStorei);
+  LOAD(BindTexture);
+  LOAD(TexSubImage2D);
+  LOAD(GenBuffersARB);
+  LOAD(DeleteBuffersARB);
+  LOAD(BindBufferARB);
+  LOAD(BufferDataARB);
+  LOAD(MapBufferARB);
+  LOAD(UnmapBufferARB);
+
+#undef LOAD
+}
+
+static int state_init(void) {
+  const SDLEW_GLFunctions *gl = &state.gl;
+  const char *extensions;
+
+  if (state.initialized) {
+    return 1;
+  }
+  if (!state.user_functions) {
+    load_functions(&state.gl);
+  }
+  if (gl->GetString == NULL || gl->GetIntegerv == NULL ||
+      gl->PixelStorei == NULL || gl->BindTexture == NULL ||
+      gl->TexSubImage2D == NULL)
+  {
+    SDL_SetError("sdlewGLUploadSurface: OpenGL functions not available");
+    return 0;
+  }
+
+  extensions = (const char *)gl->GetString(GL_EXTENSIONS);
+  state.have_pbo = extensions != NULL &&
+                   has_extension(extensions, "GL_ARB_pixel_buffer_object") &&
+                   gl->GenBuffersARB != NULL && gl->DeleteBuffersARB != NULL &&
+                   gl->BindBufferARB != NULL && gl->BufferDataARB != NULL &&
+                   gl->MapBufferARB != NULL && gl->UnmapBufferARB != NULL;
+  if (state.have_pbo) {
+    gl->GenBuffersARB(NUM_BUFFERS, state.buffers);
+    state.num_buffers = NUM_BUFFERS;
+    state.next_buffer = 0;
+  }
+
+  state.initialized = 1;
+  return 1;
+}
+
+void sdlewGLReleaseBuffers(void) {
+  if (state.num_buffers > 0) {
+    state.gl.DeleteBuffersARB(state.num_buffers, state.buffers);
+    state.num_buffers = 0;
+  }
+  free(state.staging);
+  state.staging = NULL;
+  state.staging_size = 0;
+  state.initialized = 0;
+}
+
+void sdlewGLSetFunctions(const SDLEW_GLFunctions *functions) {
+  sdlewGLReleaseBuffers();
+  if (functions != NULL) {
+    state.gl = *functions;
+    state.user_functions = 1;
+  }
+  else {
+    memset(&state.gl, 0, sizeof(state.gl));
+    state.user_functions = 0;
+  }
+}
+
+/* Uploading. */
+
+static const GLPixelFormat *find_format(const SDL_PixelFormat *format) {
+  size_t i;
+
+  if (format->palette != NULL) {
+    return NULL;
+  }
+  for (i = 0; i < sizeof(gl_formats) / sizeof(gl_formats[0]); i++) {
+    const GLPixelFormat *f = &gl_formats[i];
+    /* Alpha must match too, surfaces without alpha only take the
+     * entries without alpha.
+     */
+    if (f->bpp == format->BytesPerPixel && f->Rmask == format->Rmask &&
+        f->Gmask == format->Gmask && f->Bmask == format->Bmask &&
+        f->Amask == format->Amask)
+    {
+      return f;
+    }
+  }
+  return NULL;
+}
+
+unsigned int sdlewGLInternalFormat(const SDL_Surface *surface) {
+  return surface->format->Amask != 0 ? GL_RGBA8 : GL_RGB8;
+}
+
+/* Copy or convert the rectangle into tightly packed rows. */
+static void fill_staging(const SDL_Surface *surface, const SDL_Rect *rect,
+                         const GLPixelFormat *gl_format, Uint8 *dst) {
+  const int bpp = surface->format->BytesPerPixel;
+  const int row_size = rect->w * gl_format->bpp;
+  int y;
+
+  for (y = 0; y < rect->h; y++, dst += row_size) {
+    const Uint8 *src = (const Uint8 *)surface->pixels +
+                       (rect->y + y) * surface->pitch + rect->x * bpp;
+    if (gl_format == &gl_format_rgba) {
+      sdlew_row_to_rgba(surface->format, src, dst, rect->w);
+    }
+    else {
+      memcpy(dst, src, row_size);
+    }
+  }
+}
+
+static int upload_pbo(const SDL_Surface *surface, const SDL_Rect *rect,
+                      const GLPixelFormat *gl_format) {
+  const SDLEW_GLFunctions *gl = &state.gl;
+  const ptrdiff_t size = (ptrdiff_t)rect->w * rect->h * gl_format->bpp;
+  void *mapped;
+
+  gl->BindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,
+                    state.buffers[state.next_buffer]);
+  state.next_buffer = (state.next_buffer + 1) % state.num_buffers;
+
+  /* Respecifying the storage lets the driver hand out fresh memory instead
+   * of waiting for a pending transfer from the buffer.
+   */
+  gl->BufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, size, NULL,
+                    GL_STREAM_DRAW_ARB);
+  mapped = gl->MapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+  if (mapped == NULL) {
+    return 0;
+  }
+  fill_staging(surface, rect, gl_format, (Uint8 *)mapped);
+  if (!gl->UnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB)) {
+    /* Contents got lost, e.g. on a mode switch. */
+    return 0;
+  }
+
+  gl->PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  gl->PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  gl->TexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h,
+                    gl_format->format, gl_format->type, NULL);
+  return 1;
+}
+
+static int upload_client(const SDL_Surface *surface, const SDL_Rect *rect,
+                         const GLPixelFormat *gl_format) {
+  const SDLEW_GLFunctions *gl = &state.gl;
+  const int bpp = surface->format->BytesPerPixel;
+  const size_t size = (size_t)rect->w * rect->h * gl_format->bpp;
+
+  if (gl_format != &gl_format_rgba && surface->pitch % bpp == 0) {
+    /* Matching format, GL reads the surface rows directly. */
+    const Uint8 *pixels = (const Uint8 *)surface->pixels +
+                          rect->y * surface->pitch + rect->x * bpp;
+    const int alignment = surface->pitch % 8 == 0 ? 8 :
+                          surface->pitch % 4 == 0 ? 4 :
+                          surface->pitch % 2 == 0 ? 2 : 1;
+
+    gl->PixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / bpp);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    gl->TexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h,
+                      gl_format->format, gl_format->type, pixels);
+    return 1;
+  }
+
+  if (size > state.staging_size) {
+    free(state.staging);
+    state.staging = (Uint8 *)malloc(size);
+    if (state.staging == NULL) {
+      state.staging_size = 0;
+      SDL_OutOfMemory();
+      return 0;
+    }
+    state.staging_size = size;
+  }
+  fill_staging(surface, rect, gl_format, state.staging);
+
+  gl->PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  gl->PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  gl->TexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h,
+                    gl_format->format, gl_format->type, state.staging);
+  return 1;
+}
+
+int sdlewGLUploadSurface(SDL_Surface *surface, unsigned int texture,
+                         const SDL_Rect *rect) {
+  const SDLEW_GLFunctions *gl = &state.gl;
+  const GLPixelFormat *gl_format;
+  SDL_Rect area;
+  int old_texture = 0, old_row_length = 0, old_alignment = 4;
+  int old_skip_rows = 0, old_skip_pixels = 0, old_buffer = 0;
+  int ok;
+
+  if (surface == NULL) {
+    SDL_SetError("sdlewGLUploadSurface: passed a NULL pointer");
+    return -1;
+  }
+  if (!state_init()) {
+    return -1;
+  }
+
+  area.x = 0;
+  area.y = 0;
+  area.w = (Uint16)surface->w;
+  area.h = (Uint16)surface->h;
+  if (rect != NULL) {
+    const int x0 = rect->x > 0 ? rect->x : 0;
+    const int y0 = rect->y > 0 ? rect->y : 0;
+    const int x1 = rect->x + rect->w < surface->w ? rect->x + rect->w
+                                                    : surface->w;
+    const int y1 = rect->y + rect->h < surface->h ? rect->y + rect->h
+                                                    : surface->h;
+    if (x1 <= x0 || y1 <= y0) {
+      return 0;
+    }
+    area.x = (Sint16)x0;
+    area.y = (Sint16)y0;
+    area.w = (Uint16)(x1 - x0);
+    area.h = (Uint16)(y1 - y0);
+  }
+
+  gl_format = find_format(surface->format);
+  if (gl_format == NULL) {
+    gl_format = &gl_format_rgba;
+  }
+
+  if (SDL_MUSTLOCK(surface)) {
+    if (SDL_LockSurface(surface) < 0) {
+      return -1;
+    }
+  }
+
+  gl->GetIntegerv(GL_TEXTURE_BINDING_2D, &old_texture);
+  gl->GetIntegerv(GL_UNPACK_ROW_LENGTH, &old_row_length);
+  gl->GetIntegerv(GL_UNPACK_ALIGNMENT, &old_alignment);
+  gl->GetIntegerv(GL_UNPACK_SKIP_ROWS, &old_skip_rows);
+  gl->GetIntegerv(GL_UNPACK_SKIP_PIXELS, &old_skip_pixels);
+
+  gl->BindTexture(GL_TEXTURE_2D, texture);
+  if (old_skip_rows != 0) {
+    gl->PixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  }
+  if (old_skip_pixels != 0) {
+    gl->PixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  }
+
+  if (state.have_pbo) {
+    gl->GetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING_ARB, &old_buffer);
+    ok = upload_pbo(surface, &area, gl_format);
+    if (!ok) {
+      /* Client memory pointers are offsets while a buffer is bound. */
+      gl->BindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+      ok = upload_client(surface, &area, gl_format);
+    }
+    gl->BindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, (unsigned int)old_buffer);
+  }
+  else {
+    ok = upload_client(surface, &area, gl_format);
+  }
+
+  gl->PixelStorei(GL_UNPACK_ROW_LENGTH, old_row_length);
+  gl->PixelStorei(GL_UNPACK_ALIGNMENT, old_alignment);
+  if (old_skip_rows != 0) {
+    gl->PixelStorei(GL_UNPACK_SKIP_ROWS, old_skip_rows);
+  }
+  if (old_skip_pixels != 0) {
+    gl->PixelStorei(GL_UNPACK_SKIP_PIXELS, old_skip_pixels);
+  }
+  gl->BindTexture(GL_TEXTURE_2D, (unsigned int)old_texture);
+
+  if (SDL_MUSTLOCK(surface)) {
+    SDL_UnlockSurface(surface);
+  }
+
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Input snapshots.
+ *
+ * Snapshots are triple buffered: the event thread fills the slot after
+ * the current one and publishes it by storing its index, so readers keep
+ * two publications worth of time to copy the slot they picked. Each slot
+ * also carries a version which is odd while it is being written, so a
+ * reader which was too slow notices and retries instead of returning a
+ * torn snapshot. The writer never waits for readers.
+ */
+
+#include "sdlew_events.h"
+#include "sdlew_intern.h"
+
+#include <string.h>
+
+#define NUM_SLOTS 3
+
+typedef struct InputSlot {
+  Uint32 version;
+  SDLEW_InputSnapshot snapshot;
+  char pad[SDLEW_CACHELINE];
+} InputSlot;
+
+struct SDLEW_InputState {
+  InputSlot slots[NUM_SLOTS];
+
+  /* Written by the event thread. */
+  int current;
+  Uint32 sequence;
+  int num_joysticks;
+  SDL_Joystick *joysticks[SDLEW_INPUT_MAX_JOYSTICKS];
+};
+
+SDLEW_InputState *sdlewInputStateCreate(void) {
+  SDLEW_InputState *state;
+
+  state = (SDLEW_InputState *)sdlew_aligned_malloc(sizeof(SDLEW_InputState),
+                                                   SDLEW_CACHELINE);
+  if (state == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(state, 0, sizeof(SDLEW_InputState));
+  return state;
+}
+
+void sdlewInputStateFree(SDLEW_InputState *state) {
+  sdlew_aligned_free(state);
+}
+
+void sdlewInputStateSetJoysticks(SDLEW_InputState *state,
+                                 SDL_Joystick *const *joysticks, int num) {
+  int i;
+
+  if (num > SDLEW_INPUT_MAX_JOYSTICKS) {
+    num = SDLEW_INPUT_MAX_JOYSTICKS;
+  }
+  state->num_joysticks = 0;
+  for (i = 0; i < num; i++) {
+    if (joysticks[i] != NULL) {
+      state->joysticks[state->num_joysticks++] = joysticks[i];
+    }
+  }
+}
+
+static void capture(SDLEW_InputState *state, SDLEW_InputSnapshot *snapshot) {
+  const Uint8 *keystate;
+  int i, j, num_keys = 0;
+
+  snapshot->sequence = ++state->sequence;
+  snapshot->ticks = SDL_GetTicks();
+
+  memset(snapshot->keys, 0, sizeof(snapshot->keys));
+  keystate = SDL_GetKeyState(&num_keys);
+  if (num_keys > SDLK_LAST) {
+    num_keys = SDLK_LAST;
+  }
+  for (i = 0; i < num_keys; i++) {
+    if (keystate[i]) {
+      snapshot->keys[i >> 5] |= (Uint32)1 << (i & 31);
+    }
+  }
+  snapshot->mod = SDL_GetModState();
+  snapshot->mouse_buttons = SDL_GetMouseState(&snapshot->mouse_x,
+                                              &snapshot->mouse_y);
+
+  snapshot->num_joysticks = state->num_joysticks;
+  for (i = 0; i < state->num_joysticks; i++) {
+    SDL_Joystick *joystick = state->joysticks[i];
+    int num_axes = SDL_JoystickNumAxes(joystick);
+
+    if (num_axes > SDLEW_INPUT_MAX_AXES) {
+      num_axes = SDLEW_INPUT_MAX_AXES;
+    }
+    snapshot->num_axes[i] = num_axes;
+    for (j = 0; j < num_axes; j++) {
+      snapshot->axes[i][j] = SDL_JoystickGetAxis(joystick, j);
+    }
+  }
+}
+
+void sdlewInputStatePublish(SDLEW_InputState *state) {
+  const int index = (state->current + 1) % NUM_SLOTS;
+  InputSlot *slot = &state->slots[index];
+
+  sdlew_atomic_store(&slot->version, slot->version + 1);
+  sdlew_write_barrier();
+  capture(state, &slot->snapshot);
+  sdlew_atomic_store(&slot->version, slot->version + 1);
+
+  sdlew_atomic_store(&state->current, index);
+}
+
+void sdlewInputStateRead(const SDLEW_InputState *state,
+                         SDLEW_InputSnapshot *snapshot) {
+  for (;;) {
+    const InputSlot *slot = &state->slots[sdlew_atomic_load(&state->current)];
+    const Uint32 version = sdlew_atomic_load(&slot->version);
+
+    if (version & 1) {
+      continue;
+    }
+    memcpy(snapshot, &slot->snapshot, sizeof(SDLEW_InputSnapshot));
+    sdlew_read_barrier();
+    if (sdlew_atomic_load(&slot->version) == version) {
+      return;
+    }
+  }
+}
+
+int sdlewInputKeyDown(const SDLEW_InputSnapshot *snapshot, SDLKey key) {
+  if ((int)key < 0 || key >= SDLK_LAST) {
+    return 0;
+  }
+  return (snapshot->keys[key >> 5] >> (key & 31)) & 1;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Private helpers shared between the sdlew extension sources.
+ * Not installed, not part of the public API.
+ */
+
+#ifndef __SDL_EW_INTERN_H__
+#define __SDL_EW_INTERN_H__
+
+#include "SDL/SDL.h"
+
+#include <stddef.h>
+
+#ifdef _MSC_VER
+#  define SDLEW_INLINE static __inline
+#else
+#  define SDLEW_INLINE static __inline__
+#endif
+
+/* SIMD availability, decided at compile time. SSE2 is part of the x86-64
+ * baseline so 64bit builds always get the vector paths.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SDLEW_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+
+/* Cache line size used to keep concurrently written fields apart. */
+#define SDLEW_CACHELINE 64
+
+/* Atomic primitives. */
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#  define sdlew_atomic_load(ptr) \
+        (_ReadWriteBarrier(), *(volatile long *)(ptr))
+#  define sdlew_atomic_store(ptr, value) \
+        (_InterlockedExchange((volatile long *)(ptr), (long)(value)))
+#  define sdlew_atomic_add(ptr, value) \
+        (_InterlockedExchangeAdd((volatile long *)(ptr), (long)(value)))
+#  define sdlew_atomic_cas(ptr, expected, desired) \
+        (_InterlockedCompareExchange((volatile long *)(ptr), \
+                                     (long)(desired), \
+                                     (long)(expected)) == (long)(expected))
+#  define sdlew_pause() _mm_pause()
+/* Loads and stores are not reordered with their own kind on x86. */
+#  define sdlew_read_barrier() _ReadWriteBarrier()
+#  define sdlew_write_barrier() _ReadWriteBarrier()
+#else
+#  define sdlew_atomic_load(ptr) \
+        __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#  define sdlew_atomic_store(ptr, value) \
+        __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#  define sdlew_atomic_add(ptr, value) \
+        __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+#  define sdlew_atomic_cas(ptr, expected, desired) \
+        __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#  define sdlew_read_barrier() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#  define sdlew_write_barrier() __atomic_thread_fence(__ATOMIC_RELEASE)
+#  if defined(__i386__) || defined(__x86_64__)
+#    define sdlew_pause() __builtin_ia32_pause()
+#  else
+#    define sdlew_pause() ((void)0)
+#  endif
+#endif
+
+/* Minimal spin lock, only meant for very short critical sections such
+ * as cache lookups.
+ */
+typedef volatile int SDLEW_SpinLock;
+
+SDLEW_INLINE void sdlew_spin_lock(SDLEW_SpinLock *lock) {
+  while (!sdlew_atomic_cas(lock, 0, 1)) {
+    while (sdlew_atomic_load(lock)) {
+      sdlew_pause();
+    }
+  }
+}
+
+SDLEW_INLINE void sdlew_spin_unlock(SDLEW_SpinLock *lock) {
+  sdlew_atomic_store(lock, 0);
+}
+
+/* Memory. */
+
+void *sdlew_aligned_malloc(size_t size, size_t alignment);
+void sdlew_aligned_free(void *ptr);
+
+/* Threading. */
+
+typedef void (*sdlew_range_func)(void *userdata, int begin, int end);
+
+/* Number of threads used for parallel ranges, including the caller. */
+int sdlew_num_threads(void);
+
+/* Run func over [begin, end) split into chunks of at least grain items.
+ * Chunks are processed by a lazily created pool of SDL threads together
+ * with the calling thread, and the call returns once all of them are done.
+ * Nested or concurrent calls fall back to running on the calling thread.
+ */
+void sdlew_parallel_range(int begin, int end, int grain,
+                          sdlew_range_func func, void *userdata);
+
+/* Time. */
+
+/* Monotonic clock in microseconds, wrapping around every 71 minutes, so
+ * only differences of close enough values are meaningful.
+ */
+Uint32 sdlew_time_us(void);
+
+/* Events. */
+
+struct SDLEW_EventReplay;
+
+/* Take up to n replayed events for a drain. */
+int sdlew_replay_take(struct SDLEW_EventReplay *replay, SDL_Event *events,
+                      int n);
+
+/* Pixel access. */
+
+SDLEW_INLINE Uint32 sdlew_pixel_get(const Uint8 *p, int bpp) {
+  switch (bpp) {
+    case 1:
+      return *p;
+    case 2:
+      return *(const Uint16 *)p;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+      return p[0] | (p[1] << 8) | (p[2] << 16);
+#else
+      return (p[0] << 16) | (p[1] << 8) | p[2];
+#endif
+    default:
+      return *(const Uint32 *)p;
+  }
+}
+
+SDLEW_INLINE void sdlew_pixel_put(Uint8 *p, int bpp, Uint32 pixel) {
+  switch (bpp) {
+    case 1:
+      *p = (Uint8)pixel;
+      break;
+    case 2:
+      *(Uint16 *)p = (Uint16)pixel;
+      break;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+      p[0] = (Uint8)pixel;
+      p[1] = (Uint8)(pixel >> 8);
+      p[2] = (Uint8)(pixel >> 16);
+#else
+      p[0] = (Uint8)(pixel >> 16);
+      p[1] = (Uint8)(pixel >> 8);
+      p[2] = (Uint8)pixel;
+#endif
+      break;
+    default:
+      *(Uint32 *)p = pixel;
+      break;
+  }
+}
+
+/* Widen a channel with loss bits back to 8 bits, replicating the high
+ * bits so that full intensity stays full intensity.
+ */
+SDLEW_INLINE Uint8 sdlew_expand_channel(Uint32 value, int loss) {
+  value <<= loss;
+  if (loss > 0) {
+    value |= value >> (8 - loss);
+  }
+  return (Uint8)value;
+}
+
+/* Decode a row of pixels in an arbitrary format into bytes ordered
+ * R, G, B, A. Formats without alpha decode as opaque.
+ */
+void sdlew_row_to_rgba(const SDL_PixelFormat *format,
+                       const Uint8 *src, Uint8 *dst, int width);
+
+/* Encode a row of R, G, B, A bytes into an arbitrary format. */
+void sdlew_row_from_rgba(const SDL_PixelFormat *format,
+                         const Uint8 *src, Uint8 *dst, int width);
+
+/* Blitting. */
+
+/* Clip a blit of a src_w by src_h source against srcrect and the
+ * destination clip rectangle exactly like SDL_BlitSurface(), updating
+ * dstrect. Returns 0 when nothing is left to blit, otherwise 1 with the
+ * source origin in srcx and srcy and the size in dstrect.
+ */
+int sdlew_clip_blit(int src_w, int src_h, const SDL_Rect *srcrect,
+                    const SDL_Rect *clip, SDL_Rect *dstrect,
+                    int *srcx, int *srcy);
+
+/* Audio samples. */
+
+typedef struct SDLEW_SampleFormat {
+  int bytes;
+  int big_endian;
+  Uint16 bias;
+  int min, max;
+} SDLEW_SampleFormat;
+
+/* Describe an AUDIO_* format, returns 0 for unknown ones. */
+int sdlew_sample_format(Uint16 format, SDLEW_SampleFormat *sf);
+
+/* Signed 16 bit in host order, which can be used without conversion. */
+SDLEW_INLINE int sdlew_sample_native(const SDLEW_SampleFormat *sf) {
+  return sf->bytes == 2 && sf->bias == 0 &&
+         sf->big_endian == (SDL_BYTEORDER == SDL_BIG_ENDIAN);
+}
+
+/* Widen n samples to signed 16 bit, 8 bit formats keeping their range. */
+void sdlew_samples_to_s16(const SDLEW_SampleFormat *sf, const Uint8 *src,
+                          Sint16 *dst, int n);
+
+/* Store n values arithmetically shifted right by shift and saturated to
+ * the range of the format.
+ */
+void sdlew_samples_from_s32(const SDLEW_SampleFormat *sf, const Sint32 *src,
+                            int shift, Uint8 *dst, int n);
+
+#endif  /* __SDL_EW_INTERN_H__ */
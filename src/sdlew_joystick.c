@@ -0,0 +1,184 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Joystick snapshots.
+ *
+ * SDL 1.2 has no call handing out the state of a joystick at once, so
+ * every control still costs a call. What is saved is the update, done
+ * once for all joysticks, and the control counts, which are only queried
+ * again when the joystick in a slot changes. The axes of all slots are
+ * laid out back to back and go through the deadzone in a single pass.
+ */
+
+#include "sdlew_events.h"
+#include "sdlew_intern.h"
+
+#include <string.h>
+
+#define NUM_AXES (SDLEW_JOYSTICK_MAX * SDLEW_JOYSTICK_MAX_AXES)
+
+static int clamp_int(int value, int max) {
+  return value < 0 ? 0 : (value > max ? max : value);
+}
+
+/* Kernels. */
+
+#ifdef SDLEW_HAVE_SSE2
+SDLEW_INLINE __m128 deadzone4(__m128 f, __m128 deadzone, __m128 scale) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 v = _mm_sub_ps(_mm_andnot_ps(sign, f), deadzone);
+
+  v = _mm_mul_ps(_mm_max_ps(v, _mm_setzero_ps()), scale);
+  v = _mm_min_ps(v, _mm_set1_ps(1.0f));
+  return _mm_or_ps(v, _mm_and_ps(f, sign));
+}
+#endif
+
+/* Remove the deadzone from n axes and scale them to [-1, 1]. The vector
+ * path does the same operations in the same order so the results do not
+ * depend on it.
+ */
+static void normalise_axes(float *dst, const Sint16 *src, int n,
+                           int deadzone) {
+  const float dz = (float)deadzone;
+  const float scale = 1.0f / (32767.0f - dz);
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  {
+    const __m128 vdz = _mm_set1_ps(dz);
+    const __m128 vscale = _mm_set1_ps(scale);
+
+    for (; i + 8 <= n; i += 8) {
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128 f0 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 f1 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+
+      _mm_storeu_ps(dst + i, deadzone4(f0, vdz, vscale));
+      _mm_storeu_ps(dst + i + 4, deadzone4(f1, vdz, vscale));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    const float f = (float)src[i];
+    float v = (f < 0.0f ? -f : f) - dz;
+
+    v = (v > 0.0f ? v : 0.0f) * scale;
+    v = v < 1.0f ? v : 1.0f;
+    dst[i] = f < 0.0f ? -v : v;
+  }
+}
+
+/* Snapshots. */
+
+void sdlewJoystickSnapshotInit(SDLEW_JoystickSnapshot *snapshot,
+                               int deadzone) {
+  memset(snapshot, 0, sizeof(SDLEW_JoystickSnapshot));
+  snapshot->deadzone = clamp_int(deadzone, 32766);
+}
+
+static void clear_slot(SDLEW_JoystickSnapshot *snapshot, int slot) {
+  snapshot->joystick[slot] = NULL;
+  snapshot->index[slot] = -1;
+  snapshot->num_axes[slot] = 0;
+  snapshot->num_hats[slot] = 0;
+  snapshot->num_balls[slot] = 0;
+  snapshot->num_buttons[slot] = 0;
+  memset(snapshot->axes[slot], 0, sizeof(snapshot->axes[slot]));
+  memset(snapshot->hats[slot], 0, sizeof(snapshot->hats[slot]));
+  memset(snapshot->ball_dx[slot], 0, sizeof(snapshot->ball_dx[slot]));
+  memset(snapshot->ball_dy[slot], 0, sizeof(snapshot->ball_dy[slot]));
+  snapshot->buttons[slot] = 0;
+}
+
+static void read_joystick(SDLEW_JoystickSnapshot *snapshot, int slot) {
+  SDL_Joystick *joystick = snapshot->joystick[slot];
+  Uint32 buttons = 0;
+  int i;
+
+  for (i = 0; i < snapshot->num_axes[slot]; i++) {
+    snapshot->axes[slot][i] = SDL_JoystickGetAxis(joystick, i);
+  }
+  for (i = 0; i < snapshot->num_hats[slot]; i++) {
+    snapshot->hats[slot][i] = SDL_JoystickGetHat(joystick, i);
+  }
+  for (i = 0; i < snapshot->num_balls[slot]; i++) {
+    if (SDL_JoystickGetBall(joystick, i, &snapshot->ball_dx[slot][i],
+                            &snapshot->ball_dy[slot][i]) != 0)
+    {
+      snapshot->ball_dx[slot][i] = 0;
+      snapshot->ball_dy[slot][i] = 0;
+    }
+  }
+  for (i = 0; i < snapshot->num_buttons[slot]; i++) {
+    if (SDL_JoystickGetButton(joystick, i)) {
+      buttons |= (Uint32)1 << i;
+    }
+  }
+  snapshot->buttons[slot] = buttons;
+}
+
+int sdlewJoystickSnapshotAll(SDLEW_JoystickSnapshot *snapshot) {
+  const int num_devices = SDL_NumJoysticks();
+  int i, n = 0;
+
+  SDL_JoystickUpdate();
+
+  for (i = 0; i < num_devices && n < SDLEW_JOYSTICK_MAX; i++) {
+    SDL_Joystick *joystick;
+
+    if (!SDL_JoystickOpened(i)) {
+      continue;
+    }
+    /* Opening an open joystick only takes a reference on it, which is
+     * how SDL 1.2 hands out the handle.
+     */
+    joystick = SDL_JoystickOpen(i);
+    if (joystick == NULL) {
+      continue;
+    }
+    SDL_JoystickClose(joystick);
+
+    if (joystick != snapshot->joystick[n] || i != snapshot->index[n]) {
+      clear_slot(snapshot, n);
+      snapshot->joystick[n] = joystick;
+      snapshot->index[n] = i;
+      snapshot->num_axes[n] = clamp_int(SDL_JoystickNumAxes(joystick),
+                                        SDLEW_JOYSTICK_MAX_AXES);
+      snapshot->num_hats[n] = clamp_int(SDL_JoystickNumHats(joystick),
+                                        SDLEW_JOYSTICK_MAX_HATS);
+      snapshot->num_balls[n] = clamp_int(SDL_JoystickNumBalls(joystick),
+                                         SDLEW_JOYSTICK_MAX_BALLS);
+      snapshot->num_buttons[n] = clamp_int(SDL_JoystickNumButtons(joystick),
+                                           SDLEW_JOYSTICK_MAX_BUTTONS);
+    }
+    read_joystick(snapshot, n);
+    n++;
+  }
+
+  for (i = n; i < SDLEW_JOYSTICK_MAX; i++) {
+    if (snapshot->joystick[i] != NULL) {
+      clear_slot(snapshot, i);
+    }
+  }
+  snapshot->num_joysticks = n;
+
+  normalise_axes(&snapshot->values[0][0], &snapshot->axes[0][0], NUM_AXES,
+                 snapshot->deadzone);
+  return n;
+}
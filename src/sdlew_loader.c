@@ -0,0 +1,638 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Asynchronous surface loading.
+ *
+ * Requests flow through three stages: a single I/O thread reads files
+ * into memory ahead of the decoders, a set of worker threads decodes and
+ * converts them, and the application drains finished surfaces from the
+ * completion queue. Both waiting stages are ordered by priority, and every
+ * request is on exactly one list at a time, all guarded by one mutex.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_WORKERS 64
+
+/* Bytes read but not decoded yet before the I/O thread stalls. */
+#define READ_AHEAD_BYTES (32 * 1024 * 1024)
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+typedef struct LoadRequest {
+  int id;
+  int priority;
+  int cancelled;
+  void *userdata;
+
+  /* Source, the RWops is only set until it has been read. */
+  char *path;
+  SDL_RWops *rw;
+  int freesrc;
+
+  void *data;
+  size_t size;
+
+  SDL_Surface *surface;
+  char error[128];
+
+  struct RequestList *list;
+  struct LoadRequest *next, *prev;
+} LoadRequest;
+
+typedef struct RequestList {
+  LoadRequest *first, *last;
+} RequestList;
+
+struct SDLEW_Loader {
+  SDL_mutex *mutex;
+  SDL_cond *io_cond;
+  SDL_cond *decode_cond;
+  SDL_cond *read_cond;
+  int quit;
+
+  SDL_Thread *io_thread;
+  SDL_Thread *workers[MAX_WORKERS];
+  int num_workers;
+
+  SDL_PixelFormat format;
+  int convert;
+  SDLEW_LoaderDecodeFunc decode;
+  void *decode_userdata;
+
+  RequestList io_queue;
+  RequestList decode_queue;
+  RequestList in_flight;
+  RequestList done;
+
+  int next_id;
+  /* Request the I/O thread is reading, 0 for none. */
+  int reading_id;
+  int pending;
+  size_t buffered_bytes;
+};
+
+/* Request lists. */
+
+static void list_remove(LoadRequest *req) {
+  RequestList *list = req->list;
+
+  if (req->prev != NULL) {
+    req->prev->next = req->next;
+  }
+  else {
+    list->first = req->next;
+  }
+  if (req->next != NULL) {
+    req->next->prev = req->prev;
+  }
+  else {
+    list->last = req->prev;
+  }
+  req->next = req->prev = NULL;
+  req->list = NULL;
+}
+
+static void list_insert_after(RequestList *list, LoadRequest *after,
+                              LoadRequest *req) {
+  req->list = list;
+  req->prev = after;
+  req->next = after != NULL ? after->next : list->first;
+  if (req->next != NULL) {
+    req->next->prev = req;
+  }
+  else {
+    list->last = req;
+  }
+  if (after != NULL) {
+    after->next = req;
+  }
+  else {
+    list->first = req;
+  }
+}
+
+static void list_append(RequestList *list, LoadRequest *req) {
+  list_insert_after(list, list->last, req);
+}
+
+/* Keep the list sorted by descending priority, FIFO among equals. */
+static void list_insert_priority(RequestList *list, LoadRequest *req) {
+  LoadRequest *after = list->last;
+
+  while (after != NULL && after->priority < req->priority) {
+    after = after->prev;
+  }
+  list_insert_after(list, after, req);
+}
+
+static LoadRequest *list_find(const RequestList *list, int id) {
+  LoadRequest *req;
+
+  for (req = list->first; req != NULL; req = req->next) {
+    if (req->id == id) {
+      return req;
+    }
+  }
+  return NULL;
+}
+
+static LoadRequest *loader_find(SDLEW_Loader *loader, int id) {
+  LoadRequest *req;
+
+  if ((req = list_find(&loader->io_queue, id)) != NULL ||
+      (req = list_find(&loader->decode_queue, id)) != NULL ||
+      (req = list_find(&loader->in_flight, id)) != NULL ||
+      (req = list_find(&loader->done, id)) != NULL)
+  {
+    return req;
+  }
+  return NULL;
+}
+
+static void request_free(LoadRequest *req) {
+  if (req->rw != NULL && req->freesrc) {
+    SDL_RWclose(req->rw);
+  }
+  if (req->surface != NULL) {
+    SDL_FreeSurface(req->surface);
+  }
+  free(req->path);
+  free(req->data);
+  free(req);
+}
+
+static void request_set_error(LoadRequest *req, const char *error) {
+  strncpy(req->error, error != NULL ? error : "unknown error",
+          sizeof(req->error) - 1);
+  req->error[sizeof(req->error) - 1] = '\0';
+}
+
+/* I/O stage. */
+
+static int read_all(SDL_RWops *rw, void **r_data, size_t *r_size) {
+  Uint8 *data = NULL;
+  size_t size = 0, capacity = 0;
+  int num_read;
+
+  for (;;) {
+    if (capacity - size < READ_CHUNK_SIZE) {
+      Uint8 *grown;
+      capacity = capacity ? capacity * 2 : READ_CHUNK_SIZE * 2;
+      grown = (Uint8 *)realloc(data, capacity);
+      if (grown == NULL) {
+        free(data);
+        SDL_OutOfMemory();
+        return 0;
+      }
+      data = grown;
+    }
+    num_read = SDL_RWread(rw, data + size, 1, (int)(capacity - size));
+    if (num_read < 0) {
+      free(data);
+      return 0;
+    }
+    if (num_read == 0) {
+      break;
+    }
+    size += num_read;
+  }
+
+  if (size == 0) {
+    free(data);
+    SDL_SetError("sdlewLoader: empty file");
+    return 0;
+  }
+  *r_data = data;
+  *r_size = size;
+  return 1;
+}
+
+static int SDLCALL io_thread(void *userdata) {
+  SDLEW_Loader *loader = (SDLEW_Loader *)userdata;
+  LoadRequest *req;
+  int ok;
+
+  SDL_mutexP(loader->mutex);
+  for (;;) {
+    while (!loader->quit &&
+           (loader->io_queue.first == NULL ||
+            loader->buffered_bytes >= READ_AHEAD_BYTES))
+    {
+      SDL_CondWait(loader->io_cond, loader->mutex);
+    }
+    if (loader->quit) {
+      break;
+    }
+
+    req = loader->io_queue.first;
+    list_remove(req);
+    list_append(&loader->in_flight, req);
+    loader->reading_id = req->id;
+    SDL_mutexV(loader->mutex);
+
+    if (req->path != NULL) {
+      req->rw = SDL_RWFromFile(req->path, "rb");
+      req->freesrc = 1;
+    }
+    ok = req->rw != NULL && read_all(req->rw, &req->data, &req->size);
+    if (!ok) {
+      request_set_error(req, SDL_GetError());
+    }
+    if (req->rw != NULL && req->freesrc) {
+      SDL_RWclose(req->rw);
+    }
+    req->rw = NULL;
+
+    SDL_mutexP(loader->mutex);
+    loader->reading_id = 0;
+    SDL_CondBroadcast(loader->read_cond);
+    list_remove(req);
+    if (req->cancelled) {
+      request_free(req);
+    }
+    else if (!ok) {
+      list_append(&loader->done, req);
+    }
+    else {
+      loader->buffered_bytes += req->size;
+      list_insert_priority(&loader->decode_queue, req);
+      SDL_CondSignal(loader->decode_cond);
+    }
+  }
+  SDL_mutexV(loader->mutex);
+
+  return 0;
+}
+
+/* Decode stage. */
+
+static SDL_Surface *decode_bmp(const void *data, size_t size, void *unused) {
+  SDL_RWops *rw = SDL_RWFromConstMem(data, (int)size);
+
+  (void)unused;
+
+  if (rw == NULL) {
+    return NULL;
+  }
+  return SDL_LoadBMP_RW(rw, 1);
+}
+
+static SDL_Surface *decode_request(SDLEW_Loader *loader, LoadRequest *req,
+                                   SDLEW_LoaderDecodeFunc decode,
+                                   void *decode_userdata) {
+  SDL_Surface *surface, *converted;
+
+  surface = decode(req->data, req->size, decode_userdata);
+  if (surface == NULL || !loader->convert) {
+    return surface;
+  }
+
+  converted = SDL_ConvertSurface(surface, &loader->format, SDL_SWSURFACE);
+  SDL_FreeSurface(surface);
+  return converted;
+}
+
+static int SDLCALL decode_worker(void *userdata) {
+  SDLEW_Loader *loader = (SDLEW_Loader *)userdata;
+  SDLEW_LoaderDecodeFunc decode;
+  void *decode_userdata;
+  LoadRequest *req;
+
+  SDL_mutexP(loader->mutex);
+  for (;;) {
+    while (!loader->quit && loader->decode_queue.first == NULL) {
+      SDL_CondWait(loader->decode_cond, loader->mutex);
+    }
+    if (loader->quit) {
+      break;
+    }
+
+    req = loader->decode_queue.first;
+    list_remove(req);
+    list_append(&loader->in_flight, req);
+    decode = loader->decode;
+    decode_userdata = loader->decode_userdata;
+    SDL_mutexV(loader->mutex);
+
+    /* Requests cancelled while waiting to be picked up are skipped. */
+    if (!sdlew_atomic_load(&req->cancelled)) {
+      req->surface = decode_request(loader, req, decode,
+                                    decode_userdata);
+      if (req->surface == NULL) {
+        request_set_error(req, SDL_GetError());
+      }
+    }
+    free(req->data);
+    req->data = NULL;
+
+    SDL_mutexP(loader->mutex);
+    list_remove(req);
+    loader->buffered_bytes -= req->size;
+    SDL_CondSignal(loader->io_cond);
+    if (req->cancelled) {
+      request_free(req);
+    }
+    else {
+      list_append(&loader->done, req);
+    }
+  }
+  SDL_mutexV(loader->mutex);
+
+  return 0;
+}
+
+/* Loader. */
+
+SDLEW_Loader *sdlewLoaderCreate(const SDL_PixelFormat *format,
+                                int num_workers) {
+  SDLEW_Loader *loader;
+  int i;
+
+  if (SDL_CreateThread == NULL) {
+    SDL_SetError("sdlewLoaderCreate: threads are not available");
+    return NULL;
+  }
+
+  loader = (SDLEW_Loader *)calloc(1, sizeof(SDLEW_Loader));
+  if (loader == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  if (format != NULL) {
+    loader->format = *format;
+    loader->convert = 1;
+  }
+  loader->decode = decode_bmp;
+  loader->next_id = 1;
+
+  loader->mutex = SDL_CreateMutex();
+  loader->io_cond = SDL_CreateCond();
+  loader->decode_cond = SDL_CreateCond();
+  loader->read_cond = SDL_CreateCond();
+  if (loader->mutex == NULL || loader->io_cond == NULL ||
+      loader->decode_cond == NULL || loader->read_cond == NULL)
+  {
+    sdlewLoaderDestroy(loader);
+    return NULL;
+  }
+
+  if (num_workers <= 0) {
+    num_workers = sdlew_num_threads();
+  }
+  if (num_workers > MAX_WORKERS) {
+    num_workers = MAX_WORKERS;
+  }
+
+  loader->io_thread = SDL_CreateThread(io_thread, loader);
+  for (i = 0; i < num_workers; i++) {
+    loader->workers[i] = SDL_CreateThread(decode_worker, loader);
+    if (loader->workers[i] == NULL) {
+      break;
+    }
+    loader->num_workers++;
+  }
+  if (loader->io_thread == NULL || loader->num_workers == 0) {
+    sdlewLoaderDestroy(loader);
+    return NULL;
+  }
+
+  return loader;
+}
+
+void sdlewLoaderDestroy(SDLEW_Loader *loader) {
+  RequestList *lists[3];
+  LoadRequest *req, *next;
+  int i;
+
+  if (loader == NULL) {
+    return;
+  }
+
+  if (loader->mutex != NULL) {
+    SDL_mutexP(loader->mutex);
+    loader->quit = 1;
+    if (loader->io_cond != NULL) {
+      SDL_CondBroadcast(loader->io_cond);
+    }
+    if (loader->decode_cond != NULL) {
+      SDL_CondBroadcast(loader->decode_cond);
+    }
+    SDL_mutexV(loader->mutex);
+  }
+
+  if (loader->io_thread != NULL) {
+    SDL_WaitThread(loader->io_thread, NULL);
+  }
+  for (i = 0; i < loader->num_workers; i++) {
+    SDL_WaitThread(loader->workers[i], NULL);
+  }
+
+  /* With the threads gone nothing is in flight anymore. */
+  lists[0] = &loader->io_queue;
+  lists[1] = &loader->decode_queue;
+  lists[2] = &loader->done;
+  for (i = 0; i < 3; i++) {
+    for (req = lists[i]->first; req != NULL; req = next) {
+      next = req->next;
+      request_free(req);
+    }
+  }
+
+  if (loader->read_cond != NULL) {
+    SDL_DestroyCond(loader->read_cond);
+  }
+  if (loader->decode_cond != NULL) {
+    SDL_DestroyCond(loader->decode_cond);
+  }
+  if (loader->io_cond != NULL) {
+    SDL_DestroyCond(loader->io_cond);
+  }
+  if (loader->mutex != NULL) {
+    SDL_DestroyMutex(loader->mutex);
+  }
+  free(loader);
+}
+
+void sdlewLoaderSetDecoder(SDLEW_Loader *loader, SDLEW_LoaderDecodeFunc decode,
+                           void *userdata) {
+  SDL_mutexP(loader->mutex);
+  loader->decode = decode != NULL ? decode : decode_bmp;
+  loader->decode_userdata = userdata;
+  SDL_mutexV(loader->mutex);
+}
+
+static int loader_submit(SDLEW_Loader *loader, LoadRequest *req,
+                         int priority, void *userdata) {
+  int id;
+
+  req->priority = priority;
+  req->userdata = userdata;
+
+  SDL_mutexP(loader->mutex);
+  id = req->id = loader->next_id++;
+  loader->pending++;
+  list_insert_priority(&loader->io_queue, req);
+  SDL_CondSignal(loader->io_cond);
+  SDL_mutexV(loader->mutex);
+
+  return id;
+}
+
+int sdlewLoaderRequest(SDLEW_Loader *loader, const char *path, int priority,
+                       void *userdata) {
+  LoadRequest *req;
+
+  req = (LoadRequest *)calloc(1, sizeof(LoadRequest));
+  if (req == NULL) {
+    SDL_OutOfMemory();
+    return -1;
+  }
+  req->path = (char *)malloc(strlen(path) + 1);
+  if (req->path == NULL) {
+    free(req);
+    SDL_OutOfMemory();
+    return -1;
+  }
+  strcpy(req->path, path);
+
+  return loader_submit(loader, req, priority, userdata);
+}
+
+int sdlewLoaderRequestRW(SDLEW_Loader *loader, SDL_RWops *rw, int freesrc,
+                         int priority, void *userdata) {
+  LoadRequest *req;
+
+  if (rw == NULL) {
+    SDL_SetError("sdlewLoaderRequestRW: invalid RWops");
+    return -1;
+  }
+
+  req = (LoadRequest *)calloc(1, sizeof(LoadRequest));
+  if (req == NULL) {
+    if (freesrc) {
+      SDL_RWclose(rw);
+    }
+    SDL_OutOfMemory();
+    return -1;
+  }
+  req->rw = rw;
+  req->freesrc = freesrc;
+
+  return loader_submit(loader, req, priority, userdata);
+}
+
+int sdlewLoaderSetPriority(SDLEW_Loader *loader, int id, int priority) {
+  LoadRequest *req;
+
+  SDL_mutexP(loader->mutex);
+  req = loader_find(loader, id);
+  if (req == NULL) {
+    SDL_mutexV(loader->mutex);
+    SDL_SetError("sdlewLoaderSetPriority: unknown request %d", id);
+    return -1;
+  }
+  req->priority = priority;
+  if (req->list == &loader->io_queue || req->list == &loader->decode_queue) {
+    RequestList *list = req->list;
+    list_remove(req);
+    list_insert_priority(list, req);
+  }
+  SDL_mutexV(loader->mutex);
+
+  return 0;
+}
+
+int sdlewLoaderCancel(SDLEW_Loader *loader, int id) {
+  LoadRequest *req;
+
+  SDL_mutexP(loader->mutex);
+  req = loader_find(loader, id);
+  if (req == NULL || req->cancelled) {
+    SDL_mutexV(loader->mutex);
+    SDL_SetError("sdlewLoaderCancel: unknown request %d", id);
+    return -1;
+  }
+
+  if (req->list == &loader->in_flight) {
+    /* The stage working on it drops the request once done. Reads are
+     * waited for, so the caller owns a RWops again once this returns.
+     */
+    sdlew_atomic_store(&req->cancelled, 1);
+    while (loader->reading_id == id) {
+      SDL_CondWait(loader->read_cond, loader->mutex);
+    }
+  }
+  else {
+    if (req->list == &loader->decode_queue) {
+      loader->buffered_bytes -= req->size;
+      SDL_CondSignal(loader->io_cond);
+    }
+    list_remove(req);
+    request_free(req);
+  }
+  loader->pending--;
+  SDL_mutexV(loader->mutex);
+
+  return 0;
+}
+
+int sdlewLoaderDrain(SDLEW_Loader *loader, Uint32 budget_ms,
+                     SDLEW_LoaderCallback callback) {
+  const Uint32 start = SDL_GetTicks();
+  LoadRequest *req;
+  int num_delivered = 0;
+
+  for (;;) {
+    SDL_mutexP(loader->mutex);
+    req = loader->done.first;
+    if (req != NULL) {
+      list_remove(req);
+      loader->pending--;
+    }
+    SDL_mutexV(loader->mutex);
+
+    if (req == NULL) {
+      break;
+    }
+
+    callback(req->id, req->surface,
+             req->surface != NULL ? NULL : req->error, req->userdata);
+    req->surface = NULL;
+    request_free(req);
+    num_delivered++;
+
+    if (budget_ms != 0 && SDL_GetTicks() - start >= budget_ms) {
+      break;
+    }
+  }
+
+  return num_delivered;
+}
+
+int sdlewLoaderPending(SDLEW_Loader *loader) {
+  int pending;
+
+  SDL_mutexP(loader->mutex);
+  pending = loader->pending;
+  SDL_mutexV(loader->mutex);
+
+  return pending;
+}
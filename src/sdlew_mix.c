@@ -0,0 +1,140 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Multi-source audio mixing.
+ *
+ * Samples are mixed in chunks which fit into L1: the destination chunk is
+ * widened into a 32 bit accumulator holding sample * volume, every source
+ * adds its share, and the result is scaled back and saturated once. This
+ * way each buffer is touched exactly once however many sources there are.
+ * All formats are widened to signed 16 bit first, native signed 16 bit
+ * sources are read in place.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+/* Samples mixed at once. */
+#define CHUNK 256
+
+/* Sources summed before the accumulator is clamped, keeping it far from
+ * overflowing: 128 * 32768 * SDL_MIX_MAXVOLUME is 2^29.
+ */
+#define SOURCE_GROUP 128
+#define ACC_LIMIT (1 << 30)
+
+/* log2(SDL_MIX_MAXVOLUME) */
+#define VOLUME_SHIFT 7
+
+static void accumulate(Sint32 *acc, const Sint16 *src, int volume, int n) {
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  {
+    const __m128i vol = _mm_set1_epi16((short)volume);
+
+    for (; i + 8 <= n; i += 8) {
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128i lo = _mm_mullo_epi16(s, vol);
+      const __m128i hi = _mm_mulhi_epi16(s, vol);
+      __m128i a0 = _mm_loadu_si128((const __m128i *)(acc + i));
+      __m128i a1 = _mm_loadu_si128((const __m128i *)(acc + i + 4));
+      a0 = _mm_add_epi32(a0, _mm_unpacklo_epi16(lo, hi));
+      a1 = _mm_add_epi32(a1, _mm_unpackhi_epi16(lo, hi));
+      _mm_storeu_si128((__m128i *)(acc + i), a0);
+      _mm_storeu_si128((__m128i *)(acc + i + 4), a1);
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    acc[i] += src[i] * volume;
+  }
+}
+
+static void clamp_accumulator(Sint32 *acc, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    acc[i] = acc[i] < -ACC_LIMIT ? -ACC_LIMIT :
+             acc[i] > ACC_LIMIT ? ACC_LIMIT : acc[i];
+  }
+}
+
+int sdlewMixAudioMulti(Uint8 *dst, const Uint8 *const *srcs,
+                       const int *volumes, int n, Uint32 len,
+                       Uint16 format) {
+  Sint32 acc[CHUNK];
+  Sint16 samples[CHUNK];
+  SDLEW_SampleFormat sf;
+  int native, num_samples, offset;
+
+  if (!sdlew_sample_format(format, &sf)) {
+    SDL_SetError("sdlewMixAudioMulti: unknown audio format");
+    return -1;
+  }
+  if (n <= 0 || len == 0) {
+    return 0;
+  }
+  if (dst == NULL || srcs == NULL) {
+    SDL_SetError("sdlewMixAudioMulti: passed a NULL pointer");
+    return -1;
+  }
+
+  native = sdlew_sample_native(&sf);
+  num_samples = (int)(len / sf.bytes);
+
+  for (offset = 0; offset < num_samples; offset += CHUNK) {
+    const int count = num_samples - offset < CHUNK ? num_samples - offset
+                                                   : CHUNK;
+    const size_t byte_offset = (size_t)offset * sf.bytes;
+    int i, summed = 0;
+
+    sdlew_samples_to_s16(&sf, dst + byte_offset, samples, count);
+    for (i = 0; i < count; i++) {
+      acc[i] = samples[i] * SDL_MIX_MAXVOLUME;
+    }
+
+    for (i = 0; i < n; i++) {
+      const Uint8 *src = srcs[i];
+      int volume = volumes != NULL ? volumes[i] : SDL_MIX_MAXVOLUME;
+
+      volume = volume > SDL_MIX_MAXVOLUME ? SDL_MIX_MAXVOLUME : volume;
+      if (src == NULL || volume <= 0) {
+        continue;
+      }
+      src += byte_offset;
+
+      if (native && ((size_t)src & 1) == 0) {
+        accumulate(acc, (const Sint16 *)src, volume, count);
+      }
+      else {
+        sdlew_samples_to_s16(&sf, src, samples, count);
+        accumulate(acc, samples, volume, count);
+      }
+
+      if (++summed == SOURCE_GROUP) {
+        clamp_accumulator(acc, count);
+        summed = 0;
+      }
+    }
+
+    sdlew_samples_from_s32(&sf, acc, VOLUME_SHIFT, dst + byte_offset,
+                           count);
+  }
+
+  return 0;
+}
@@ -0,0 +1,685 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Voice mixer.
+ *
+ * Voice state is kept in parallel arrays with the active voices packed at
+ * the front, so the render loop walks a few dense arrays instead of
+ * skipping over idle voice structs. Output is rendered in chunks which fit
+ * into L1: every voice adds its samples times its gains into a float
+ * accumulator, which is converted to the output format once at the end.
+ *
+ * Commands go through a bounded multi-producer, single consumer queue of
+ * slots carrying a sequence number. A producer claims a position with a
+ * compare and swap, fills the slot and publishes it by bumping the
+ * sequence, the audio thread consumes published slots in order and hands
+ * them back by bumping the sequence by a full lap.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sample frames rendered at once. */
+#define CHUNK 256
+
+/* Keeps the float to integer conversion in range. */
+#define ACC_LIMIT 1073741824.0f
+
+#define MAX_COMMANDS (1 << 20)
+
+#define QUARTER_PI 0.78539816339744830962
+
+enum {
+  COMMAND_PLAY = 0,
+  COMMAND_STOP = 1,
+  COMMAND_SET_GAIN = 2,
+};
+
+enum {
+  VOICE_LOOP = (1 << 0),
+  VOICE_STOP = (1 << 1),
+};
+
+typedef struct MixerCommand {
+  int type;
+  Uint32 voice;
+  Uint32 when;
+  const Sint16 *sound;
+  int frames;
+  int channels;
+  int loop;
+  float gain_l, gain_r;
+  int ramp;
+} MixerCommand;
+
+typedef struct CommandSlot {
+  Uint32 sequence;
+  MixerCommand command;
+} CommandSlot;
+
+struct SDLEW_Mixer {
+  /* Constant after creation. */
+  SDLEW_SampleFormat sf;
+  int channels;
+  int frame_size;
+  int shift;
+  Uint8 silence;
+  int max_voices;
+  CommandSlot *commands;
+  Uint32 command_mask;
+  char pad0[SDLEW_CACHELINE];
+
+  /* Written by any thread. */
+  Uint32 enqueue_pos;
+  Uint32 next_handle;
+  Uint32 dropped_commands;
+  char pad1[SDLEW_CACHELINE];
+
+  /* Written by the audio thread. */
+  Uint32 dequeue_pos;
+  Uint32 time;
+  int num_voices;
+  Uint32 dropped_voices;
+  int active_voices;
+
+  /* Voices, the first num_voices ones are active. */
+  const Sint16 **sound;
+  Uint32 *handle;
+  Uint32 *frames;
+  Uint32 *pos;
+  Uint32 *start;
+  Uint32 *stop;
+  int *ramp;
+  float *gain_l, *gain_r;
+  float *step_l, *step_r;
+  float *target_l, *target_r;
+  Uint8 *sound_channels;
+  Uint8 *flags;
+};
+
+/* Kernels. */
+
+/* Add n frames of src times gains to acc, the gain of frame i being
+ * gain + i * step. The vector paths compute gains the same way so the
+ * results do not depend on them.
+ */
+static void mix_span(float *acc, const Sint16 *src, int n,
+                     int src_channels, int dst_channels,
+                     const float *gain, const float *step) {
+  int i = 0;
+
+  if (src_channels == 1 && dst_channels == 2) {
+#ifdef SDLEW_HAVE_SSE2
+    const __m128 g = _mm_setr_ps(gain[0], gain[1], gain[0], gain[1]);
+    const __m128 d = _mm_setr_ps(step[0], step[1], step[0], step[1]);
+    const __m128 four = _mm_set1_ps(4.0f);
+    __m128 i0 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    __m128 i1 = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m128i s = _mm_loadl_epi64((const __m128i *)(src + i));
+      const __m128 f = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 g0 = _mm_add_ps(g, _mm_mul_ps(i0, d));
+      const __m128 g1 = _mm_add_ps(g, _mm_mul_ps(i1, d));
+      float *a = acc + i * 2;
+
+      _mm_storeu_ps(a, _mm_add_ps(_mm_loadu_ps(a),
+                                  _mm_mul_ps(_mm_unpacklo_ps(f, f), g0)));
+      _mm_storeu_ps(a + 4,
+                    _mm_add_ps(_mm_loadu_ps(a + 4),
+                               _mm_mul_ps(_mm_unpackhi_ps(f, f), g1)));
+      i0 = _mm_add_ps(i0, four);
+      i1 = _mm_add_ps(i1, four);
+    }
+#endif
+    for (; i < n; i++) {
+      const float s = (float)src[i];
+
+      acc[i * 2] += s * (gain[0] + (float)i * step[0]);
+      acc[i * 2 + 1] += s * (gain[1] + (float)i * step[1]);
+    }
+  }
+  else if (src_channels == 2 && dst_channels == 2) {
+#ifdef SDLEW_HAVE_SSE2
+    const __m128 g = _mm_setr_ps(gain[0], gain[1], gain[0], gain[1]);
+    const __m128 d = _mm_setr_ps(step[0], step[1], step[0], step[1]);
+    const __m128 four = _mm_set1_ps(4.0f);
+    __m128 i0 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    __m128 i1 = _mm_setr_ps(2.0f, 2.0f, 3.0f, 3.0f);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      const __m128 f0 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 f1 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+      const __m128 g0 = _mm_add_ps(g, _mm_mul_ps(i0, d));
+      const __m128 g1 = _mm_add_ps(g, _mm_mul_ps(i1, d));
+      float *a = acc + i * 2;
+
+      _mm_storeu_ps(a, _mm_add_ps(_mm_loadu_ps(a), _mm_mul_ps(f0, g0)));
+      _mm_storeu_ps(a + 4,
+                    _mm_add_ps(_mm_loadu_ps(a + 4), _mm_mul_ps(f1, g1)));
+      i0 = _mm_add_ps(i0, four);
+      i1 = _mm_add_ps(i1, four);
+    }
+#endif
+    for (; i < n; i++) {
+      acc[i * 2] += (float)src[i * 2] * (gain[0] + (float)i * step[0]);
+      acc[i * 2 + 1] += (float)src[i * 2 + 1] *
+                        (gain[1] + (float)i * step[1]);
+    }
+  }
+  else if (src_channels == 1) {
+#ifdef SDLEW_HAVE_SSE2
+    const __m128 g = _mm_set1_ps(gain[0]);
+    const __m128 d = _mm_set1_ps(step[0]);
+    const __m128 four = _mm_set1_ps(4.0f);
+    __m128 i0 = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m128i s = _mm_loadl_epi64((const __m128i *)(src + i));
+      const __m128 f = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 g0 = _mm_add_ps(g, _mm_mul_ps(i0, d));
+
+      _mm_storeu_ps(acc + i,
+                    _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(f, g0)));
+      i0 = _mm_add_ps(i0, four);
+    }
+#endif
+    for (; i < n; i++) {
+      acc[i] += (float)src[i] * (gain[0] + (float)i * step[0]);
+    }
+  }
+  else {
+#ifdef SDLEW_HAVE_SSE2
+    const __m128 g = _mm_set1_ps(gain[0]);
+    const __m128 d = _mm_set1_ps(step[0]);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 i0 = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      const __m128 f0 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 f1 = _mm_cvtepi32_ps(
+          _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+      const __m128 l = _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0));
+      const __m128 r = _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1));
+      const __m128 f = _mm_mul_ps(_mm_add_ps(l, r), half);
+      const __m128 g0 = _mm_add_ps(g, _mm_mul_ps(i0, d));
+
+      _mm_storeu_ps(acc + i,
+                    _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(f, g0)));
+      i0 = _mm_add_ps(i0, four);
+    }
+#endif
+    for (; i < n; i++) {
+      const float s = ((float)src[i * 2] + (float)src[i * 2 + 1]) * 0.5f;
+
+      acc[i] += s * (gain[0] + (float)i * step[0]);
+    }
+  }
+}
+
+/* Truncate the accumulator to integers, saturated to ACC_LIMIT. */
+static void acc_to_s32(const float *acc, Sint32 *dst, int n) {
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  {
+    const __m128 lo = _mm_set1_ps(-ACC_LIMIT);
+    const __m128 hi = _mm_set1_ps(ACC_LIMIT);
+
+    for (; i + 4 <= n; i += 4) {
+      const __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), lo), hi);
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_cvttps_epi32(f));
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    const float f = acc[i] < -ACC_LIMIT ? -ACC_LIMIT :
+                    acc[i] > ACC_LIMIT ? ACC_LIMIT : acc[i];
+    dst[i] = (Sint32)f;
+  }
+}
+
+/* Voices. */
+
+static int find_voice(const SDLEW_Mixer *mixer, Uint32 handle) {
+  int v;
+
+  for (v = 0; v < mixer->num_voices; v++) {
+    if (mixer->handle[v] == handle) {
+      return v;
+    }
+  }
+  return -1;
+}
+
+static void remove_voice(SDLEW_Mixer *mixer, int v) {
+  const int last = --mixer->num_voices;
+
+  mixer->sound[v] = mixer->sound[last];
+  mixer->handle[v] = mixer->handle[last];
+  mixer->frames[v] = mixer->frames[last];
+  mixer->pos[v] = mixer->pos[last];
+  mixer->start[v] = mixer->start[last];
+  mixer->stop[v] = mixer->stop[last];
+  mixer->ramp[v] = mixer->ramp[last];
+  mixer->gain_l[v] = mixer->gain_l[last];
+  mixer->gain_r[v] = mixer->gain_r[last];
+  mixer->step_l[v] = mixer->step_l[last];
+  mixer->step_r[v] = mixer->step_r[last];
+  mixer->target_l[v] = mixer->target_l[last];
+  mixer->target_r[v] = mixer->target_r[last];
+  mixer->sound_channels[v] = mixer->sound_channels[last];
+  mixer->flags[v] = mixer->flags[last];
+}
+
+static void run_command(SDLEW_Mixer *mixer, const MixerCommand *command) {
+  /* Times in the past mean the start of this buffer. */
+  const Uint32 when = (Sint32)(command->when - mixer->time) > 0
+                          ? command->when
+                          : mixer->time;
+  int v;
+
+  if (command->type == COMMAND_PLAY) {
+    if (mixer->num_voices == mixer->max_voices) {
+      sdlew_atomic_store(&mixer->dropped_voices, mixer->dropped_voices + 1);
+      return;
+    }
+    v = mixer->num_voices++;
+    mixer->sound[v] = command->sound;
+    mixer->handle[v] = command->voice;
+    mixer->frames[v] = (Uint32)command->frames;
+    mixer->pos[v] = 0;
+    mixer->start[v] = when;
+    mixer->stop[v] = 0;
+    mixer->ramp[v] = 0;
+    mixer->gain_l[v] = mixer->target_l[v] = command->gain_l;
+    mixer->gain_r[v] = mixer->target_r[v] = command->gain_r;
+    mixer->step_l[v] = mixer->step_r[v] = 0.0f;
+    mixer->sound_channels[v] = (Uint8)command->channels;
+    mixer->flags[v] = command->loop ? VOICE_LOOP : 0;
+    return;
+  }
+
+  v = find_voice(mixer, command->voice);
+  if (v == -1) {
+    return;
+  }
+
+  if (command->type == COMMAND_STOP) {
+    mixer->flags[v] |= VOICE_STOP;
+    mixer->stop[v] = when;
+  }
+  else if (command->ramp <= 0) {
+    mixer->gain_l[v] = mixer->target_l[v] = command->gain_l;
+    mixer->gain_r[v] = mixer->target_r[v] = command->gain_r;
+    mixer->ramp[v] = 0;
+  }
+  else {
+    mixer->target_l[v] = command->gain_l;
+    mixer->target_r[v] = command->gain_r;
+    mixer->step_l[v] = (command->gain_l - mixer->gain_l[v]) / command->ramp;
+    mixer->step_r[v] = (command->gain_r - mixer->gain_r[v]) / command->ramp;
+    mixer->ramp[v] = command->ramp;
+  }
+}
+
+/* Mix the next n frames of voice v, which does not pass the end of its
+ * sound, advancing its gain ramp.
+ */
+static void mix_frames(SDLEW_Mixer *mixer, int v, float *acc, int n) {
+  const int src_channels = mixer->sound_channels[v];
+  const Sint16 *src = mixer->sound[v] + (size_t)mixer->pos[v] * src_channels;
+  const float zero[2] = {0.0f, 0.0f};
+  float gain[2], step[2];
+  int ramp = mixer->ramp[v] < n ? mixer->ramp[v] : n;
+
+  mixer->pos[v] += (Uint32)n;
+
+  if (ramp > 0) {
+    gain[0] = mixer->gain_l[v];
+    gain[1] = mixer->gain_r[v];
+    step[0] = mixer->step_l[v];
+    step[1] = mixer->step_r[v];
+    mix_span(acc, src, ramp, src_channels, mixer->channels, gain, step);
+
+    mixer->ramp[v] -= ramp;
+    if (mixer->ramp[v] == 0) {
+      mixer->gain_l[v] = mixer->target_l[v];
+      mixer->gain_r[v] = mixer->target_r[v];
+    }
+    else {
+      mixer->gain_l[v] = gain[0] + (float)ramp * step[0];
+      mixer->gain_r[v] = gain[1] + (float)ramp * step[1];
+    }
+    acc += ramp * mixer->channels;
+    src += ramp * src_channels;
+    n -= ramp;
+  }
+
+  if (n > 0 && (mixer->gain_l[v] != 0.0f || mixer->gain_r[v] != 0.0f)) {
+    gain[0] = mixer->gain_l[v];
+    gain[1] = mixer->gain_r[v];
+    mix_span(acc, src, n, src_channels, mixer->channels, gain, zero);
+  }
+}
+
+/* Mix voice v into the count frames of acc starting at time now. Returns
+ * 0 once the voice is done.
+ */
+static int mix_voice(SDLEW_Mixer *mixer, int v, float *acc, Uint32 now,
+                     int count) {
+  const Sint32 until_start = (Sint32)(mixer->start[v] - now);
+  int begin, end = count, done = 0;
+
+  if (until_start >= count) {
+    return 1;
+  }
+  begin = until_start > 0 ? (int)until_start : 0;
+
+  if (mixer->flags[v] & VOICE_STOP) {
+    const Sint32 until_stop = (Sint32)(mixer->stop[v] - now);
+
+    if (until_stop <= count) {
+      end = until_stop > begin ? (int)until_stop : begin;
+      done = 1;
+    }
+  }
+
+  while (begin < end) {
+    const Uint32 left = mixer->frames[v] - mixer->pos[v];
+    const int n = (Uint32)(end - begin) < left ? end - begin : (int)left;
+
+    mix_frames(mixer, v, acc + begin * mixer->channels, n);
+    begin += n;
+
+    if (mixer->pos[v] == mixer->frames[v]) {
+      if (!(mixer->flags[v] & VOICE_LOOP)) {
+        return 0;
+      }
+      mixer->pos[v] = 0;
+    }
+  }
+
+  return !done;
+}
+
+/* Commands. */
+
+static int push_command(SDLEW_Mixer *mixer, const MixerCommand *command) {
+  Uint32 pos = sdlew_atomic_load(&mixer->enqueue_pos);
+  CommandSlot *slot;
+
+  for (;;) {
+    Sint32 diff;
+
+    slot = &mixer->commands[pos & mixer->command_mask];
+    diff = (Sint32)(sdlew_atomic_load(&slot->sequence) - pos);
+    if (diff == 0) {
+      if (sdlew_atomic_cas(&mixer->enqueue_pos, pos, pos + 1)) {
+        break;
+      }
+    }
+    else if (diff < 0) {
+      sdlew_atomic_add(&mixer->dropped_commands, 1);
+      return -1;
+    }
+    pos = sdlew_atomic_load(&mixer->enqueue_pos);
+  }
+
+  slot->command = *command;
+  sdlew_atomic_store(&slot->sequence, pos + 1);
+  return 0;
+}
+
+static void run_commands(SDLEW_Mixer *mixer) {
+  for (;;) {
+    const Uint32 pos = mixer->dequeue_pos;
+    CommandSlot *slot = &mixer->commands[pos & mixer->command_mask];
+
+    if ((Sint32)(sdlew_atomic_load(&slot->sequence) - (pos + 1)) < 0) {
+      break;
+    }
+    run_command(mixer, &slot->command);
+    sdlew_atomic_store(&slot->sequence, pos + mixer->command_mask + 1);
+    mixer->dequeue_pos = pos + 1;
+  }
+}
+
+static void pan_gains(const SDLEW_Mixer *mixer, float gain, float pan,
+                      MixerCommand *command) {
+  double angle;
+
+  if (mixer->channels == 1) {
+    command->gain_l = gain;
+    command->gain_r = gain;
+    return;
+  }
+  pan = pan < -1.0f ? -1.0f : pan > 1.0f ? 1.0f : pan;
+  angle = (pan + 1.0) * QUARTER_PI;
+  command->gain_l = (float)(gain * cos(angle));
+  command->gain_r = (float)(gain * sin(angle));
+}
+
+/* Mixer. */
+
+SDLEW_Mixer *sdlewMixerCreate(const SDL_AudioSpec *spec, int max_voices,
+                              int max_commands) {
+  SDLEW_Mixer *mixer;
+  SDLEW_SampleFormat sf;
+  Uint32 queue_size = 1, i;
+  size_t size;
+  Uint8 *mem;
+
+  if (spec == NULL || (spec->channels != 1 && spec->channels != 2) ||
+      max_voices <= 0 || max_commands <= 0 || max_commands > MAX_COMMANDS)
+  {
+    SDL_SetError("sdlewMixerCreate: invalid parameters");
+    return NULL;
+  }
+  if (!sdlew_sample_format(spec->format, &sf)) {
+    SDL_SetError("sdlewMixerCreate: unknown audio format");
+    return NULL;
+  }
+  while (queue_size < (Uint32)max_commands) {
+    queue_size *= 2;
+  }
+
+  mixer = (SDLEW_Mixer *)sdlew_aligned_malloc(sizeof(SDLEW_Mixer),
+                                              SDLEW_CACHELINE);
+  if (mixer == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(mixer, 0, sizeof(SDLEW_Mixer));
+
+  mixer->commands = (CommandSlot *)malloc(sizeof(CommandSlot) * queue_size);
+  size = (size_t)max_voices * (sizeof(const Sint16 *) + 6 * sizeof(Uint32) +
+                               6 * sizeof(float) + 2);
+  mem = (Uint8 *)sdlew_aligned_malloc(size, SDLEW_CACHELINE);
+  if (mixer->commands == NULL || mem == NULL) {
+    free(mixer->commands);
+    sdlew_aligned_free(mem);
+    sdlew_aligned_free(mixer);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  for (i = 0; i < queue_size; i++) {
+    mixer->commands[i].sequence = i;
+  }
+
+  /* Widest arrays first to keep all of them aligned. */
+  mixer->sound = (const Sint16 **)mem;
+  mem += sizeof(const Sint16 *) * max_voices;
+  mixer->handle = (Uint32 *)mem;
+  mixer->frames = mixer->handle + max_voices;
+  mixer->pos = mixer->frames + max_voices;
+  mixer->start = mixer->pos + max_voices;
+  mixer->stop = mixer->start + max_voices;
+  mixer->ramp = (int *)(mixer->stop + max_voices);
+  mixer->gain_l = (float *)(mixer->ramp + max_voices);
+  mixer->gain_r = mixer->gain_l + max_voices;
+  mixer->step_l = mixer->gain_r + max_voices;
+  mixer->step_r = mixer->step_l + max_voices;
+  mixer->target_l = mixer->step_r + max_voices;
+  mixer->target_r = mixer->target_l + max_voices;
+  mixer->sound_channels = (Uint8 *)(mixer->target_r + max_voices);
+  mixer->flags = mixer->sound_channels + max_voices;
+
+  mixer->sf = sf;
+  mixer->channels = spec->channels;
+  mixer->frame_size = sf.bytes * spec->channels;
+  /* Voices are mixed at 16 bit, 8 bit formats hold the top byte. */
+  mixer->shift = sf.bytes == 1 ? 8 : 0;
+  mixer->silence = spec->silence;
+  mixer->max_voices = max_voices;
+  mixer->command_mask = queue_size - 1;
+  return mixer;
+}
+
+void sdlewMixerFree(SDLEW_Mixer *mixer) {
+  if (mixer != NULL) {
+    sdlew_aligned_free((void *)mixer->sound);
+    free(mixer->commands);
+    sdlew_aligned_free(mixer);
+  }
+}
+
+Uint32 sdlewMixerPlay(SDLEW_Mixer *mixer, const Sint16 *sound, int frames,
+                      int channels, int loop, float gain, float pan,
+                      Uint32 when) {
+  MixerCommand command;
+
+  if (sound == NULL || frames <= 0 || (channels != 1 && channels != 2)) {
+    SDL_SetError("sdlewMixerPlay: invalid parameters");
+    return 0;
+  }
+
+  command.type = COMMAND_PLAY;
+  do {
+    command.voice = (Uint32)sdlew_atomic_add(&mixer->next_handle, 1) + 1;
+  } while (command.voice == 0);
+  command.when = when;
+  command.sound = sound;
+  command.frames = frames;
+  command.channels = channels;
+  command.loop = loop;
+  command.ramp = 0;
+  pan_gains(mixer, gain, pan, &command);
+
+  if (push_command(mixer, &command) != 0) {
+    SDL_SetError("sdlewMixerPlay: command queue is full");
+    return 0;
+  }
+  return command.voice;
+}
+
+int sdlewMixerStop(SDLEW_Mixer *mixer, Uint32 voice, Uint32 when) {
+  MixerCommand command;
+
+  memset(&command, 0, sizeof(MixerCommand));
+  command.type = COMMAND_STOP;
+  command.voice = voice;
+  command.when = when;
+
+  if (push_command(mixer, &command) != 0) {
+    SDL_SetError("sdlewMixerStop: command queue is full");
+    return -1;
+  }
+  return 0;
+}
+
+int sdlewMixerSetGain(SDLEW_Mixer *mixer, Uint32 voice, float gain,
+                      float pan, int ramp) {
+  MixerCommand command;
+
+  memset(&command, 0, sizeof(MixerCommand));
+  command.type = COMMAND_SET_GAIN;
+  command.voice = voice;
+  command.when = 0;
+  command.ramp = ramp;
+  pan_gains(mixer, gain, pan, &command);
+
+  if (push_command(mixer, &command) != 0) {
+    SDL_SetError("sdlewMixerSetGain: command queue is full");
+    return -1;
+  }
+  return 0;
+}
+
+Uint32 sdlewMixerGetTime(const SDLEW_Mixer *mixer) {
+  return sdlew_atomic_load(&mixer->time);
+}
+
+void sdlewMixerRender(SDLEW_Mixer *mixer, Uint8 *stream, int len) {
+  float acc[CHUNK * 2];
+  Sint32 out[CHUNK * 2];
+  const int frames = len > 0 ? len / mixer->frame_size : 0;
+  int offset;
+
+  run_commands(mixer);
+
+  for (offset = 0; offset < frames; offset += CHUNK) {
+    const int count = frames - offset < CHUNK ? frames - offset : CHUNK;
+    const int num_samples = count * mixer->channels;
+    const Uint32 now = mixer->time + (Uint32)offset;
+    int v = 0;
+
+    memset(acc, 0, sizeof(float) * num_samples);
+    while (v < mixer->num_voices) {
+      if (mix_voice(mixer, v, acc, now, count)) {
+        v++;
+      }
+      else {
+        remove_voice(mixer, v);
+      }
+    }
+
+    acc_to_s32(acc, out, num_samples);
+    sdlew_samples_from_s32(&mixer->sf, out, mixer->shift,
+                           stream + (size_t)offset * mixer->frame_size,
+                           num_samples);
+  }
+
+  if (len > frames * mixer->frame_size) {
+    memset(stream + frames * mixer->frame_size, mixer->silence,
+           len - frames * mixer->frame_size);
+  }
+  sdlew_atomic_store(&mixer->active_voices, mixer->num_voices);
+  sdlew_atomic_store(&mixer->time, mixer->time + (Uint32)frames);
+}
+
+void SDLCALL sdlewMixerCallback(void *userdata, Uint8 *stream, int len) {
+  sdlewMixerRender((SDLEW_Mixer *)userdata, stream, len);
+}
+
+void sdlewMixerGetStats(const SDLEW_Mixer *mixer, SDLEW_MixerStats *stats) {
+  stats->voices = sdlew_atomic_load(&mixer->active_voices);
+  stats->dropped_commands = sdlew_atomic_load(&mixer->dropped_commands);
+  stats->dropped_voices = sdlew_atomic_load(&mixer->dropped_voices);
+}
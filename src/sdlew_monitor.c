@@ -0,0 +1,293 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Audio callback timing.
+ *
+ * The audio thread is the only writer of the counters and histograms, so
+ * it updates them with plain release stores instead of read-modify-write
+ * atomics, and readers take acquire loads value by value. Resetting from
+ * another thread only raises a flag which the audio thread acts upon, so
+ * there is never a second writer.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <string.h>
+
+enum {
+  HIST_INTERVAL = 0,
+  HIST_BUSY = 1,
+  HIST_SLACK = 2,
+  NUM_HISTS,
+};
+
+struct SDLEW_AudioMonitor {
+  /* Only changed before unpausing or with the audio locked. */
+  void (SDLCALL *callback)(void *userdata, Uint8 *stream, int len);
+  void *userdata;
+  int frame_size;
+  int freq;
+  const SDLEW_AudioStream *stream;
+  SDLEW_AudioMonitorHook hook;
+  void *hook_userdata;
+  char pad0[SDLEW_CACHELINE];
+
+  /* Written by any thread. */
+  int reset_requested;
+  char pad1[SDLEW_CACHELINE];
+
+  /* Written by the audio thread. */
+  int started;
+  Uint32 last_start;
+  Uint32 last_underruns;
+  Uint32 callbacks;
+  Uint32 period_us;
+  Uint32 overtime;
+  Uint32 underruns;
+  SDLEW_AudioHistogram hists[NUM_HISTS];
+};
+
+/* Histograms. */
+
+static int hist_bin(Uint32 us) {
+  int octave = 0;
+
+  if (us < 4) {
+    return (int)us;
+  }
+  while (us >= 8) {
+    us >>= 1;
+    octave++;
+  }
+  if (octave >= SDLEW_AUDIO_HISTOGRAM_BINS / 4 - 1) {
+    return SDLEW_AUDIO_HISTOGRAM_BINS - 1;
+  }
+  return 4 + octave * 4 + (int)(us - 4);
+}
+
+static Uint32 hist_bin_start(int bin) {
+  if (bin < 4) {
+    return (Uint32)bin;
+  }
+  return (Uint32)(4 + (bin & 3)) << (bin / 4 - 1);
+}
+
+static void hist_clear(SDLEW_AudioHistogram *hist) {
+  memset(hist, 0, sizeof(SDLEW_AudioHistogram));
+  hist->min_us = 0xffffffff;
+}
+
+static void hist_add(SDLEW_AudioHistogram *hist, Uint32 us) {
+  Uint32 *bin = &hist->bins[hist_bin(us)];
+
+  sdlew_atomic_store(bin, *bin + 1);
+  if (us < hist->min_us) {
+    sdlew_atomic_store(&hist->min_us, us);
+  }
+  if (us > hist->max_us) {
+    sdlew_atomic_store(&hist->max_us, us);
+  }
+  sdlew_atomic_store(&hist->count, hist->count + 1);
+}
+
+static void hist_copy(SDLEW_AudioHistogram *dst,
+                      const SDLEW_AudioHistogram *src) {
+  int i;
+
+  dst->count = sdlew_atomic_load(&src->count);
+  for (i = 0; i < SDLEW_AUDIO_HISTOGRAM_BINS; i++) {
+    dst->bins[i] = sdlew_atomic_load(&src->bins[i]);
+  }
+  if (dst->count != 0) {
+    dst->min_us = sdlew_atomic_load(&src->min_us);
+    dst->max_us = sdlew_atomic_load(&src->max_us);
+  }
+  else {
+    dst->min_us = 0;
+    dst->max_us = 0;
+  }
+}
+
+Uint32 sdlewAudioHistogramPercentile(const SDLEW_AudioHistogram *hist,
+                                     double fraction) {
+  Uint32 target, sum = 0;
+  int i;
+
+  if (hist->count == 0) {
+    return 0;
+  }
+  if (fraction <= 0.0) {
+    return hist->min_us;
+  }
+  if (fraction >= 1.0) {
+    return hist->max_us;
+  }
+
+  target = (Uint32)(fraction * hist->count + 0.5);
+  if (target == 0) {
+    target = 1;
+  }
+  for (i = 0; i < SDLEW_AUDIO_HISTOGRAM_BINS - 1; i++) {
+    sum += hist->bins[i];
+    if (sum >= target) {
+      const Uint32 end = hist_bin_start(i + 1) - 1;
+      return end < hist->max_us ? end : hist->max_us;
+    }
+  }
+  return hist->max_us;
+}
+
+/* Monitor. */
+
+static void monitor_reset(SDLEW_AudioMonitor *monitor) {
+  int i;
+
+  monitor->started = 0;
+  monitor->callbacks = 0;
+  monitor->overtime = 0;
+  monitor->underruns = 0;
+  for (i = 0; i < NUM_HISTS; i++) {
+    hist_clear(&monitor->hists[i]);
+  }
+}
+
+SDLEW_AudioMonitor *sdlewAudioMonitorCreate(SDL_AudioSpec *spec) {
+  SDLEW_AudioMonitor *monitor;
+
+  if (spec == NULL || spec->callback == NULL || spec->freq <= 0) {
+    SDL_SetError("sdlewAudioMonitorCreate: invalid parameters");
+    return NULL;
+  }
+
+  monitor = (SDLEW_AudioMonitor *)sdlew_aligned_malloc(
+      sizeof(SDLEW_AudioMonitor), SDLEW_CACHELINE);
+  if (monitor == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(monitor, 0, sizeof(SDLEW_AudioMonitor));
+  monitor_reset(monitor);
+
+  monitor->callback = spec->callback;
+  monitor->userdata = spec->userdata;
+  sdlewAudioMonitorSetSpec(monitor, spec);
+
+  spec->callback = sdlewAudioMonitorCallback;
+  spec->userdata = monitor;
+  return monitor;
+}
+
+void sdlewAudioMonitorFree(SDLEW_AudioMonitor *monitor) {
+  sdlew_aligned_free(monitor);
+}
+
+void sdlewAudioMonitorSetSpec(SDLEW_AudioMonitor *monitor,
+                              const SDL_AudioSpec *obtained) {
+  monitor->frame_size = ((obtained->format & 0xff) / 8) *
+                        (obtained->channels > 0 ? obtained->channels : 1);
+  if (monitor->frame_size == 0) {
+    monitor->frame_size = 1;
+  }
+  if (obtained->freq > 0) {
+    monitor->freq = obtained->freq;
+  }
+}
+
+void sdlewAudioMonitorWatchStream(SDLEW_AudioMonitor *monitor,
+                                  const SDLEW_AudioStream *stream) {
+  SDLEW_AudioStreamStats stats;
+
+  monitor->stream = stream;
+  if (stream != NULL) {
+    sdlewAudioStreamGetStats(stream, &stats);
+    monitor->last_underruns = stats.underruns;
+  }
+}
+
+void sdlewAudioMonitorSetUnderrunHook(SDLEW_AudioMonitor *monitor,
+                                      SDLEW_AudioMonitorHook hook,
+                                      void *userdata) {
+  monitor->hook = hook;
+  monitor->hook_userdata = userdata;
+}
+
+void SDLCALL sdlewAudioMonitorCallback(void *userdata, Uint8 *stream,
+                                       int len) {
+  SDLEW_AudioMonitor *monitor = (SDLEW_AudioMonitor *)userdata;
+  const Uint32 start = sdlew_time_us();
+  Uint32 busy, period;
+  int missed = 0;
+
+  if (sdlew_atomic_load(&monitor->reset_requested)) {
+    monitor_reset(monitor);
+    sdlew_atomic_store(&monitor->reset_requested, 0);
+  }
+  if (monitor->started) {
+    hist_add(&monitor->hists[HIST_INTERVAL], start - monitor->last_start);
+  }
+  monitor->started = 1;
+  monitor->last_start = start;
+
+  monitor->callback(monitor->userdata, stream, len);
+
+  busy = sdlew_time_us() - start;
+  period = (Uint32)((Uint64)(len / monitor->frame_size) * 1000000 /
+                    (Uint32)monitor->freq);
+  hist_add(&monitor->hists[HIST_BUSY], busy);
+  hist_add(&monitor->hists[HIST_SLACK], busy < period ? period - busy : 0);
+  sdlew_atomic_store(&monitor->period_us, period);
+  if (busy > period) {
+    sdlew_atomic_store(&monitor->overtime, monitor->overtime + 1);
+    missed = 1;
+  }
+
+  if (monitor->stream != NULL) {
+    SDLEW_AudioStreamStats stats;
+
+    sdlewAudioStreamGetStats(monitor->stream, &stats);
+    if (stats.underruns != monitor->last_underruns) {
+      sdlew_atomic_store(&monitor->underruns, monitor->underruns +
+                         (stats.underruns - monitor->last_underruns));
+      monitor->last_underruns = stats.underruns;
+      missed = 1;
+    }
+  }
+
+  sdlew_atomic_store(&monitor->callbacks, monitor->callbacks + 1);
+
+  if (missed && monitor->hook != NULL) {
+    SDLEW_AudioMonitorStats stats;
+
+    sdlewAudioMonitorGetStats(monitor, &stats);
+    monitor->hook(&stats, monitor->hook_userdata);
+  }
+}
+
+void sdlewAudioMonitorGetStats(const SDLEW_AudioMonitor *monitor,
+                               SDLEW_AudioMonitorStats *stats) {
+  stats->callbacks = sdlew_atomic_load(&monitor->callbacks);
+  stats->period_us = sdlew_atomic_load(&monitor->period_us);
+  stats->overtime = sdlew_atomic_load(&monitor->overtime);
+  stats->underruns = sdlew_atomic_load(&monitor->underruns);
+  hist_copy(&stats->interval, &monitor->hists[HIST_INTERVAL]);
+  hist_copy(&stats->busy, &monitor->hists[HIST_BUSY]);
+  hist_copy(&stats->slack, &monitor->hists[HIST_SLACK]);
+}
+
+void sdlewAudioMonitorResetStats(SDLEW_AudioMonitor *monitor) {
+  sdlew_atomic_store(&monitor->reset_requested, 1);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Offline audio rendering.
+ *
+ * The callback always gets whole buffers of spec->samples frames like
+ * with a device, a final partial buffer is rendered aside and cut. Time
+ * is accumulated buffer by buffer so the 32 bit microsecond clock never
+ * wraps in between two readings.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct OfflineRender {
+  const SDL_AudioSpec *spec;
+  int frame_size;
+  int buffer_size;
+  Uint8 silence;
+  Uint32 last_time;
+  SDLEW_OfflineStats stats;
+} OfflineRender;
+
+static int offline_init(OfflineRender *render, const SDL_AudioSpec *spec) {
+  SDLEW_SampleFormat sf;
+
+  if (spec == NULL || spec->callback == NULL || spec->freq <= 0 ||
+      spec->channels == 0 || spec->samples == 0 ||
+      !sdlew_sample_format(spec->format, &sf))
+  {
+    return 0;
+  }
+
+  memset(render, 0, sizeof(OfflineRender));
+  render->spec = spec;
+  render->frame_size = sf.bytes * spec->channels;
+  render->buffer_size = render->frame_size * spec->samples;
+  /* What SDL_OpenAudio() computes, 0 for AUDIO_U16 too. */
+  render->silence = spec->format == AUDIO_U8 ? 0x80 : 0x00;
+  render->last_time = sdlew_time_us();
+  return 1;
+}
+
+static void offline_tick(OfflineRender *render) {
+  const Uint32 now = sdlew_time_us();
+
+  render->stats.elapsed_us += now - render->last_time;
+  render->last_time = now;
+}
+
+/* Render one buffer of which frames are kept. */
+static void offline_run(OfflineRender *render, Uint8 *buf, Uint32 frames) {
+  Uint32 start;
+
+  memset(buf, render->silence, render->buffer_size);
+  start = sdlew_time_us();
+  render->spec->callback(render->spec->userdata, buf, render->buffer_size);
+  render->stats.callback_us += sdlew_time_us() - start;
+  render->stats.callbacks++;
+  render->stats.frames += frames;
+}
+
+static void offline_finish(OfflineRender *render, SDLEW_OfflineStats *stats) {
+  offline_tick(render);
+  if (stats != NULL) {
+    *stats = render->stats;
+    stats->realtime_factor =
+        render->stats.elapsed_us != 0
+            ? (double)render->stats.frames / render->spec->freq /
+                  ((double)render->stats.elapsed_us * 1e-6)
+            : 0.0;
+  }
+}
+
+int sdlewAudioRenderOffline(const SDL_AudioSpec *spec, Uint8 *buf,
+                            Uint32 frames, SDLEW_OfflineStats *stats) {
+  OfflineRender render;
+  Uint32 done = 0;
+
+  if (buf == NULL || !offline_init(&render, spec)) {
+    SDL_SetError("sdlewAudioRenderOffline: invalid parameters");
+    return -1;
+  }
+
+  while (frames - done >= spec->samples) {
+    offline_run(&render, buf + (size_t)done * render.frame_size,
+                spec->samples);
+    done += spec->samples;
+    offline_tick(&render);
+  }
+
+  if (done < frames) {
+    Uint8 *scratch = (Uint8 *)malloc(render.buffer_size);
+
+    if (scratch == NULL) {
+      offline_finish(&render, stats);
+      SDL_OutOfMemory();
+      return -1;
+    }
+    offline_run(&render, scratch, frames - done);
+    memcpy(buf + (size_t)done * render.frame_size, scratch,
+           (size_t)(frames - done) * render.frame_size);
+    free(scratch);
+  }
+
+  offline_finish(&render, stats);
+  return 0;
+}
+
+int sdlewAudioRenderOfflineRW(const SDL_AudioSpec *spec, SDL_RWops *dst,
+                              Uint32 frames, SDLEW_OfflineStats *stats) {
+  OfflineRender render;
+  Uint8 *scratch;
+  Uint32 done = 0;
+  int result = 0;
+
+  if (dst == NULL || !offline_init(&render, spec)) {
+    SDL_SetError("sdlewAudioRenderOfflineRW: invalid parameters");
+    return -1;
+  }
+
+  scratch = (Uint8 *)malloc(render.buffer_size);
+  if (scratch == NULL) {
+    SDL_OutOfMemory();
+    return -1;
+  }
+
+  while (done < frames) {
+    const Uint32 n = frames - done < spec->samples ? frames - done
+                                                   : spec->samples;
+
+    offline_run(&render, scratch, n);
+    if (SDL_RWwrite(dst, scratch, render.frame_size, (int)n) != (int)n) {
+      SDL_SetError("sdlewAudioRenderOfflineRW: write failed");
+      result = -1;
+      break;
+    }
+    done += n;
+    offline_tick(&render);
+  }
+
+  free(scratch);
+  offline_finish(&render, stats);
+  return result;
+}
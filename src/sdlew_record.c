@@ -0,0 +1,560 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Event recording and replay.
+ *
+ * A recording starts with an 8 byte header, "SDLEWEV" and a version byte.
+ * Every record is the time since the previous record in microseconds, a
+ * type byte, which is the SDL event type or BATCH_END, and the fields of
+ * the type. All numbers are LEB128 varints, signed ones zigzag encoded so
+ * small negative values stay short, which makes a typical motion event 6
+ * to 8 bytes instead of sizeof(SDL_Event).
+ */
+
+#include "sdlew_events.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define VERSION 1
+#define HEADER_SIZE 8
+
+#define BATCH_END 0xff
+
+/* Bytes buffered before writing, and the largest record. */
+#define BUFFER_SIZE 4096
+#define MAX_RECORD 64
+
+static const char magic[7] = {'S', 'D', 'L', 'E', 'W', 'E', 'V'};
+
+struct SDLEW_EventRecorder {
+  SDL_RWops *dst;
+  int freedst;
+  int failed;
+  Uint32 last_time;
+  int mouse_x, mouse_y;
+  int len;
+  Uint8 buffer[BUFFER_SIZE];
+};
+
+struct SDLEW_EventReplay {
+  const Uint8 *data;
+  size_t size;
+  size_t pos;
+  Uint8 *owned;
+  int flags;
+  int done;
+  int mouse_x, mouse_y;
+
+  /* Record decoded ahead, with its time since the start. */
+  int has_next;
+  int next_is_end;
+  SDL_Event next;
+  Uint64 next_time;
+
+  /* Replay clock for the realtime mode. */
+  int started;
+  Uint32 last_clock;
+  Uint64 clock;
+};
+
+/* Encoding. */
+
+static Uint32 zigzag(int value) {
+  return value < 0 ? ~((Uint32)value << 1) : (Uint32)value << 1;
+}
+
+static int unzigzag(Uint32 value) {
+  return (value & 1) ? -(int)(value >> 1) - 1 : (int)(value >> 1);
+}
+
+static Uint8 *put_varint(Uint8 *p, Uint32 value) {
+  while (value >= 0x80) {
+    *p++ = (Uint8)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (Uint8)value;
+  return p;
+}
+
+static Uint8 *put_signed(Uint8 *p, int value) {
+  return put_varint(p, zigzag(value));
+}
+
+static void recorder_flush(SDLEW_EventRecorder *recorder) {
+  if (recorder->len != 0 && !recorder->failed &&
+      SDL_RWwrite(recorder->dst, recorder->buffer, recorder->len, 1) != 1)
+  {
+    recorder->failed = 1;
+  }
+  recorder->len = 0;
+}
+
+/* Start a record of the given type and return where its fields go. */
+static Uint8 *recorder_begin(SDLEW_EventRecorder *recorder, int type) {
+  const Uint32 now = sdlew_time_us();
+  Uint8 *p;
+
+  if (recorder->len + MAX_RECORD > BUFFER_SIZE) {
+    recorder_flush(recorder);
+  }
+  p = put_varint(recorder->buffer + recorder->len,
+                 now - recorder->last_time);
+  recorder->last_time = now;
+  *p++ = (Uint8)type;
+  return p;
+}
+
+static void recorder_end(SDLEW_EventRecorder *recorder, const Uint8 *p) {
+  recorder->len = (int)(p - recorder->buffer);
+}
+
+SDLEW_EventRecorder *sdlewEventRecorderCreate(SDL_RWops *dst, int freedst) {
+  SDLEW_EventRecorder *recorder;
+
+  if (dst == NULL) {
+    SDL_SetError("sdlewEventRecorderCreate: passed a NULL destination");
+    return NULL;
+  }
+
+  recorder = (SDLEW_EventRecorder *)calloc(1, sizeof(SDLEW_EventRecorder));
+  if (recorder == NULL) {
+    if (freedst) {
+      SDL_RWclose(dst);
+    }
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  recorder->dst = dst;
+  recorder->freedst = freedst;
+  recorder->last_time = sdlew_time_us();
+
+  memcpy(recorder->buffer, magic, sizeof(magic));
+  recorder->buffer[sizeof(magic)] = VERSION;
+  recorder->len = HEADER_SIZE;
+  return recorder;
+}
+
+int sdlewEventRecorderClose(SDLEW_EventRecorder *recorder) {
+  int failed;
+
+  if (recorder == NULL) {
+    return 0;
+  }
+  recorder_flush(recorder);
+  failed = recorder->failed;
+  if (recorder->freedst) {
+    SDL_RWclose(recorder->dst);
+  }
+  free(recorder);
+
+  if (failed) {
+    SDL_SetError("sdlewEventRecorderClose: failed writing the recording");
+    return -1;
+  }
+  return 0;
+}
+
+void sdlewEventRecord(SDLEW_EventRecorder *recorder, const SDL_Event *event) {
+  Uint8 *p = recorder_begin(recorder, event->type);
+
+  switch (event->type) {
+    case SDL_ACTIVEEVENT:
+      p = put_varint(p, event->active.gain);
+      p = put_varint(p, event->active.state);
+      break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      p = put_varint(p, event->key.which);
+      p = put_varint(p, event->key.state);
+      p = put_varint(p, event->key.keysym.scancode);
+      p = put_varint(p, (Uint32)event->key.keysym.sym);
+      p = put_varint(p, (Uint32)event->key.keysym.mod);
+      p = put_varint(p, event->key.keysym.unicode);
+      break;
+    case SDL_MOUSEMOTION:
+      p = put_varint(p, event->motion.which);
+      p = put_varint(p, event->motion.state);
+      p = put_signed(p, event->motion.x - recorder->mouse_x);
+      p = put_signed(p, event->motion.y - recorder->mouse_y);
+      p = put_signed(p, event->motion.xrel);
+      p = put_signed(p, event->motion.yrel);
+      recorder->mouse_x = event->motion.x;
+      recorder->mouse_y = event->motion.y;
+      break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      p = put_varint(p, event->button.which);
+      p = put_varint(p, event->button.button);
+      p = put_varint(p, event->button.state);
+      p = put_signed(p, event->button.x - recorder->mouse_x);
+      p = put_signed(p, event->button.y - recorder->mouse_y);
+      recorder->mouse_x = event->button.x;
+      recorder->mouse_y = event->button.y;
+      break;
+    case SDL_JOYAXISMOTION:
+      p = put_varint(p, event->jaxis.which);
+      p = put_varint(p, event->jaxis.axis);
+      p = put_signed(p, event->jaxis.value);
+      break;
+    case SDL_JOYBALLMOTION:
+      p = put_varint(p, event->jball.which);
+      p = put_varint(p, event->jball.ball);
+      p = put_signed(p, event->jball.xrel);
+      p = put_signed(p, event->jball.yrel);
+      break;
+    case SDL_JOYHATMOTION:
+      p = put_varint(p, event->jhat.which);
+      p = put_varint(p, event->jhat.hat);
+      p = put_varint(p, event->jhat.value);
+      break;
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP:
+      p = put_varint(p, event->jbutton.which);
+      p = put_varint(p, event->jbutton.button);
+      p = put_varint(p, event->jbutton.state);
+      break;
+    case SDL_VIDEORESIZE:
+      p = put_signed(p, event->resize.w);
+      p = put_signed(p, event->resize.h);
+      break;
+    default:
+      if (event->type >= SDL_USEREVENT) {
+        p = put_signed(p, event->user.code);
+      }
+      break;
+  }
+
+  recorder_end(recorder, p);
+}
+
+void sdlewEventRecordBatch(SDLEW_EventRecorder *recorder) {
+  recorder_end(recorder, recorder_begin(recorder, BATCH_END));
+}
+
+/* Decoding. */
+
+static int get_varint(SDLEW_EventReplay *replay, Uint32 *value) {
+  Uint32 result = 0;
+  int shift;
+
+  for (shift = 0; shift < 35; shift += 7) {
+    Uint8 byte;
+
+    if (replay->pos >= replay->size) {
+      return 0;
+    }
+    byte = replay->data[replay->pos++];
+    result |= (Uint32)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int get_byte(SDLEW_EventReplay *replay, Uint8 *value) {
+  Uint32 v;
+
+  if (!get_varint(replay, &v) || v > 0xff) {
+    return 0;
+  }
+  *value = (Uint8)v;
+  return 1;
+}
+
+static int get_signed(SDLEW_EventReplay *replay, int *value) {
+  Uint32 v;
+
+  if (!get_varint(replay, &v)) {
+    return 0;
+  }
+  *value = unzigzag(v);
+  return 1;
+}
+
+/* Decode the fields of an event of the given type. */
+static int decode_event(SDLEW_EventReplay *replay, Uint8 type,
+                        SDL_Event *event) {
+  Uint32 u[3];
+  int s[4];
+
+  memset(event, 0, sizeof(SDL_Event));
+  event->type = type;
+
+  switch (type) {
+    case SDL_ACTIVEEVENT:
+      return get_byte(replay, &event->active.gain) &&
+             get_byte(replay, &event->active.state);
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      if (!get_byte(replay, &event->key.which) ||
+          !get_byte(replay, &event->key.state) ||
+          !get_byte(replay, &event->key.keysym.scancode) ||
+          !get_varint(replay, &u[0]) || !get_varint(replay, &u[1]) ||
+          !get_varint(replay, &u[2]))
+      {
+        return 0;
+      }
+      event->key.keysym.sym = (SDLKey)u[0];
+      event->key.keysym.mod = (SDLMod)u[1];
+      event->key.keysym.unicode = (Uint16)u[2];
+      return 1;
+    case SDL_MOUSEMOTION:
+      if (!get_byte(replay, &event->motion.which) ||
+          !get_byte(replay, &event->motion.state) ||
+          !get_signed(replay, &s[0]) || !get_signed(replay, &s[1]) ||
+          !get_signed(replay, &s[2]) || !get_signed(replay, &s[3]))
+      {
+        return 0;
+      }
+      replay->mouse_x += s[0];
+      replay->mouse_y += s[1];
+      event->motion.x = (Uint16)replay->mouse_x;
+      event->motion.y = (Uint16)replay->mouse_y;
+      event->motion.xrel = (Sint16)s[2];
+      event->motion.yrel = (Sint16)s[3];
+      return 1;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      if (!get_byte(replay, &event->button.which) ||
+          !get_byte(replay, &event->button.button) ||
+          !get_byte(replay, &event->button.state) ||
+          !get_signed(replay, &s[0]) || !get_signed(replay, &s[1]))
+      {
+        return 0;
+      }
+      replay->mouse_x += s[0];
+      replay->mouse_y += s[1];
+      event->button.x = (Uint16)replay->mouse_x;
+      event->button.y = (Uint16)replay->mouse_y;
+      return 1;
+    case SDL_JOYAXISMOTION:
+      if (!get_byte(replay, &event->jaxis.which) ||
+          !get_byte(replay, &event->jaxis.axis) ||
+          !get_signed(replay, &s[0]))
+      {
+        return 0;
+      }
+      event->jaxis.value = (Sint16)s[0];
+      return 1;
+    case SDL_JOYBALLMOTION:
+      if (!get_byte(replay, &event->jball.which) ||
+          !get_byte(replay, &event->jball.ball) ||
+          !get_signed(replay, &s[0]) || !get_signed(replay, &s[1]))
+      {
+        return 0;
+      }
+      event->jball.xrel = (Sint16)s[0];
+      event->jball.yrel = (Sint16)s[1];
+      return 1;
+    case SDL_JOYHATMOTION:
+      return get_byte(replay, &event->jhat.which) &&
+             get_byte(replay, &event->jhat.hat) &&
+             get_byte(replay, &event->jhat.value);
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP:
+      return get_byte(replay, &event->jbutton.which) &&
+             get_byte(replay, &event->jbutton.button) &&
+             get_byte(replay, &event->jbutton.state);
+    case SDL_VIDEORESIZE:
+      return get_signed(replay, &event->resize.w) &&
+             get_signed(replay, &event->resize.h);
+    default:
+      if (type >= SDL_NUMEVENTS) {
+        return 0;
+      }
+      if (type >= SDL_USEREVENT) {
+        return get_signed(replay, &event->user.code);
+      }
+      return 1;
+  }
+}
+
+/* Decode the next record unless already done, returns 0 at the end. */
+static int replay_peek(SDLEW_EventReplay *replay) {
+  Uint32 delta;
+  Uint8 type;
+
+  if (replay->has_next) {
+    return 1;
+  }
+  if (replay->done) {
+    return 0;
+  }
+  if (replay->pos == replay->size) {
+    replay->done = 1;
+    return 0;
+  }
+
+  if (!get_varint(replay, &delta) || replay->pos >= replay->size) {
+    replay->done = -1;
+    return 0;
+  }
+  type = replay->data[replay->pos++];
+  replay->next_time += delta;
+  replay->next_is_end = type == BATCH_END;
+  if (!replay->next_is_end && !decode_event(replay, type, &replay->next)) {
+    replay->done = -1;
+    return 0;
+  }
+  replay->has_next = 1;
+  return 1;
+}
+
+/* Whether the next record is due in realtime mode. */
+static int replay_due(SDLEW_EventReplay *replay) {
+  const Uint32 now = sdlew_time_us();
+
+  if (!replay->started) {
+    replay->started = 1;
+    replay->last_clock = now;
+  }
+  replay->clock += now - replay->last_clock;
+  replay->last_clock = now;
+  return replay->next_time <= replay->clock;
+}
+
+/* Take up to n events of the current batch, or the due ones in realtime
+ * mode. push sends them to SDL instead, stopping once it refuses one.
+ */
+static int replay_take(SDLEW_EventReplay *replay, SDL_Event *events, int n,
+                       int push) {
+  const int realtime = replay->flags & SDLEW_REPLAY_REALTIME;
+  int count = 0;
+
+  while (count < n && replay_peek(replay)) {
+    if (realtime && !replay_due(replay)) {
+      break;
+    }
+    if (replay->next_is_end) {
+      replay->has_next = 0;
+      if (!realtime) {
+        break;
+      }
+      continue;
+    }
+    if (push) {
+      if (SDL_PushEvent(&replay->next) != 0) {
+        break;
+      }
+    }
+    else {
+      events[count] = replay->next;
+    }
+    replay->has_next = 0;
+    count++;
+  }
+
+  return count;
+}
+
+int sdlew_replay_take(SDLEW_EventReplay *replay, SDL_Event *events, int n) {
+  return replay_take(replay, events, n, 0);
+}
+
+SDLEW_EventReplay *sdlewEventReplayCreate(const void *data, size_t size,
+                                          int flags) {
+  SDLEW_EventReplay *replay;
+
+  if (data == NULL || size < HEADER_SIZE ||
+      memcmp(data, magic, sizeof(magic)) != 0 ||
+      ((const Uint8 *)data)[sizeof(magic)] != VERSION)
+  {
+    SDL_SetError("sdlewEventReplayCreate: not an event recording");
+    return NULL;
+  }
+
+  replay = (SDLEW_EventReplay *)calloc(1, sizeof(SDLEW_EventReplay));
+  if (replay == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  replay->data = (const Uint8 *)data;
+  replay->size = size;
+  replay->pos = HEADER_SIZE;
+  replay->flags = flags;
+  return replay;
+}
+
+SDLEW_EventReplay *sdlewEventReplayCreateRW(SDL_RWops *src, int freesrc,
+                                            int flags) {
+  SDLEW_EventReplay *replay = NULL;
+  Uint8 *data = NULL;
+  size_t size = 0, capacity = 0;
+
+  if (src == NULL) {
+    SDL_SetError("sdlewEventReplayCreateRW: passed a NULL source");
+    return NULL;
+  }
+
+  for (;;) {
+    int n;
+
+    if (size == capacity) {
+      Uint8 *grown;
+
+      capacity = capacity != 0 ? capacity * 2 : BUFFER_SIZE;
+      grown = (Uint8 *)realloc(data, capacity);
+      if (grown == NULL) {
+        SDL_OutOfMemory();
+        goto finally;
+      }
+      data = grown;
+    }
+    n = SDL_RWread(src, data + size, 1, (int)(capacity - size));
+    if (n <= 0) {
+      break;
+    }
+    size += (size_t)n;
+  }
+
+  replay = sdlewEventReplayCreate(data, size, flags);
+  if (replay != NULL) {
+    replay->owned = data;
+    data = NULL;
+  }
+
+finally:
+  free(data);
+  if (freesrc) {
+    SDL_RWclose(src);
+  }
+  return replay;
+}
+
+void sdlewEventReplayFree(SDLEW_EventReplay *replay) {
+  if (replay != NULL) {
+    free(replay->owned);
+    free(replay);
+  }
+}
+
+int sdlewEventReplayDone(const SDLEW_EventReplay *replay) {
+  if (replay->has_next) {
+    return 0;
+  }
+  if (replay->done != 0) {
+    return replay->done;
+  }
+  return replay->pos == replay->size;
+}
+
+int sdlewEventReplayPush(SDLEW_EventReplay *replay) {
+  return replay_take(replay, NULL, 0x7fffffff, 1);
+}
@@ -0,0 +1,452 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Streaming sample rate conversion.
+ *
+ * The rate ratio is reduced to src:dst = step:phases_exact, and the read
+ * position is kept as an input frame index plus a fraction in units of
+ * 1/phases_exact, so the position never drifts however long the stream.
+ * Input is kept as planar float history per channel.
+ *
+ * The sinc filter is a Kaiser windowed sinc with one coefficient row per
+ * fraction when there are few enough of them (44.1k <-> 48k needs 160 or
+ * 147), otherwise rows are tabulated at MAX_PHASES fractions and the two
+ * nearest ones interpolated. When downsampling the cutoff moves down to
+ * the output Nyquist frequency and the filter widens accordingly.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#  define M_PI 3.14159265358979323846
+#endif
+
+/* Zero crossings on either side of the sinc at full bandwidth. */
+#define SINC_ZERO_CROSSINGS 16
+#define MAX_TAPS 256
+#define MAX_PHASES 256
+#define KAISER_BETA 8.0
+/* Cutoff relative to the lower Nyquist frequency, leaving room for the
+ * transition band.
+ */
+#define CUTOFF 0.92
+
+/* Samples converted at once on input and output. */
+#define CHUNK 1024
+
+struct SDLEW_Resampler {
+  SDLEW_SampleFormat format;
+  Uint16 audio_format;
+  int channels;
+  int src_rate, dst_rate;
+  int quality;
+
+  /* Input frames advanced per output frame is step / phases_exact. */
+  int step, phases_exact;
+
+  /* Sinc rows of taps coefficients, num_phases + 1 of them. */
+  float *coeffs;
+  int taps, num_phases;
+  int interpolate;
+
+  /* Planar history, capacity frames per channel. */
+  float *history;
+  int capacity, num_frames;
+
+  /* Read position: history frame and fraction of it. */
+  int pos, frac;
+};
+
+static int gcd(int a, int b) {
+  while (b != 0) {
+    const int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Filter design. */
+
+static double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+  int k;
+
+  for (k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static double sinc_kernel(double d, double cutoff, double half) {
+  const double r = d / half;
+  double x, w;
+
+  if (r <= -1.0 || r >= 1.0) {
+    return 0.0;
+  }
+  w = bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) / bessel_i0(KAISER_BETA);
+  x = M_PI * cutoff * d;
+  return (x == 0.0 ? cutoff : cutoff * sin(x) / x) * w;
+}
+
+static int build_sinc(SDLEW_Resampler *r) {
+  double cutoff = CUTOFF;
+  int half, p, j;
+
+  if (r->step > r->phases_exact) {
+    cutoff *= (double)r->phases_exact / r->step;
+  }
+  half = (int)ceil(SINC_ZERO_CROSSINGS / cutoff * CUTOFF);
+  half = (half + 1) & ~1;
+  half = half > MAX_TAPS / 2 ? MAX_TAPS / 2 : half;
+  r->taps = half * 2;
+
+  if (r->phases_exact <= MAX_PHASES) {
+    r->num_phases = r->phases_exact;
+    r->interpolate = 0;
+  }
+  else {
+    r->num_phases = MAX_PHASES;
+    r->interpolate = 1;
+  }
+
+  r->coeffs = (float *)sdlew_aligned_malloc(
+      sizeof(float) * r->taps * (r->num_phases + 1), 16);
+  if (r->coeffs == NULL) {
+    return 0;
+  }
+
+  /* Row p filters the input at fraction p / num_phases past tap
+   * half - 1. Each row is normalized for unity gain at DC.
+   */
+  for (p = 0; p <= r->num_phases; p++) {
+    float *row = r->coeffs + p * r->taps;
+    double sum = 0.0;
+    for (j = 0; j < r->taps; j++) {
+      const double d = (half - 1 - j) + (double)p / r->num_phases;
+      const double h = sinc_kernel(d, cutoff, half);
+      row[j] = (float)h;
+      sum += h;
+    }
+    for (j = 0; j < r->taps; j++) {
+      row[j] = (float)(row[j] / sum);
+    }
+  }
+  return 1;
+}
+
+/* History. */
+
+static int history_reserve(SDLEW_Resampler *r, int frames) {
+  float *history;
+  int capacity, c;
+
+  if (frames <= r->capacity) {
+    return 1;
+  }
+  capacity = r->capacity > 0 ? r->capacity : CHUNK;
+  while (capacity < frames) {
+    capacity *= 2;
+  }
+
+  history = (float *)malloc(sizeof(float) * capacity * r->channels);
+  if (history == NULL) {
+    return 0;
+  }
+  if (r->history != NULL) {
+    for (c = 0; c < r->channels; c++) {
+      memcpy(history + c * capacity, r->history + c * r->capacity,
+             sizeof(float) * r->num_frames);
+    }
+    free(r->history);
+  }
+  r->history = history;
+  r->capacity = capacity;
+  return 1;
+}
+
+static void history_append(SDLEW_Resampler *r, const Uint8 *src,
+                           int frames) {
+  Sint16 samples[CHUNK];
+  const int channels = r->channels;
+  const int chunk_frames = CHUNK / channels;
+
+  while (frames > 0) {
+    const int n = frames < chunk_frames ? frames : chunk_frames;
+    int c, i;
+
+    sdlew_samples_to_s16(&r->format, src, samples, n * channels);
+    for (c = 0; c < channels; c++) {
+      float *dst = r->history + c * r->capacity + r->num_frames;
+      for (i = 0; i < n; i++) {
+        dst[i] = samples[i * channels + c];
+      }
+    }
+
+    r->num_frames += n;
+    src += n * channels * r->format.bytes;
+    frames -= n;
+  }
+}
+
+/* Drop frames which are no longer reachable by the filter. */
+static void history_discard(SDLEW_Resampler *r) {
+  const int first = r->pos - (r->taps / 2 - 1);
+  int c;
+
+  if (first <= 0) {
+    return;
+  }
+  for (c = 0; c < r->channels; c++) {
+    float *h = r->history + c * r->capacity;
+    memmove(h, h + first, sizeof(float) * (r->num_frames - first));
+  }
+  r->num_frames -= first;
+  r->pos -= first;
+}
+
+/* Kernels. */
+
+static float dot(const float *x, const float *h, int taps) {
+  int j;
+
+#ifdef SDLEW_HAVE_SSE2
+  __m128 sum = _mm_setzero_ps();
+
+  for (j = 0; j < taps; j += 4) {
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + j),
+                                     _mm_load_ps(h + j)));
+  }
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+#else
+  /* Same association as the four lanes above. */
+  float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+
+  for (j = 0; j < taps; j += 4) {
+    s0 += x[j] * h[j];
+    s1 += x[j + 1] * h[j + 1];
+    s2 += x[j + 2] * h[j + 2];
+    s3 += x[j + 3] * h[j + 3];
+  }
+  return (s0 + s2) + (s1 + s3);
+#endif
+}
+
+static Sint32 round_sample(float value) {
+  /* Keeps the conversion defined, the store saturates anyway. */
+  value = value < -65536.0f ? -65536.0f : value > 65536.0f ? 65536.0f : value;
+  return value >= 0.0f ? (Sint32)(value + 0.5f) : -(Sint32)(0.5f - value);
+}
+
+/* Produce output frames for the current position until the filter runs
+ * out of history, returning the number of frames written to out.
+ */
+static int resample(SDLEW_Resampler *r, Sint32 *out, int max_frames) {
+  const int channels = r->channels;
+  const int half = r->taps / 2;
+  int n = 0, c;
+
+  while (n < max_frames && r->pos + half < r->num_frames) {
+    const float *x = r->history + r->pos - (half - 1);
+
+    if (r->quality == SDLEW_RESAMPLE_LINEAR) {
+      const float t = (float)r->frac / r->phases_exact;
+      for (c = 0; c < channels; c++) {
+        const float *h = x + c * r->capacity;
+        out[n * channels + c] = round_sample(h[0] + (h[1] - h[0]) * t);
+      }
+    }
+    else if (!r->interpolate) {
+      const float *row = r->coeffs + r->frac * r->taps;
+      for (c = 0; c < channels; c++) {
+        out[n * channels + c] = round_sample(
+            dot(x + c * r->capacity, row, r->taps));
+      }
+    }
+    else {
+      const double f = (double)r->frac * r->num_phases / r->phases_exact;
+      const int p = (int)f;
+      const float t = (float)(f - p);
+      const float *row = r->coeffs + p * r->taps;
+      for (c = 0; c < channels; c++) {
+        const float y0 = dot(x + c * r->capacity, row, r->taps);
+        const float y1 = dot(x + c * r->capacity, row + r->taps, r->taps);
+        out[n * channels + c] = round_sample(y0 + (y1 - y0) * t);
+      }
+    }
+
+    n++;
+    r->frac += r->step;
+    r->pos += r->frac / r->phases_exact;
+    r->frac %= r->phases_exact;
+  }
+
+  return n;
+}
+
+/* API. */
+
+SDLEW_Resampler *sdlewResamplerCreate(Uint16 format, int channels,
+                                      int src_rate, int dst_rate,
+                                      int quality) {
+  SDLEW_Resampler *r;
+  int d;
+
+  if (channels <= 0 || channels > CHUNK || src_rate <= 0 || dst_rate <= 0) {
+    SDL_SetError("sdlewResamplerCreate: invalid parameters");
+    return NULL;
+  }
+
+  r = (SDLEW_Resampler *)calloc(1, sizeof(SDLEW_Resampler));
+  if (r == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  if (!sdlew_sample_format(format, &r->format)) {
+    SDL_SetError("sdlewResamplerCreate: unknown audio format");
+    free(r);
+    return NULL;
+  }
+
+  d = gcd(src_rate, dst_rate);
+  r->audio_format = format;
+  r->channels = channels;
+  r->src_rate = src_rate;
+  r->dst_rate = dst_rate;
+  r->quality = quality == SDLEW_RESAMPLE_LINEAR ? SDLEW_RESAMPLE_LINEAR
+                                                : SDLEW_RESAMPLE_SINC;
+  r->step = src_rate / d;
+  r->phases_exact = dst_rate / d;
+
+  if (r->quality == SDLEW_RESAMPLE_SINC) {
+    if (!build_sinc(r)) {
+      free(r);
+      SDL_OutOfMemory();
+      return NULL;
+    }
+  }
+  else {
+    r->taps = 2;
+  }
+  if (!history_reserve(r, r->taps / 2)) {
+    sdlew_aligned_free(r->coeffs);
+    free(r);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+
+  sdlewResamplerReset(r);
+  return r;
+}
+
+void sdlewResamplerFree(SDLEW_Resampler *resampler) {
+  if (resampler != NULL) {
+    sdlew_aligned_free(resampler->coeffs);
+    free(resampler->history);
+    free(resampler);
+  }
+}
+
+void sdlewResamplerReset(SDLEW_Resampler *resampler) {
+  int c;
+
+  /* Silence before the start of the stream, room for it is reserved on
+   * creation.
+   */
+  resampler->num_frames = resampler->taps / 2 - 1;
+  resampler->pos = resampler->num_frames;
+  resampler->frac = 0;
+  for (c = 0; c < resampler->channels; c++) {
+    memset(resampler->history + c * resampler->capacity, 0,
+           sizeof(float) * resampler->num_frames);
+  }
+}
+
+int sdlewResamplerMaxOutput(const SDLEW_Resampler *resampler, int src_len) {
+  const int frame_size = resampler->format.bytes * resampler->channels;
+  const Uint64 frames = (Uint64)(src_len > 0 ? src_len : 0) / frame_size;
+
+  /* Every step / phases_exact input frames yield one output frame. */
+  return (int)((frames * resampler->phases_exact + resampler->step - 1) /
+               resampler->step) * frame_size;
+}
+
+int sdlewResamplerProcess(SDLEW_Resampler *resampler, const Uint8 *src,
+                          int src_len, Uint8 *dst) {
+  Sint32 out[CHUNK];
+  const int channels = resampler->channels;
+  const int frame_size = resampler->format.bytes * channels;
+  const int frames = src_len / frame_size;
+  const int chunk_frames = CHUNK / channels;
+  int written = 0, n;
+
+  if (frames <= 0) {
+    return 0;
+  }
+  if (src == NULL || dst == NULL) {
+    SDL_SetError("sdlewResamplerProcess: passed a NULL pointer");
+    return -1;
+  }
+
+  /* All input is taken in first, which lets dst overlap src. */
+  if (!history_reserve(resampler, resampler->num_frames + frames)) {
+    SDL_OutOfMemory();
+    return -1;
+  }
+  history_append(resampler, src, frames);
+
+  while ((n = resample(resampler, out, chunk_frames)) > 0) {
+    sdlew_samples_from_s32(&resampler->format, out, 0, dst + written,
+                           n * channels);
+    written += n * frame_size;
+  }
+
+  history_discard(resampler);
+  return written;
+}
+
+void sdlewResamplerBuildCVT(const SDLEW_Resampler *resampler,
+                            SDL_AudioCVT *cvt) {
+  const double ratio = (double)resampler->dst_rate / resampler->src_rate;
+
+  memset(cvt, 0, sizeof(*cvt));
+  cvt->needed = resampler->src_rate != resampler->dst_rate;
+  cvt->src_format = resampler->audio_format;
+  cvt->dst_format = resampler->audio_format;
+  cvt->rate_incr = ratio;
+  cvt->len_mult = (int)ceil(ratio);
+  cvt->len_ratio = ratio;
+}
+
+int sdlewResamplerConvert(SDLEW_Resampler *resampler, SDL_AudioCVT *cvt) {
+  const int len = sdlewResamplerProcess(resampler, cvt->buf, cvt->len,
+                                        cvt->buf);
+
+  if (len < 0) {
+    return -1;
+  }
+  cvt->len_cvt = len;
+  return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Event routing.
+ *
+ * Compiling fills every entry of the type table, empty ones with a
+ * handler keeping or dropping the event, so dispatching never tests for
+ * a missing handler. When keys have handlers the SDL_KEYDOWN and
+ * SDL_KEYUP entries point to a second level indexing a per direction key
+ * table, whose entries without a key handler hold the type handler. Keys
+ * out of range land on an extra last entry holding the type handler too.
+ *
+ * SDL 1.2 event filters get no user data, hence the single installed
+ * router.
+ */
+
+#include "sdlew_events.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Route {
+  SDLEW_EventHandler handler;
+  void *userdata;
+} Route;
+
+struct SDLEW_EventRouter {
+  /* Registered handlers. */
+  Route on_type[SDL_NUMEVENTS];
+  Route on_key[SDLK_LAST];
+  int keep;
+
+  /* Compiled tables, all entries have a handler. */
+  Route types[SDL_NUMEVENTS];
+  Route keys[2][SDLK_LAST + 1];
+};
+
+static SDLEW_EventRouter *installed = NULL;
+static SDL_EventFilter previous_filter = NULL;
+
+static int keep_event(const SDL_Event *event, void *userdata) {
+  (void)event;
+  (void)userdata;
+  return 1;
+}
+
+static int drop_event(const SDL_Event *event, void *userdata) {
+  (void)event;
+  (void)userdata;
+  return 0;
+}
+
+/* Second level for key events, userdata is the key table of the event
+ * direction.
+ */
+static int route_key(const SDL_Event *event, void *userdata) {
+  const Route *keys = (const Route *)userdata;
+  const unsigned int sym = (unsigned int)event->key.keysym.sym;
+  const Route *route = &keys[sym < SDLK_LAST ? sym : SDLK_LAST];
+
+  return route->handler(event, route->userdata);
+}
+
+static int SDLCALL router_filter(const SDL_Event *event) {
+  return sdlewEventRouterDispatch(installed, event);
+}
+
+SDLEW_EventRouter *sdlewEventRouterCreate(void) {
+  SDLEW_EventRouter *router;
+
+  router = (SDLEW_EventRouter *)malloc(sizeof(SDLEW_EventRouter));
+  if (router == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(router, 0, sizeof(SDLEW_EventRouter));
+  router->keep = 1;
+  sdlewEventRouterCompile(router);
+  return router;
+}
+
+void sdlewEventRouterFree(SDLEW_EventRouter *router) {
+  if (router != NULL && router == installed) {
+    sdlewEventRouterInstall(NULL);
+  }
+  free(router);
+}
+
+void sdlewEventRouterSetDefault(SDLEW_EventRouter *router, int keep) {
+  router->keep = keep != 0;
+}
+
+int sdlewEventRouterOnType(SDLEW_EventRouter *router, Uint8 type,
+                           SDLEW_EventHandler handler, void *userdata) {
+  if (type >= SDL_NUMEVENTS) {
+    SDL_SetError("sdlewEventRouterOnType: invalid event type");
+    return -1;
+  }
+  router->on_type[type].handler = handler;
+  router->on_type[type].userdata = handler != NULL ? userdata : NULL;
+  return 0;
+}
+
+int sdlewEventRouterOnKey(SDLEW_EventRouter *router, SDLKey key,
+                          SDLEW_EventHandler handler, void *userdata) {
+  if ((int)key < 0 || key >= SDLK_LAST) {
+    SDL_SetError("sdlewEventRouterOnKey: invalid key");
+    return -1;
+  }
+  router->on_key[key].handler = handler;
+  router->on_key[key].userdata = handler != NULL ? userdata : NULL;
+  return 0;
+}
+
+void sdlewEventRouterCompile(SDLEW_EventRouter *router) {
+  Route fallback;
+  int i, dir, have_keys = 0;
+
+  fallback.handler = router->keep ? keep_event : drop_event;
+  fallback.userdata = NULL;
+
+  for (i = 0; i < SDL_NUMEVENTS; i++) {
+    router->types[i] = router->on_type[i].handler != NULL
+                           ? router->on_type[i]
+                           : fallback;
+  }
+  for (i = 0; i < SDLK_LAST; i++) {
+    if (router->on_key[i].handler != NULL) {
+      have_keys = 1;
+      break;
+    }
+  }
+  if (!have_keys) {
+    return;
+  }
+
+  for (dir = 0; dir < 2; dir++) {
+    Route *keys = router->keys[dir];
+    Route *type = &router->types[SDL_KEYDOWN + dir];
+
+    for (i = 0; i < SDLK_LAST; i++) {
+      keys[i] = router->on_key[i].handler != NULL ? router->on_key[i]
+                                                  : *type;
+    }
+    keys[SDLK_LAST] = *type;
+    type->handler = route_key;
+    type->userdata = keys;
+  }
+}
+
+int sdlewEventRouterDispatch(const SDLEW_EventRouter *router,
+                             const SDL_Event *event) {
+  const Route *route = &router->types[event->type & (SDL_NUMEVENTS - 1)];
+
+  return route->handler(event, route->userdata);
+}
+
+void sdlewEventRouterInstall(SDLEW_EventRouter *router) {
+  if (router == NULL) {
+    if (installed != NULL) {
+      SDL_SetEventFilter(previous_filter);
+      installed = NULL;
+      previous_filter = NULL;
+    }
+    return;
+  }
+
+  sdlewEventRouterCompile(router);
+  if (installed == NULL) {
+    previous_filter = SDL_GetEventFilter();
+  }
+  installed = router;
+  SDL_SetEventFilter(router_filter);
+}
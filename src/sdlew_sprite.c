@@ -0,0 +1,706 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Pre-encoded sprites.
+ *
+ * Every row of a sprite is a list of runs, each skipping transparent
+ * pixels and then covering a span of opaque pixels followed by a span of
+ * translucent ones. Opaque pixels are stored in the destination format and
+ * copied as they are, but for the alpha bits of destinations with alpha.
+ * Translucent pixels of 32 bit destinations with 8 bit channels are stored
+ * premultiplied in the destination layout, so blending is a multiply-add
+ * per byte, other destinations blend through RGBA.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SPRITE_MAGIC 0x54525053  /* "SPRT" */
+#define SPRITE_VERSION 1
+
+#define MAX_RUN_LENGTH 0xffff
+
+/* Pixels blended through RGBA at once in the generic path. */
+#define BLEND_CHUNK 256
+
+enum {
+  PIXEL_TRANSPARENT = 0,
+  PIXEL_OPAQUE = 1,
+  PIXEL_BLEND = 2,
+};
+
+typedef struct SpriteRun {
+  Uint16 skip;
+  Uint16 opaque;
+  Uint16 blend;
+  Uint16 unused;
+} SpriteRun;
+
+/* Where the data of a row starts, with an extra entry past the last row. */
+typedef struct SpriteRow {
+  Uint32 run;
+  Uint32 opaque;
+  Uint32 blend;
+} SpriteRow;
+
+struct SDLEW_Sprite {
+  int w, h;
+  int bpp;
+  Uint32 Rmask, Gmask, Bmask, Amask;
+  int premultiplied;
+
+  SpriteRow *rows;
+  SpriteRun *runs;
+  Uint8 *opaque;
+  /* Premultiplied in destination layout, or R, G, B, A bytes. */
+  Uint32 *blend;
+  Uint8 *alpha;
+};
+
+SDLEW_INLINE Uint32 div255(Uint32 x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+/* 32 bit formats with every colour channel in a byte of its own. */
+static int format_byte_aligned(const SDL_PixelFormat *format) {
+  return format->BytesPerPixel == 4 &&
+         format->Rloss == 0 && format->Gloss == 0 && format->Bloss == 0 &&
+         format->Rshift % 8 == 0 && format->Gshift % 8 == 0 &&
+         format->Bshift % 8 == 0;
+}
+
+static SDLEW_Sprite *sprite_alloc(int w, int h, Uint32 num_runs,
+                                  Uint32 opaque_bytes, Uint32 num_blend) {
+  SDLEW_Sprite *sprite;
+
+  sprite = (SDLEW_Sprite *)calloc(1, sizeof(SDLEW_Sprite));
+  if (sprite == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  sprite->w = w;
+  sprite->h = h;
+  sprite->rows = (SpriteRow *)malloc(sizeof(SpriteRow) * (h + 1));
+  sprite->runs = (SpriteRun *)malloc(sizeof(SpriteRun) * (num_runs + 1));
+  sprite->opaque = (Uint8 *)malloc(opaque_bytes + 1);
+  sprite->blend = (Uint32 *)malloc(sizeof(Uint32) * (num_blend + 1));
+  sprite->alpha = (Uint8 *)malloc(num_blend + 1);
+  if (sprite->rows == NULL || sprite->runs == NULL ||
+      sprite->opaque == NULL || sprite->blend == NULL ||
+      sprite->alpha == NULL)
+  {
+    sdlewSpriteFree(sprite);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  return sprite;
+}
+
+void sdlewSpriteFree(SDLEW_Sprite *sprite) {
+  if (sprite == NULL) {
+    return;
+  }
+  free(sprite->rows);
+  free(sprite->runs);
+  free(sprite->opaque);
+  free(sprite->blend);
+  free(sprite->alpha);
+  free(sprite);
+}
+
+void sdlewSpriteGetSize(const SDLEW_Sprite *sprite, int *w, int *h) {
+  *w = sprite->w;
+  *h = sprite->h;
+}
+
+/* Encoding. */
+
+/* Decode row y of the source and classify its pixels. */
+static void classify_row(SDL_Surface *src, int y, Uint8 *rgba,
+                         Uint8 *classes) {
+  const SDL_PixelFormat *format = src->format;
+  const Uint8 *row = (const Uint8 *)src->pixels + y * src->pitch;
+  const int bpp = format->BytesPerPixel;
+  const int pixel_alpha = format->Amask != 0 && (src->flags & SDL_SRCALPHA);
+  const int surface_alpha = !pixel_alpha && (src->flags & SDL_SRCALPHA);
+  const int colorkey = (src->flags & SDL_SRCCOLORKEY) != 0;
+  int x;
+
+  sdlew_row_to_rgba(format, row, rgba, src->w);
+
+  for (x = 0; x < src->w; x++) {
+    Uint8 *c = rgba + x * 4;
+    int alpha = 255;
+
+    if (pixel_alpha) {
+      alpha = c[3];
+    }
+    else if (surface_alpha) {
+      alpha = format->alpha;
+    }
+    if (colorkey && sdlew_pixel_get(row + x * bpp, bpp) == format->colorkey) {
+      alpha = 0;
+    }
+
+    c[3] = (Uint8)alpha;
+    classes[x] = alpha == 0 ? PIXEL_TRANSPARENT :
+                 alpha == 255 ? PIXEL_OPAQUE : PIXEL_BLEND;
+  }
+}
+
+/* Count the pixels of one class starting at x, up to the run limit. */
+static int class_span(const Uint8 *classes, int x, int w, int cls) {
+  int end = x;
+
+  while (end < w && classes[end] == cls && end - x < MAX_RUN_LENGTH) {
+    end++;
+  }
+  return end - x;
+}
+
+/* Split a classified row into runs, filling them in when runs is given.
+ * Returns the number of runs.
+ */
+static int row_runs(const Uint8 *classes, int w, SpriteRun *runs) {
+  int x = 0, num_runs = 0;
+
+  while (x < w) {
+    SpriteRun run;
+
+    run.skip = (Uint16)class_span(classes, x, w, PIXEL_TRANSPARENT);
+    x += run.skip;
+    run.opaque = (Uint16)class_span(classes, x, w, PIXEL_OPAQUE);
+    x += run.opaque;
+    run.blend = (Uint16)class_span(classes, x, w, PIXEL_BLEND);
+    x += run.blend;
+    run.unused = 0;
+
+    /* Trailing transparency needs no run. */
+    if (run.opaque == 0 && run.blend == 0) {
+      break;
+    }
+    if (runs != NULL) {
+      runs[num_runs] = run;
+    }
+    num_runs++;
+  }
+  return num_runs;
+}
+
+static void encode_blend(const SDL_PixelFormat *format, int premultiplied,
+                         const Uint8 *rgba, Uint32 *blend, Uint8 *alpha,
+                         int count) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    const Uint8 *c = rgba + i * 4;
+    const Uint32 a = c[3];
+
+    if (premultiplied) {
+      blend[i] = (div255(c[0] * a) << format->Rshift) |
+                 (div255(c[1] * a) << format->Gshift) |
+                 (div255(c[2] * a) << format->Bshift);
+    }
+    else {
+      memcpy(&blend[i], c, 4);
+    }
+    alpha[i] = (Uint8)a;
+  }
+}
+
+SDLEW_Sprite *sdlewSpriteCreate(SDL_Surface *src,
+                                const SDL_PixelFormat *format) {
+  SDLEW_Sprite *sprite = NULL;
+  Uint8 *rgba = NULL, *classes = NULL;
+  Uint32 num_runs = 0, num_opaque = 0, num_blend = 0;
+  SpriteRow *row;
+  int src_locked = 0, premultiplied, y, x;
+
+  if (src == NULL || format == NULL) {
+    SDL_SetError("sdlewSpriteCreate: passed a NULL pointer");
+    return NULL;
+  }
+  if (src->w <= 0 || src->h <= 0 || src->w > MAX_RUN_LENGTH) {
+    SDL_SetError("sdlewSpriteCreate: invalid surface size");
+    return NULL;
+  }
+
+  rgba = (Uint8 *)malloc(src->w * 4);
+  classes = (Uint8 *)malloc(src->w);
+  if (rgba == NULL || classes == NULL) {
+    SDL_OutOfMemory();
+    goto finally;
+  }
+
+  if (SDL_MUSTLOCK(src)) {
+    if (SDL_LockSurface(src) < 0) {
+      goto finally;
+    }
+    src_locked = 1;
+  }
+
+  /* First pass sizes the arrays. */
+  for (y = 0; y < src->h; y++) {
+    classify_row(src, y, rgba, classes);
+    num_runs += row_runs(classes, src->w, NULL);
+    for (x = 0; x < src->w; x++) {
+      num_opaque += classes[x] == PIXEL_OPAQUE;
+      num_blend += classes[x] == PIXEL_BLEND;
+    }
+  }
+
+  sprite = sprite_alloc(src->w, src->h, num_runs,
+                        num_opaque * format->BytesPerPixel, num_blend);
+  if (sprite == NULL) {
+    goto finally;
+  }
+  premultiplied = format_byte_aligned(format);
+  sprite->bpp = format->BytesPerPixel;
+  sprite->Rmask = format->Rmask;
+  sprite->Gmask = format->Gmask;
+  sprite->Bmask = format->Bmask;
+  sprite->Amask = format->Amask;
+  sprite->premultiplied = premultiplied;
+
+  /* Second pass fills them in. */
+  row = sprite->rows;
+  row->run = row->opaque = row->blend = 0;
+  for (y = 0; y < src->h; y++, row++) {
+    SpriteRun *runs = sprite->runs + row->run;
+    Uint32 opaque = row->opaque, blend = row->blend;
+    int row_num_runs, i;
+
+    classify_row(src, y, rgba, classes);
+    row_num_runs = row_runs(classes, src->w, runs);
+
+    for (i = 0, x = 0; i < row_num_runs; i++) {
+      x += runs[i].skip;
+      sdlew_row_from_rgba(format, rgba + x * 4,
+                          sprite->opaque + opaque * format->BytesPerPixel,
+                          runs[i].opaque);
+      opaque += runs[i].opaque;
+      x += runs[i].opaque;
+      encode_blend(format, premultiplied, rgba + x * 4,
+                   sprite->blend + blend, sprite->alpha + blend,
+                   runs[i].blend);
+      blend += runs[i].blend;
+      x += runs[i].blend;
+    }
+
+    row[1].run = row->run + row_num_runs;
+    row[1].opaque = opaque;
+    row[1].blend = blend;
+  }
+
+finally:
+  if (src_locked) {
+    SDL_UnlockSurface(src);
+  }
+  free(rgba);
+  free(classes);
+  return sprite;
+}
+
+/* Blitting. */
+
+static void copy_span(Uint8 *dst, const Uint8 *src, int size) {
+#ifdef SDLEW_HAVE_SSE2
+  while (size >= 16) {
+    _mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+    dst += 16;
+    src += 16;
+    size -= 16;
+  }
+#endif
+  memcpy(dst, src, size);
+}
+
+/* Copy opaque pixels over a destination with alpha, keeping its alpha
+ * bits like blending does.
+ */
+static void copy_span_keep_alpha(Uint8 *dst, const Uint8 *src, int count,
+                                 int bpp, Uint32 Amask) {
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  if (bpp == 4) {
+    const __m128i keep = _mm_set1_epi32((int)Amask);
+
+    for (; i + 4 <= count; i += 4) {
+      const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i * 4));
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+      _mm_storeu_si128((__m128i *)(dst + i * 4),
+                       _mm_or_si128(_mm_andnot_si128(keep, s),
+                                    _mm_and_si128(keep, d)));
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    const Uint32 d = sdlew_pixel_get(dst + i * bpp, bpp);
+    const Uint32 s = sdlew_pixel_get(src + i * bpp, bpp);
+    sdlew_pixel_put(dst + i * bpp, bpp, (s & ~Amask) | (d & Amask));
+  }
+}
+
+/* Bytes of destination pixels left alone by blending, inverse alpha is
+ * forced to 255 there and the premultiplied source is 0.
+ */
+SDLEW_INLINE Uint32 blend_inverse(Uint8 alpha, Uint32 keep_mask) {
+  return ((255 - alpha) * 0x01010101u) | keep_mask;
+}
+
+static void blend_span_premultiplied(Uint32 *dst, const Uint32 *src,
+                                     const Uint8 *alpha, int count,
+                                     Uint32 keep_mask) {
+  int i = 0, shift;
+
+#ifdef SDLEW_HAVE_SSE2
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+
+    for (; i + 4 <= count; i += 4) {
+      const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+      const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128i inv = _mm_set_epi32(
+              (int)blend_inverse(alpha[i + 3], keep_mask),
+              (int)blend_inverse(alpha[i + 2], keep_mask),
+              (int)blend_inverse(alpha[i + 1], keep_mask),
+              (int)blend_inverse(alpha[i + 0], keep_mask));
+      __m128i lo, hi;
+
+      /* div255(d * inv) for every byte, then add the source. */
+      lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                           _mm_unpacklo_epi8(inv, zero));
+      hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                           _mm_unpackhi_epi8(inv, zero));
+      lo = _mm_add_epi16(lo, round);
+      hi = _mm_add_epi16(hi, round);
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    const Uint32 inv = blend_inverse(alpha[i], keep_mask);
+    const Uint32 d = dst[i], s = src[i];
+    Uint32 result = 0;
+
+    for (shift = 0; shift < 32; shift += 8) {
+      Uint32 c = div255(((d >> shift) & 0xff) * ((inv >> shift) & 0xff));
+      c += (s >> shift) & 0xff;
+      result |= (c > 255 ? 255 : c) << shift;
+    }
+    dst[i] = result;
+  }
+}
+
+/* Any other format goes through RGBA, keeping the destination alpha. */
+static void blend_span_rgba(const SDL_PixelFormat *format, Uint8 *dst,
+                            const Uint32 *src, const Uint8 *alpha,
+                            int count) {
+  Uint8 rgba[BLEND_CHUNK * 4];
+  const int bpp = format->BytesPerPixel;
+
+  while (count > 0) {
+    const int n = count < BLEND_CHUNK ? count : BLEND_CHUNK;
+    int i, c;
+
+    sdlew_row_to_rgba(format, dst, rgba, n);
+    for (i = 0; i < n; i++) {
+      const Uint8 *s = (const Uint8 *)&src[i];
+      const Uint32 a = alpha[i];
+      for (c = 0; c < 3; c++) {
+        rgba[i * 4 + c] = (Uint8)div255(s[c] * a +
+                                        rgba[i * 4 + c] * (255 - a));
+      }
+    }
+    sdlew_row_from_rgba(format, rgba, dst, n);
+
+    dst += n * bpp;
+    src += n;
+    alpha += n;
+    count -= n;
+  }
+}
+
+static void blit_row(const SDLEW_Sprite *sprite, const SpriteRow *row,
+                     const SDL_PixelFormat *format, Uint8 *dst,
+                     int x0, int x1, Uint32 keep_mask) {
+  const SpriteRun *run = sprite->runs + row->run;
+  const SpriteRun *end = sprite->runs + row[1].run;
+  const int bpp = sprite->bpp;
+  const Uint8 *opaque = sprite->opaque + row->opaque * bpp;
+  const Uint32 *blend = sprite->blend + row->blend;
+  const Uint8 *alpha = sprite->alpha + row->blend;
+  int x = 0;
+
+  for (; run < end && x < x1; run++) {
+    int begin, stop;
+
+    x += run->skip;
+
+    begin = x < x0 ? x0 : x;
+    stop = x + run->opaque > x1 ? x1 : x + run->opaque;
+    if (begin < stop && format->Amask != 0) {
+      copy_span_keep_alpha(dst + (begin - x0) * bpp,
+                           opaque + (begin - x) * bpp, stop - begin, bpp,
+                           format->Amask);
+    }
+    else if (begin < stop) {
+      copy_span(dst + (begin - x0) * bpp, opaque + (begin - x) * bpp,
+                (stop - begin) * bpp);
+    }
+    opaque += run->opaque * bpp;
+    x += run->opaque;
+
+    begin = x < x0 ? x0 : x;
+    stop = x + run->blend > x1 ? x1 : x + run->blend;
+    if (begin < stop) {
+      if (sprite->premultiplied) {
+        blend_span_premultiplied((Uint32 *)(dst + (begin - x0) * 4),
+                                 blend + (begin - x), alpha + (begin - x),
+                                 stop - begin, keep_mask);
+      }
+      else {
+        blend_span_rgba(format, dst + (begin - x0) * bpp,
+                        blend + (begin - x), alpha + (begin - x),
+                        stop - begin);
+      }
+    }
+    blend += run->blend;
+    alpha += run->blend;
+    x += run->blend;
+  }
+}
+
+int sdlewSpriteBlit(const SDLEW_Sprite *sprite, const SDL_Rect *srcrect,
+                    SDL_Surface *dst, SDL_Rect *dstrect) {
+  const SDL_PixelFormat *format;
+  SDL_Rect full;
+  Uint32 keep_mask;
+  int srcx, srcy, w, h, y;
+
+  if (sprite == NULL || dst == NULL) {
+    SDL_SetError("sdlewSpriteBlit: passed a NULL pointer");
+    return -1;
+  }
+  format = dst->format;
+  if (format->BytesPerPixel != sprite->bpp ||
+      format->Rmask != sprite->Rmask || format->Gmask != sprite->Gmask ||
+      format->Bmask != sprite->Bmask || format->Amask != sprite->Amask)
+  {
+    SDL_SetError("sdlewSpriteBlit: sprite was encoded for another format");
+    return -1;
+  }
+  if (dstrect == NULL) {
+    full.x = full.y = 0;
+    dstrect = &full;
+  }
+
+  if (!sdlew_clip_blit(sprite->w, sprite->h, srcrect, &dst->clip_rect,
+                       dstrect, &srcx, &srcy))
+  {
+    return 0;
+  }
+  w = dstrect->w;
+  h = dstrect->h;
+
+  if (SDL_MUSTLOCK(dst)) {
+    if (SDL_LockSurface(dst) < 0) {
+      return -1;
+    }
+  }
+
+  keep_mask = ~(format->Rmask | format->Gmask | format->Bmask);
+  for (y = 0; y < h; y++) {
+    Uint8 *row = (Uint8 *)dst->pixels + (dstrect->y + y) * dst->pitch +
+                 dstrect->x * format->BytesPerPixel;
+    blit_row(sprite, sprite->rows + srcy + y, format, row,
+             srcx, srcx + w, keep_mask);
+  }
+
+  if (SDL_MUSTLOCK(dst)) {
+    SDL_UnlockSurface(dst);
+  }
+
+  return 0;
+}
+
+/* Serialization.
+ *
+ * A little endian header is followed by the arrays as they are in memory,
+ * so files only load on hosts of the byte order which wrote them.
+ */
+
+int sdlewSpriteSave(const SDLEW_Sprite *sprite, SDL_RWops *dst) {
+  const SpriteRow *last = sprite->rows + sprite->h;
+  Uint32 header[13];
+  int i, ok = 1;
+
+  header[0] = SPRITE_MAGIC;
+  header[1] = SPRITE_VERSION;
+  header[2] = SDL_BYTEORDER;
+  header[3] = (Uint32)sprite->w;
+  header[4] = (Uint32)sprite->h;
+  header[5] = (Uint32)sprite->bpp;
+  header[6] = sprite->Rmask;
+  header[7] = sprite->Gmask;
+  header[8] = sprite->Bmask;
+  header[9] = sprite->Amask;
+  header[10] = (Uint32)sprite->premultiplied;
+  header[11] = last->run;
+  header[12] = last->blend;
+
+  for (i = 0; i < 13; i++) {
+    ok &= SDL_WriteLE32(dst, header[i]);
+  }
+
+#define WRITE_ARRAY(ptr, size) \
+  ok &= (size) == 0 || SDL_RWwrite(dst, ptr, size, 1) == 1
+
+  WRITE_ARRAY(sprite->rows, sizeof(SpriteRow) * (sprite->h + 1));
+  WRITE_ARRAY(sprite->runs, sizeof(SpriteRun) * last->run);
+  WRITE_ARRAY(sprite->opaque, (size_t)last->opaque * sprite->bpp);
+  WRITE_ARRAY(sprite->blend, sizeof(Uint32) * last->blend);
+  WRITE_ARRAY(sprite->alpha, last->blend);
+
+#undef WRITE_ARRAY
+
+  if (!ok) {
+    SDL_SetError("sdlewSpriteSave: write error");
+    return -1;
+  }
+  return 0;
+}
+
+/* Check every run stays inside its row and the offsets add up. */
+static int sprite_validate(const SDLEW_Sprite *sprite, Uint32 num_runs,
+                           Uint32 num_blend) {
+  int y;
+
+  if (sprite->rows[0].run != 0 || sprite->rows[0].opaque != 0 ||
+      sprite->rows[0].blend != 0 || sprite->rows[sprite->h].run != num_runs ||
+      sprite->rows[sprite->h].blend != num_blend)
+  {
+    return 0;
+  }
+  for (y = 0; y < sprite->h; y++) {
+    const SpriteRow *row = sprite->rows + y;
+    Uint32 i, x = 0, opaque = row->opaque, blend = row->blend;
+
+    if (row[1].run < row->run || row[1].run > num_runs) {
+      return 0;
+    }
+    for (i = row->run; i < row[1].run; i++) {
+      const SpriteRun *run = sprite->runs + i;
+      x += run->skip + run->opaque + run->blend;
+      opaque += run->opaque;
+      blend += run->blend;
+    }
+    if (x > (Uint32)sprite->w || opaque != row[1].opaque ||
+        blend != row[1].blend)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+SDLEW_Sprite *sdlewSpriteLoad(SDL_RWops *src, int freesrc) {
+  SDLEW_Sprite *sprite = NULL;
+  Uint32 header[13], num_opaque;
+  int i, ok = 1;
+
+  for (i = 0; i < 13; i++) {
+    header[i] = SDL_ReadLE32(src);
+  }
+  if (header[0] != SPRITE_MAGIC || header[1] != SPRITE_VERSION) {
+    SDL_SetError("sdlewSpriteLoad: not a sprite file");
+    goto finally;
+  }
+  if (header[2] != SDL_BYTEORDER) {
+    SDL_SetError("sdlewSpriteLoad: sprite was saved with another byte order");
+    goto finally;
+  }
+  if (header[3] == 0 || header[3] > MAX_RUN_LENGTH || header[4] == 0 ||
+      header[4] > 0x7fffffff / sizeof(SpriteRow) - 1 || header[5] < 1 ||
+      header[5] > 4 ||
+      header[11] > (Uint64)header[4] * (header[3] / 2 + 1) ||
+      header[12] > (Uint64)header[3] * header[4])
+  {
+    SDL_SetError("sdlewSpriteLoad: corrupt sprite file");
+    goto finally;
+  }
+
+  /* Opaque pixel count is only known after reading the rows. */
+  sprite = sprite_alloc((int)header[3], (int)header[4], header[11], 0,
+                        header[12]);
+  if (sprite == NULL) {
+    goto finally;
+  }
+  sprite->bpp = (int)header[5];
+  sprite->Rmask = header[6];
+  sprite->Gmask = header[7];
+  sprite->Bmask = header[8];
+  sprite->Amask = header[9];
+  sprite->premultiplied = header[10] != 0 && sprite->bpp == 4;
+
+#define READ_ARRAY(ptr, size) \
+  ok = ok && ((size) == 0 || SDL_RWread(src, ptr, size, 1) == 1)
+
+  READ_ARRAY(sprite->rows, sizeof(SpriteRow) * (sprite->h + 1));
+  num_opaque = sprite->rows[sprite->h].opaque;
+  if (ok && num_opaque > (Uint64)sprite->w * sprite->h) {
+    ok = 0;
+  }
+  if (ok) {
+    free(sprite->opaque);
+    sprite->opaque = (Uint8 *)malloc((size_t)num_opaque * sprite->bpp + 1);
+    if (sprite->opaque == NULL) {
+      sdlewSpriteFree(sprite);
+      sprite = NULL;
+      SDL_OutOfMemory();
+      goto finally;
+    }
+  }
+  READ_ARRAY(sprite->runs, sizeof(SpriteRun) * header[11]);
+  READ_ARRAY(sprite->opaque, (size_t)num_opaque * sprite->bpp);
+  READ_ARRAY(sprite->blend, sizeof(Uint32) * header[12]);
+  READ_ARRAY(sprite->alpha, header[12]);
+
+#undef READ_ARRAY
+
+  if (!ok || !sprite_validate(sprite, header[11], header[12])) {
+    sdlewSpriteFree(sprite);
+    sprite = NULL;
+    SDL_SetError("sdlewSpriteLoad: corrupt sprite file");
+  }
+
+finally:
+  if (freesrc) {
+    SDL_RWclose(src);
+  }
+  return sprite;
+}
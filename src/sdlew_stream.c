@@ -0,0 +1,181 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Single producer, single consumer audio ring.
+ *
+ * Both positions are free running byte counters, so the fill level is
+ * their difference and no slot is wasted telling full from empty. Each
+ * side only ever writes its own position and counters, publishing the
+ * position with a release store after copying and reading the other one
+ * with an acquire load. The two sides live on separate cache lines so the
+ * callback and the producer do not keep stealing a line from each other.
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <string.h>
+
+/* Keeps the difference of the positions unambiguous. */
+#define MAX_CAPACITY (1 << 30)
+
+struct SDLEW_AudioStream {
+  /* Constant after creation. */
+  Uint8 *data;
+  Uint32 size, mask;
+  int frame_size;
+  Uint8 silence;
+  char pad0[SDLEW_CACHELINE];
+
+  /* Written by the producer. */
+  Uint32 write_pos;
+  Uint32 overruns, overrun_bytes;
+  char pad1[SDLEW_CACHELINE];
+
+  /* Written by the consumer. */
+  Uint32 read_pos;
+  Uint32 underruns, underrun_bytes;
+  char pad2[SDLEW_CACHELINE];
+};
+
+SDLEW_AudioStream *sdlewAudioStreamCreate(const SDL_AudioSpec *spec,
+                                          int capacity) {
+  SDLEW_AudioStream *stream;
+  Uint32 size = 1;
+
+  if (spec == NULL || capacity <= 0 || capacity > MAX_CAPACITY) {
+    SDL_SetError("sdlewAudioStreamCreate: invalid parameters");
+    return NULL;
+  }
+  while (size < (Uint32)capacity) {
+    size *= 2;
+  }
+
+  stream = (SDLEW_AudioStream *)sdlew_aligned_malloc(
+      sizeof(SDLEW_AudioStream), SDLEW_CACHELINE);
+  if (stream == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(stream, 0, sizeof(SDLEW_AudioStream));
+
+  stream->data = (Uint8 *)sdlew_aligned_malloc(size, SDLEW_CACHELINE);
+  if (stream->data == NULL) {
+    sdlew_aligned_free(stream);
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  stream->size = size;
+  stream->mask = size - 1;
+  stream->frame_size = ((spec->format & 0xff) / 8) *
+                       (spec->channels > 0 ? spec->channels : 1);
+  stream->silence = spec->silence;
+
+  return stream;
+}
+
+void sdlewAudioStreamFree(SDLEW_AudioStream *stream) {
+  if (stream != NULL) {
+    sdlew_aligned_free(stream->data);
+    sdlew_aligned_free(stream);
+  }
+}
+
+/* Producer. */
+
+int sdlewAudioStreamSpace(const SDLEW_AudioStream *stream) {
+  const Uint32 read_pos = sdlew_atomic_load(&stream->read_pos);
+  const Uint32 write_pos = sdlew_atomic_load(&stream->write_pos);
+  const Uint32 space = stream->size - (write_pos - read_pos);
+
+  return (int)(space - space % stream->frame_size);
+}
+
+int sdlewAudioStreamWrite(SDLEW_AudioStream *stream, const void *data,
+                          int len) {
+  const Uint32 write_pos = stream->write_pos;
+  const Uint32 offset = write_pos & stream->mask;
+  Uint32 n, first;
+
+  if (len <= 0) {
+    return 0;
+  }
+
+  n = (Uint32)sdlewAudioStreamSpace(stream);
+  if (n < (Uint32)len) {
+    sdlew_atomic_add(&stream->overruns, 1);
+    sdlew_atomic_add(&stream->overrun_bytes, (Uint32)len - n);
+  }
+  else {
+    n = (Uint32)len - (Uint32)len % stream->frame_size;
+  }
+
+  first = stream->size - offset < n ? stream->size - offset : n;
+  memcpy(stream->data + offset, data, first);
+  memcpy(stream->data, (const Uint8 *)data + first, n - first);
+
+  sdlew_atomic_store(&stream->write_pos, write_pos + n);
+  return (int)n;
+}
+
+/* Consumer. */
+
+int sdlewAudioStreamAvailable(const SDLEW_AudioStream *stream) {
+  const Uint32 write_pos = sdlew_atomic_load(&stream->write_pos);
+  const Uint32 read_pos = sdlew_atomic_load(&stream->read_pos);
+
+  return (int)(write_pos - read_pos);
+}
+
+int sdlewAudioStreamRead(SDLEW_AudioStream *stream, void *data, int len) {
+  const Uint32 read_pos = stream->read_pos;
+  const Uint32 offset = read_pos & stream->mask;
+  Uint32 n, first;
+
+  if (len <= 0) {
+    return 0;
+  }
+
+  n = (Uint32)sdlewAudioStreamAvailable(stream);
+  n = n < (Uint32)len ? n : (Uint32)len;
+
+  first = stream->size - offset < n ? stream->size - offset : n;
+  memcpy(data, stream->data + offset, first);
+  memcpy((Uint8 *)data + first, stream->data, n - first);
+
+  sdlew_atomic_store(&stream->read_pos, read_pos + n);
+  return (int)n;
+}
+
+void SDLCALL sdlewAudioStreamCallback(void *userdata, Uint8 *stream,
+                                      int len) {
+  SDLEW_AudioStream *s = (SDLEW_AudioStream *)userdata;
+  const int n = sdlewAudioStreamRead(s, stream, len);
+
+  if (n < len) {
+    memset(stream + n, s->silence, len - n);
+    sdlew_atomic_add(&s->underruns, 1);
+    sdlew_atomic_add(&s->underrun_bytes, (Uint32)(len - n));
+  }
+}
+
+void sdlewAudioStreamGetStats(const SDLEW_AudioStream *stream,
+                              SDLEW_AudioStreamStats *stats) {
+  stats->underruns = sdlew_atomic_load(&stream->underruns);
+  stats->underrun_bytes = sdlew_atomic_load(&stream->underrun_bytes);
+  stats->overruns = sdlew_atomic_load(&stream->overruns);
+  stats->overrun_bytes = sdlew_atomic_load(&stream->overrun_bytes);
+}
@@ -0,0 +1,679 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Separable surface stretching.
+ *
+ * Every source row touched is decoded to RGBA, filtered horizontally into
+ * a ring of 16 bit rows and the ring is then combined vertically into the
+ * destination row. Filter weights are 1.14 fixed point, the intermediate
+ * rows keep 7 fractional bits per channel.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define INTER_BITS 7
+
+#define FILTER_MASK 0xff
+#define CACHE_SIZE 16
+
+/* Destination rows per parallel chunk. */
+#define BAND_GRAIN 16
+
+typedef struct FilterTable {
+  int src_len, dst_len, filter;
+  /* Weights stored per output, rounded up to a multiple of two. */
+  int taps;
+  int max_count;
+  int *offset;
+  int *count;
+  Sint16 *weights;
+  int users;
+  int cached;
+} FilterTable;
+
+static struct {
+  SDLEW_SpinLock lock;
+  FilterTable *tables[CACHE_SIZE];
+  int next_evict;
+} cache;
+
+/* Filter coefficients. */
+
+static void table_free(FilterTable *table) {
+  if (table != NULL) {
+    free(table->offset);
+    free(table->count);
+    sdlew_aligned_free(table->weights);
+    free(table);
+  }
+}
+
+/* Raw weights for a single output sample, not yet clamped to the source. */
+static int sample_weights(int filter, double scale, int i,
+                          double *w, int *first) {
+  int j, jmin, jmax;
+
+  if (filter == SDLEW_STRETCH_BOX) {
+    /* Coverage of the output pixel footprint over source pixels. */
+    const double start = i * scale, end = (i + 1) * scale;
+    jmin = (int)floor(start);
+    jmax = (int)ceil(end) - 1;
+    for (j = jmin; j <= jmax; j++) {
+      const double lo = j > start ? j : start;
+      const double hi = j + 1 < end ? j + 1 : end;
+      w[j - jmin] = hi - lo;
+    }
+  }
+  else if (filter == SDLEW_STRETCH_BILINEAR) {
+    /* Tent filter, widened when minifying to avoid aliasing. */
+    const double center = (i + 0.5) * scale - 0.5;
+    const double radius = scale > 1.0 ? scale : 1.0;
+    jmin = (int)ceil(center - radius);
+    jmax = (int)floor(center + radius);
+    for (j = jmin; j <= jmax; j++) {
+      const double d = fabs(j - center) / radius;
+      w[j - jmin] = d < 1.0 ? 1.0 - d : 0.0;
+    }
+  }
+  else {
+    jmin = jmax = (int)floor((i + 0.5) * scale);
+    w[0] = 1.0;
+  }
+
+  *first = jmin;
+  return jmax - jmin + 1;
+}
+
+static FilterTable *table_build(int src_len, int dst_len, int filter) {
+  const double scale = (double)src_len / dst_len;
+  const int max_raw = (int)ceil(scale > 1.0 ? scale : 1.0) * 2 + 3;
+  FilterTable *table;
+  double *raw, *clamped;
+  int i, j;
+
+  table = (FilterTable *)calloc(1, sizeof(FilterTable));
+  raw = (double *)malloc(sizeof(double) * max_raw);
+  clamped = (double *)malloc(sizeof(double) * max_raw);
+  if (table == NULL || raw == NULL || clamped == NULL) {
+    free(table);
+    free(raw);
+    free(clamped);
+    return NULL;
+  }
+
+  table->src_len = src_len;
+  table->dst_len = dst_len;
+  table->filter = filter;
+  table->taps = (max_raw + 1) & ~1;
+  table->offset = (int *)malloc(sizeof(int) * dst_len);
+  table->count = (int *)malloc(sizeof(int) * dst_len);
+  table->weights = (Sint16 *)sdlew_aligned_malloc(
+          sizeof(Sint16) * dst_len * table->taps, 16);
+  if (table->offset == NULL || table->count == NULL ||
+      table->weights == NULL)
+  {
+    table_free(table);
+    free(raw);
+    free(clamped);
+    return NULL;
+  }
+  memset(table->weights, 0, sizeof(Sint16) * dst_len * table->taps);
+
+  for (i = 0; i < dst_len; i++) {
+    Sint16 *w = table->weights + i * table->taps;
+    int first, num, lo, hi, total, largest;
+    double sum = 0.0;
+
+    num = sample_weights(filter, scale, i, raw, &first);
+
+    /* Fold samples outside of the source onto the edge pixels. */
+    lo = first < 0 ? 0 : first;
+    hi = first + num - 1 > src_len - 1 ? src_len - 1 : first + num - 1;
+    if (hi < lo) {
+      lo = hi = first < 0 ? 0 : src_len - 1;
+    }
+    for (j = 0; j <= hi - lo; j++) {
+      clamped[j] = 0.0;
+    }
+    for (j = 0; j < num; j++) {
+      int index = first + j;
+      index = index < lo ? lo : (index > hi ? hi : index);
+      clamped[index - lo] += raw[j];
+      sum += raw[j];
+    }
+    if (sum <= 0.0) {
+      clamped[0] = sum = 1.0;
+    }
+
+    /* Quantize, pushing the rounding error into the largest weight so
+     * every output sums to exactly one.
+     */
+    total = 0;
+    largest = 0;
+    for (j = 0; j <= hi - lo; j++) {
+      w[j] = (Sint16)floor(clamped[j] / sum * WEIGHT_ONE + 0.5);
+      total += w[j];
+      if (w[j] > w[largest]) {
+        largest = j;
+      }
+    }
+    w[largest] = (Sint16)(w[largest] + WEIGHT_ONE - total);
+
+    /* Trim zero weights at both ends. */
+    while (hi > lo && w[hi - lo] == 0) {
+      hi--;
+    }
+    while (lo < hi && w[0] == 0) {
+      memmove(w, w + 1, sizeof(Sint16) * (hi - lo));
+      w[hi - lo] = 0;
+      lo++;
+    }
+
+    table->offset[i] = lo;
+    table->count[i] = hi - lo + 1;
+    if (table->count[i] > table->max_count) {
+      table->max_count = table->count[i];
+    }
+  }
+
+  free(raw);
+  free(clamped);
+
+  return table;
+}
+
+static FilterTable *table_acquire(int src_len, int dst_len, int filter) {
+  FilterTable *table, *evicted = NULL;
+  int i;
+
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    table = cache.tables[i];
+    if (table != NULL && table->src_len == src_len &&
+        table->dst_len == dst_len && table->filter == filter)
+    {
+      table->users++;
+      sdlew_spin_unlock(&cache.lock);
+      return table;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  table = table_build(src_len, dst_len, filter);
+  if (table == NULL) {
+    return NULL;
+  }
+  table->users = 1;
+
+  /* Round-robin eviction, skipping tables which are still in use. */
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    const int slot = (cache.next_evict + i) % CACHE_SIZE;
+    if (cache.tables[slot] == NULL || cache.tables[slot]->users == 0) {
+      evicted = cache.tables[slot];
+      cache.tables[slot] = table;
+      cache.next_evict = (slot + 1) % CACHE_SIZE;
+      table->cached = 1;
+      break;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  table_free(evicted);
+
+  return table;
+}
+
+static void table_release(FilterTable *table) {
+  int destroy;
+
+  sdlew_spin_lock(&cache.lock);
+  table->users--;
+  destroy = (!table->cached && table->users == 0);
+  sdlew_spin_unlock(&cache.lock);
+
+  if (destroy) {
+    table_free(table);
+  }
+}
+
+void sdlewStretchFlushCache(void) {
+  FilterTable *unused[CACHE_SIZE];
+  int i, num_unused = 0;
+
+  sdlew_spin_lock(&cache.lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    FilterTable *table = cache.tables[i];
+    if (table == NULL) {
+      continue;
+    }
+    cache.tables[i] = NULL;
+    table->cached = 0;
+    if (table->users == 0) {
+      unused[num_unused++] = table;
+    }
+  }
+  sdlew_spin_unlock(&cache.lock);
+
+  for (i = 0; i < num_unused; i++) {
+    table_free(unused[i]);
+  }
+}
+
+/* Filter kernels. */
+
+/* Horizontal pass: RGBA bytes to 16 bit channels with INTER_BITS of
+ * fraction. The input row must be padded by table->taps pixels.
+ */
+static void filter_row_horizontal(const FilterTable *table,
+                                  const Uint8 *in, Sint16 *out) {
+  const int taps = table->taps;
+  int x, k;
+
+  for (x = 0; x < table->dst_len; x++, out += 4) {
+    const Uint8 *p = in + table->offset[x] * 4;
+    const Sint16 *w = table->weights + x * taps;
+#ifdef SDLEW_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    const int count = table->count[x];
+
+    /* Two source pixels per step, channels interleaved so that madd
+     * yields one sum per channel.
+     */
+    for (k = 0; k < count; k += 2, p += 8) {
+      __m128i pixels = _mm_unpacklo_epi8(
+              _mm_loadl_epi64((const __m128i *)p), zero);
+      __m128i weights = _mm_set1_epi32(
+              (int)(((Uint32)(Uint16)w[k + 1] << 16) | (Uint16)w[k]));
+      pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(pixels, weights));
+    }
+    acc = _mm_add_epi32(acc,
+            _mm_set1_epi32(1 << (WEIGHT_BITS - INTER_BITS - 1)));
+    acc = _mm_srai_epi32(acc, WEIGHT_BITS - INTER_BITS);
+    _mm_storel_epi64((__m128i *)out, _mm_packs_epi32(acc, acc));
+#else
+    int r = 0, g = 0, b = 0, a = 0;
+    const int count = table->count[x];
+    const int round = 1 << (WEIGHT_BITS - INTER_BITS - 1);
+
+    for (k = 0; k < count; k++, p += 4) {
+      r += p[0] * w[k];
+      g += p[1] * w[k];
+      b += p[2] * w[k];
+      a += p[3] * w[k];
+    }
+    out[0] = (Sint16)((r + round) >> (WEIGHT_BITS - INTER_BITS));
+    out[1] = (Sint16)((g + round) >> (WEIGHT_BITS - INTER_BITS));
+    out[2] = (Sint16)((b + round) >> (WEIGHT_BITS - INTER_BITS));
+    out[3] = (Sint16)((a + round) >> (WEIGHT_BITS - INTER_BITS));
+#endif
+  }
+}
+
+/* Vertical pass: combine count intermediate rows into RGBA bytes. */
+static void filter_rows_vertical(const Sint16 **rows, const Sint16 *w,
+                                 int count, Uint8 *out, int num_values) {
+  const int shift = WEIGHT_BITS + INTER_BITS;
+  int i = 0, k;
+
+#ifdef SDLEW_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+
+  for (; i + 8 <= num_values; i += 8) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    __m128i result;
+
+    for (k = 0; k < count; k += 2) {
+      const __m128i a = _mm_load_si128((const __m128i *)(rows[k] + i));
+      __m128i b, weights;
+      if (k + 1 < count) {
+        b = _mm_load_si128((const __m128i *)(rows[k + 1] + i));
+        weights = _mm_set1_epi32(
+                (int)(((Uint32)(Uint16)w[k + 1] << 16) | (Uint16)w[k]));
+      }
+      else {
+        b = zero;
+        weights = _mm_set1_epi32((Uint16)w[k]);
+      }
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+                                            weights));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+                                            weights));
+    }
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), shift);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), shift);
+    result = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(result, result));
+  }
+#endif
+
+  for (; i < num_values; i++) {
+    int sum = 1 << (shift - 1);
+    for (k = 0; k < count; k++) {
+      sum += rows[k][i] * w[k];
+    }
+    sum >>= shift;
+    out[i] = (Uint8)(sum > 255 ? 255 : sum);
+  }
+}
+
+/* Stretch job. */
+
+typedef struct StretchJob {
+  SDL_Surface *src, *dst;
+  SDL_Rect srcrect, dstrect;
+  int filter;
+  int same_format;
+  const FilterTable *htable, *vtable;
+  int error;
+} StretchJob;
+
+static Uint8 *source_row(const StretchJob *job, int y) {
+  const SDL_Surface *src = job->src;
+  return (Uint8 *)src->pixels + (job->srcrect.y + y) * src->pitch +
+         job->srcrect.x * src->format->BytesPerPixel;
+}
+
+static Uint8 *dest_row(const StretchJob *job, int y) {
+  const SDL_Surface *dst = job->dst;
+  return (Uint8 *)dst->pixels + (job->dstrect.y + y) * dst->pitch +
+         job->dstrect.x * dst->format->BytesPerPixel;
+}
+
+/* Nearest neighbour between identical formats, plain pixel copies. */
+static void stretch_band_copy(StretchJob *job, int begin, int end) {
+  const int *xoffset = job->htable->offset;
+  const int width = job->dstrect.w;
+  int x, y;
+
+  for (y = begin; y < end; y++) {
+    const Uint8 *src = source_row(job, job->vtable->offset[y]);
+    Uint8 *dst = dest_row(job, y);
+
+    switch (job->dst->format->BytesPerPixel) {
+      case 1:
+        for (x = 0; x < width; x++) {
+          dst[x] = src[xoffset[x]];
+        }
+        break;
+      case 2:
+        for (x = 0; x < width; x++) {
+          ((Uint16 *)dst)[x] = ((const Uint16 *)src)[xoffset[x]];
+        }
+        break;
+      case 3:
+        for (x = 0; x < width; x++) {
+          memcpy(dst + x * 3, src + xoffset[x] * 3, 3);
+        }
+        break;
+      default:
+        for (x = 0; x < width; x++) {
+          ((Uint32 *)dst)[x] = ((const Uint32 *)src)[xoffset[x]];
+        }
+        break;
+    }
+  }
+}
+
+/* Nearest neighbour between different formats, through RGBA. */
+static void stretch_band_convert(StretchJob *job, int begin, int end) {
+  const int *xoffset = job->htable->offset;
+  const int width = job->dstrect.w;
+  Uint32 *in, *out;
+  int x, y, decoded = -1;
+
+  in = (Uint32 *)malloc(sizeof(Uint32) * job->srcrect.w);
+  out = (Uint32 *)malloc(sizeof(Uint32) * width);
+  if (in == NULL || out == NULL) {
+    sdlew_atomic_store(&job->error, 1);
+    free(in);
+    free(out);
+    return;
+  }
+
+  for (y = begin; y < end; y++) {
+    const int sy = job->vtable->offset[y];
+    if (sy != decoded) {
+      sdlew_row_to_rgba(job->src->format, source_row(job, sy),
+                        (Uint8 *)in, job->srcrect.w);
+      decoded = sy;
+    }
+    for (x = 0; x < width; x++) {
+      out[x] = in[xoffset[x]];
+    }
+    sdlew_row_from_rgba(job->dst->format, (const Uint8 *)out,
+                        dest_row(job, y), width);
+  }
+
+  free(in);
+  free(out);
+}
+
+/* Bilinear and box filtering. */
+static void stretch_band_filter(StretchJob *job, int begin, int end) {
+  const FilterTable *htable = job->htable, *vtable = job->vtable;
+  const int num_values = job->dstrect.w * 4;
+  /* Row stride in values, padded for aligned SIMD loads. */
+  const int stride = (num_values + 7) & ~7;
+  const int ring_size = vtable->max_count;
+  const Sint16 **rows;
+  Uint8 *in, *out;
+  Sint16 *ring;
+  int *ring_row;
+  int y, k;
+
+  in = (Uint8 *)calloc(job->srcrect.w + htable->taps, 4);
+  out = (Uint8 *)malloc(num_values);
+  ring = (Sint16 *)sdlew_aligned_malloc(
+          sizeof(Sint16) * stride * ring_size, 16);
+  ring_row = (int *)malloc(sizeof(int) * ring_size);
+  rows = (const Sint16 **)malloc(sizeof(*rows) * ring_size);
+  if (in == NULL || out == NULL || ring == NULL || ring_row == NULL ||
+      rows == NULL)
+  {
+    sdlew_atomic_store(&job->error, 1);
+    free(in);
+    free(out);
+    sdlew_aligned_free(ring);
+    free(ring_row);
+    free((void *)rows);
+    return;
+  }
+  for (k = 0; k < ring_size; k++) {
+    ring_row[k] = -1;
+  }
+
+  for (y = begin; y < end; y++) {
+    const int first = vtable->offset[y];
+    const int count = vtable->count[y];
+
+    /* Rows of one window map to distinct slots since count fits the
+     * ring, rows already filtered for the previous output are reused.
+     */
+    for (k = 0; k < count; k++) {
+      const int sy = first + k;
+      const int slot = sy % ring_size;
+      Sint16 *row = ring + slot * stride;
+      if (ring_row[slot] != sy) {
+        sdlew_row_to_rgba(job->src->format, source_row(job, sy),
+                          in, job->srcrect.w);
+        filter_row_horizontal(htable, in, row);
+        ring_row[slot] = sy;
+      }
+      rows[k] = row;
+    }
+
+    filter_rows_vertical(rows, vtable->weights + y * vtable->taps, count,
+                         out, num_values);
+    sdlew_row_from_rgba(job->dst->format, out, dest_row(job, y),
+                        job->dstrect.w);
+  }
+
+  free(in);
+  free(out);
+  sdlew_aligned_free(ring);
+  free(ring_row);
+  free((void *)rows);
+}
+
+static void stretch_band(void *userdata, int begin, int end) {
+  StretchJob *job = (StretchJob *)userdata;
+
+  if (job->filter != SDLEW_STRETCH_NEAREST) {
+    stretch_band_filter(job, begin, end);
+  }
+  else if (job->same_format) {
+    stretch_band_copy(job, begin, end);
+  }
+  else {
+    stretch_band_convert(job, begin, end);
+  }
+}
+
+static int formats_equal(const SDL_PixelFormat *a, const SDL_PixelFormat *b) {
+  if (a->BytesPerPixel != b->BytesPerPixel) {
+    return 0;
+  }
+  if (a->palette != NULL || b->palette != NULL) {
+    if (a->palette == NULL || b->palette == NULL ||
+        a->palette->ncolors != b->palette->ncolors)
+    {
+      return 0;
+    }
+    return a->palette == b->palette ||
+           memcmp(a->palette->colors, b->palette->colors,
+                  sizeof(SDL_Color) * a->palette->ncolors) == 0;
+  }
+  return a->Rmask == b->Rmask && a->Gmask == b->Gmask &&
+         a->Bmask == b->Bmask && a->Amask == b->Amask;
+}
+
+static int resolve_rect(const SDL_Surface *surface, const SDL_Rect *rect,
+                        SDL_Rect *result) {
+  if (rect == NULL) {
+    result->x = 0;
+    result->y = 0;
+    result->w = (Uint16)surface->w;
+    result->h = (Uint16)surface->h;
+    return 1;
+  }
+  *result = *rect;
+  return rect->x >= 0 && rect->y >= 0 &&
+         rect->x + rect->w <= surface->w &&
+         rect->y + rect->h <= surface->h;
+}
+
+int sdlewStretch(SDL_Surface *src, const SDL_Rect *srcrect,
+                 SDL_Surface *dst, const SDL_Rect *dstrect,
+                 int filter) {
+  StretchJob job;
+  int src_locked = 0, dst_locked = 0;
+
+  memset(&job, 0, sizeof(job));
+  job.src = src;
+  job.dst = dst;
+  job.filter = filter & FILTER_MASK;
+
+  if (src == NULL || dst == NULL) {
+    SDL_SetError("sdlewStretch: passed a NULL surface");
+    return -1;
+  }
+  if (src == dst) {
+    SDL_SetError("sdlewStretch: can't stretch a surface onto itself");
+    return -1;
+  }
+  if (job.filter > SDLEW_STRETCH_BOX) {
+    SDL_SetError("sdlewStretch: unknown filter %d", job.filter);
+    return -1;
+  }
+  if (!resolve_rect(src, srcrect, &job.srcrect) ||
+      !resolve_rect(dst, dstrect, &job.dstrect))
+  {
+    SDL_SetError("sdlewStretch: rectangle exceeds the surface");
+    return -1;
+  }
+  if (job.srcrect.w == 0 || job.srcrect.h == 0 ||
+      job.dstrect.w == 0 || job.dstrect.h == 0)
+  {
+    return 0;
+  }
+
+  job.same_format = formats_equal(src->format, dst->format);
+  job.htable = table_acquire(job.srcrect.w, job.dstrect.w, job.filter);
+  job.vtable = table_acquire(job.srcrect.h, job.dstrect.h, job.filter);
+  if (job.htable == NULL || job.vtable == NULL) {
+    goto out_of_memory;
+  }
+
+  if (SDL_MUSTLOCK(src)) {
+    if (SDL_LockSurface(src) < 0) {
+      goto error;
+    }
+    src_locked = 1;
+  }
+  if (SDL_MUSTLOCK(dst)) {
+    if (SDL_LockSurface(dst) < 0) {
+      goto error;
+    }
+    dst_locked = 1;
+  }
+
+  if (filter & SDLEW_STRETCH_PARALLEL) {
+    sdlew_parallel_range(0, job.dstrect.h, BAND_GRAIN, stretch_band, &job);
+  }
+  else {
+    stretch_band(&job, 0, job.dstrect.h);
+  }
+
+  if (dst_locked) {
+    SDL_UnlockSurface(dst);
+  }
+  if (src_locked) {
+    SDL_UnlockSurface(src);
+  }
+  table_release((FilterTable *)job.htable);
+  table_release((FilterTable *)job.vtable);
+
+  if (job.error) {
+    SDL_OutOfMemory();
+    return -1;
+  }
+  return 0;
+
+out_of_memory:
+  SDL_OutOfMemory();
+error:
+  if (src_locked) {
+    SDL_UnlockSurface(src);
+  }
+  if (job.htable != NULL) {
+    table_release((FilterTable *)job.htable);
+  }
+  if (job.vtable != NULL) {
+    table_release((FilterTable *)job.vtable);
+  }
+  return -1;
+}
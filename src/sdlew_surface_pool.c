@@ -0,0 +1,345 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Recycling allocator for scratch surfaces.
+ *
+ * Every pooled surface lives in a single allocation holding the pool
+ * bookkeeping followed by the cache line aligned pixel storage. Surfaces
+ * in use are also hashed by address, so releasing one only accepts
+ * surfaces the pool handed out and never looks at foreign memory.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_BUCKETS 64
+
+/* Pixel rows are padded to a whole SIMD register. */
+#define PITCH_ALIGN 16
+
+typedef struct PoolKey {
+  int w, h, depth;
+  Uint32 Rmask, Gmask, Bmask, Amask;
+} PoolKey;
+
+typedef struct PoolEntry {
+  struct SDLEW_SurfacePool *pool;
+  PoolKey key;
+  SDL_Surface *surface;
+  size_t size;
+  unsigned int last_frame;
+  /* Free list of the bucket, or list of surfaces in use. */
+  struct PoolEntry *next, *prev;
+  /* Chain of the in use hash bucket. */
+  struct PoolEntry *hash_next;
+} PoolEntry;
+
+/* Offset of the pixels from the start of an entry allocation. */
+#define ENTRY_SIZE \
+        ((sizeof(PoolEntry) + SDLEW_CACHELINE - 1) & ~(SDLEW_CACHELINE - 1))
+
+struct SDLEW_SurfacePool {
+  PoolEntry *buckets[NUM_BUCKETS];
+  PoolEntry *in_use;
+  PoolEntry *in_use_hash[NUM_BUCKETS];
+  unsigned int frame;
+  unsigned int max_idle_frames;
+  SDLEW_SurfacePoolStats stats;
+};
+
+static unsigned int key_hash(const PoolKey *key) {
+  unsigned int hash = (unsigned int)key->w * 73856093u;
+  hash ^= (unsigned int)key->h * 19349663u;
+  hash ^= (unsigned int)key->depth * 83492791u;
+  hash ^= key->Rmask ^ (key->Gmask << 1) ^ (key->Bmask << 2) ^
+          (key->Amask << 3);
+  return (hash ^ (hash >> 16)) % NUM_BUCKETS;
+}
+
+static int key_equal(const PoolKey *a, const PoolKey *b) {
+  return a->w == b->w && a->h == b->h && a->depth == b->depth &&
+         a->Rmask == b->Rmask && a->Gmask == b->Gmask &&
+         a->Bmask == b->Bmask && a->Amask == b->Amask;
+}
+
+static unsigned int surface_hash(const SDL_Surface *surface) {
+  const size_t hash = (size_t)surface / sizeof(SDL_Surface);
+  return (unsigned int)(hash ^ (hash >> 16)) % NUM_BUCKETS;
+}
+
+static PoolEntry *entry_create(SDLEW_SurfacePool *pool, const PoolKey *key) {
+  const int bpp = (key->depth + 7) / 8;
+  const int pitch = (key->w * bpp + PITCH_ALIGN - 1) & ~(PITCH_ALIGN - 1);
+  const size_t size = ENTRY_SIZE + (size_t)pitch * key->h;
+  PoolEntry *entry;
+
+  if (pitch > 0xffff) {
+    SDL_SetError("sdlewSurfacePoolAcquire: surface too wide");
+    return NULL;
+  }
+
+  entry = (PoolEntry *)sdlew_aligned_malloc(size, SDLEW_CACHELINE);
+  if (entry == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  memset(entry, 0, sizeof(PoolEntry));
+
+  entry->surface = SDL_CreateRGBSurfaceFrom((Uint8 *)entry + ENTRY_SIZE,
+                                            key->w, key->h, key->depth,
+                                            pitch, key->Rmask, key->Gmask,
+                                            key->Bmask, key->Amask);
+  if (entry->surface == NULL) {
+    sdlew_aligned_free(entry);
+    return NULL;
+  }
+  entry->pool = pool;
+  entry->key = *key;
+  entry->size = size;
+
+  return entry;
+}
+
+static void entry_destroy(PoolEntry *entry) {
+  SDL_FreeSurface(entry->surface);
+  sdlew_aligned_free(entry);
+}
+
+/* Bring a recycled surface back into the state of a fresh one. */
+static void entry_reset_state(PoolEntry *entry) {
+  SDL_Surface *surface = entry->surface;
+  const Uint32 alpha_flag = entry->key.Amask ? SDL_SRCALPHA : 0;
+
+  if (surface->flags & SDL_SRCCOLORKEY) {
+    SDL_SetColorKey(surface, 0, 0);
+  }
+  if ((surface->flags & SDL_SRCALPHA) != alpha_flag ||
+      surface->format->alpha != SDL_ALPHA_OPAQUE)
+  {
+    SDL_SetAlpha(surface, alpha_flag, SDL_ALPHA_OPAQUE);
+  }
+  if (surface->clip_rect.x != 0 || surface->clip_rect.y != 0 ||
+      surface->clip_rect.w != surface->w ||
+      surface->clip_rect.h != surface->h)
+  {
+    SDL_SetClipRect(surface, NULL);
+  }
+}
+
+static void in_use_link(SDLEW_SurfacePool *pool, PoolEntry *entry) {
+  const unsigned int bucket = surface_hash(entry->surface);
+
+  entry->hash_next = pool->in_use_hash[bucket];
+  pool->in_use_hash[bucket] = entry;
+  entry->prev = NULL;
+  entry->next = pool->in_use;
+  if (pool->in_use != NULL) {
+    pool->in_use->prev = entry;
+  }
+  pool->in_use = entry;
+  pool->stats.surfaces_in_use++;
+}
+
+/* Take the entry of surface out of the in use hash, NULL when the pool
+ * did not hand it out.
+ */
+static PoolEntry *in_use_find(SDLEW_SurfacePool *pool, SDL_Surface *surface) {
+  PoolEntry **link = &pool->in_use_hash[surface_hash(surface)];
+
+  while (*link != NULL) {
+    PoolEntry *entry = *link;
+    if (entry->surface == surface && entry->pool == pool) {
+      *link = entry->hash_next;
+      entry->hash_next = NULL;
+      return entry;
+    }
+    link = &entry->hash_next;
+  }
+  return NULL;
+}
+
+/* Callers take the entry out of the in use hash themselves. */
+static void in_use_unlink(SDLEW_SurfacePool *pool, PoolEntry *entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  }
+  else {
+    pool->in_use = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  }
+  pool->stats.surfaces_in_use--;
+}
+
+/* Move a surface which is no longer used onto its free list. */
+static void entry_recycle(SDLEW_SurfacePool *pool, PoolEntry *entry) {
+  const unsigned int bucket = key_hash(&entry->key);
+
+  entry_reset_state(entry);
+  entry->last_frame = pool->frame;
+  entry->prev = NULL;
+  entry->next = pool->buckets[bucket];
+  pool->buckets[bucket] = entry;
+  pool->stats.surfaces_free++;
+}
+
+SDLEW_SurfacePool *sdlewSurfacePoolCreate(unsigned int max_idle_frames) {
+  SDLEW_SurfacePool *pool;
+
+  pool = (SDLEW_SurfacePool *)calloc(1, sizeof(SDLEW_SurfacePool));
+  if (pool == NULL) {
+    SDL_OutOfMemory();
+    return NULL;
+  }
+  pool->max_idle_frames = max_idle_frames;
+  return pool;
+}
+
+void sdlewSurfacePoolDestroy(SDLEW_SurfacePool *pool) {
+  PoolEntry *entry, *next;
+  int i;
+
+  if (pool == NULL) {
+    return;
+  }
+  for (i = 0; i < NUM_BUCKETS; i++) {
+    for (entry = pool->buckets[i]; entry != NULL; entry = next) {
+      next = entry->next;
+      entry_destroy(entry);
+    }
+  }
+  for (entry = pool->in_use; entry != NULL; entry = next) {
+    next = entry->next;
+    entry_destroy(entry);
+  }
+  free(pool);
+}
+
+SDL_Surface *sdlewSurfacePoolAcquire(SDLEW_SurfacePool *pool,
+                                     int width, int height, int depth,
+                                     Uint32 Rmask, Uint32 Gmask,
+                                     Uint32 Bmask, Uint32 Amask) {
+  PoolKey key;
+  PoolEntry *entry, *prev = NULL;
+  unsigned int bucket;
+
+  /* SDL surfaces are at most 0xffff wide and high, which also keeps the
+   * pitch computation in entry_create() from overflowing.
+   */
+  if (width <= 0 || width > 0xffff || height <= 0 || height > 0xffff ||
+      (depth != 8 && depth != 15 && depth != 16 && depth != 24 &&
+       depth != 32))
+  {
+    SDL_SetError("sdlewSurfacePoolAcquire: invalid surface size or depth");
+    return NULL;
+  }
+
+  key.w = width;
+  key.h = height;
+  key.depth = depth;
+  key.Rmask = Rmask;
+  key.Gmask = Gmask;
+  key.Bmask = Bmask;
+  key.Amask = Amask;
+  bucket = key_hash(&key);
+
+  pool->stats.acquires++;
+
+  for (entry = pool->buckets[bucket]; entry != NULL; entry = entry->next) {
+    if (key_equal(&entry->key, &key)) {
+      if (prev != NULL) {
+        prev->next = entry->next;
+      }
+      else {
+        pool->buckets[bucket] = entry->next;
+      }
+      pool->stats.surfaces_free--;
+      pool->stats.hits++;
+      in_use_link(pool, entry);
+      return entry->surface;
+    }
+    prev = entry;
+  }
+
+  entry = entry_create(pool, &key);
+  if (entry == NULL) {
+    return NULL;
+  }
+  pool->stats.misses++;
+  pool->stats.bytes_allocated += entry->size;
+  in_use_link(pool, entry);
+
+  return entry->surface;
+}
+
+void sdlewSurfacePoolRelease(SDLEW_SurfacePool *pool, SDL_Surface *surface) {
+  PoolEntry *entry = surface != NULL ? in_use_find(pool, surface) : NULL;
+
+  if (entry == NULL) {
+    SDL_SetError("sdlewSurfacePoolRelease: surface is not in use by the pool");
+    return;
+  }
+  in_use_unlink(pool, entry);
+  entry_recycle(pool, entry);
+  pool->stats.releases++;
+}
+
+void sdlewSurfacePoolReset(SDLEW_SurfacePool *pool) {
+  PoolEntry *entry, *next, **link;
+  int i;
+
+  /* Everything handed out during the frame goes back to the pool. */
+  for (entry = pool->in_use; entry != NULL; entry = next) {
+    next = entry->next;
+    entry->hash_next = NULL;
+    in_use_unlink(pool, entry);
+    entry_recycle(pool, entry);
+  }
+  memset(pool->in_use_hash, 0, sizeof(pool->in_use_hash));
+
+  pool->frame++;
+  pool->stats.frames++;
+
+  /* Drop surfaces nobody asked for in a while. */
+  if (pool->max_idle_frames == 0) {
+    return;
+  }
+  for (i = 0; i < NUM_BUCKETS; i++) {
+    link = &pool->buckets[i];
+    while (*link != NULL) {
+      entry = *link;
+      if (pool->frame - entry->last_frame > pool->max_idle_frames) {
+        *link = entry->next;
+        pool->stats.surfaces_free--;
+        pool->stats.evictions++;
+        pool->stats.bytes_allocated -= entry->size;
+        entry_destroy(entry);
+      }
+      else {
+        link = &entry->next;
+      }
+    }
+  }
+}
+
+void sdlewSurfacePoolGetStats(const SDLEW_SurfacePool *pool,
+                              SDLEW_SurfacePoolStats *stats) {
+  *stats = pool->stats;
+}
@@ -0,0 +1,523 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define VC_EXTRALEAN
+#  include <windows.h>
+#else
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+#define MAX_THREADS 64
+
+/* Memory. */
+
+void *sdlew_aligned_malloc(size_t size, size_t alignment) {
+  void *mem, **ptr;
+
+  /* Keep the original pointer right in front of the aligned block. */
+  mem = malloc(size + alignment + sizeof(void *));
+  if (mem == NULL) {
+    return NULL;
+  }
+  ptr = (void **)(((size_t)mem + sizeof(void *) + alignment - 1) &
+                  ~(alignment - 1));
+  ptr[-1] = mem;
+  return ptr;
+}
+
+void sdlew_aligned_free(void *ptr) {
+  if (ptr != NULL) {
+    free(((void **)ptr)[-1]);
+  }
+}
+
+/* Threading. */
+
+static struct {
+  SDLEW_SpinLock init_lock;
+  int initialized;
+  int num_threads;
+  SDL_Thread *threads[MAX_THREADS];
+  SDL_mutex *mutex;
+  SDL_cond *work_cond;
+  SDL_cond *done_cond;
+  int quit;
+  int busy;
+  unsigned int generation;
+
+  /* Range currently being processed, guarded by mutex. */
+  sdlew_range_func func;
+  void *userdata;
+  int next, end, chunk;
+  int active;
+} pool;
+
+static int system_num_threads(void) {
+  const char *env = getenv("SDLEW_NUM_THREADS");
+  int num_threads;
+
+  if (env != NULL && atoi(env) > 0) {
+    num_threads = atoi(env);
+  }
+  else {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    num_threads = (int)info.dwNumberOfProcessors;
+#else
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (num_threads > MAX_THREADS) {
+    num_threads = MAX_THREADS;
+  }
+  return num_threads;
+}
+
+/* Process chunks of the current range, called with the mutex held. */
+static void pool_run_chunks(void) {
+  while (pool.next < pool.end) {
+    sdlew_range_func func = pool.func;
+    void *userdata = pool.userdata;
+    int begin = pool.next;
+    int end = begin + pool.chunk;
+
+    if (end > pool.end) {
+      end = pool.end;
+    }
+    pool.next = end;
+
+    SDL_mutexV(pool.mutex);
+    func(userdata, begin, end);
+    SDL_mutexP(pool.mutex);
+  }
+}
+
+static int SDLCALL pool_worker(void *unused) {
+  unsigned int generation = 0;
+
+  (void)unused;
+
+  SDL_mutexP(pool.mutex);
+  for (;;) {
+    while (!pool.quit && pool.generation == generation) {
+      SDL_CondWait(pool.work_cond, pool.mutex);
+    }
+    if (pool.quit) {
+      break;
+    }
+    generation = pool.generation;
+
+    pool.active++;
+    pool_run_chunks();
+    pool.active--;
+
+    if (pool.active == 0) {
+      SDL_CondSignal(pool.done_cond);
+    }
+  }
+  SDL_mutexV(pool.mutex);
+
+  return 0;
+}
+
+static void pool_exit(void) {
+  int i;
+
+  SDL_mutexP(pool.mutex);
+  pool.quit = 1;
+  SDL_CondBroadcast(pool.work_cond);
+  SDL_mutexV(pool.mutex);
+
+  for (i = 0; i < pool.num_threads - 1; i++) {
+    SDL_WaitThread(pool.threads[i], NULL);
+  }
+
+  SDL_DestroyCond(pool.done_cond);
+  SDL_DestroyCond(pool.work_cond);
+  SDL_DestroyMutex(pool.mutex);
+}
+
+static void pool_init(void) {
+  int i;
+
+  sdlew_spin_lock(&pool.init_lock);
+  if (pool.initialized) {
+    sdlew_spin_unlock(&pool.init_lock);
+    return;
+  }
+
+  pool.num_threads = 1;
+
+  /* Thread API is only usable once sdlewInit() found libSDL. */
+  if (SDL_CreateThread != NULL && system_num_threads() > 1) {
+    pool.mutex = SDL_CreateMutex();
+    pool.work_cond = SDL_CreateCond();
+    pool.done_cond = SDL_CreateCond();
+
+    if (pool.mutex != NULL && pool.work_cond != NULL &&
+        pool.done_cond != NULL)
+    {
+      int num_workers = system_num_threads() - 1;
+      for (i = 0; i < num_workers; i++) {
+        pool.threads[i] = SDL_CreateThread(pool_worker, NULL);
+        if (pool.threads[i] == NULL) {
+          break;
+        }
+        pool.num_threads++;
+      }
+      if (pool.num_threads > 1) {
+        atexit(pool_exit);
+      }
+    }
+  }
+
+  sdlew_atomic_store(&pool.initialized, 1);
+  sdlew_spin_unlock(&pool.init_lock);
+}
+
+int sdlew_num_threads(void) {
+  if (!sdlew_atomic_load(&pool.initialized)) {
+    pool_init();
+  }
+  return pool.num_threads;
+}
+
+void sdlew_parallel_range(int begin, int end, int grain,
+                          sdlew_range_func func, void *userdata) {
+  int num_threads, chunk;
+
+  if (end <= begin) {
+    return;
+  }
+  if (grain < 1) {
+    grain = 1;
+  }
+
+  num_threads = sdlew_num_threads();
+  if (num_threads == 1 || end - begin <= grain) {
+    func(userdata, begin, end);
+    return;
+  }
+
+  SDL_mutexP(pool.mutex);
+  if (pool.busy) {
+    /* Either nested inside a worker or another thread owns the pool. */
+    SDL_mutexV(pool.mutex);
+    func(userdata, begin, end);
+    return;
+  }
+
+  /* A few chunks per thread to even out unbalanced work. */
+  chunk = (end - begin + num_threads * 4 - 1) / (num_threads * 4);
+  if (chunk < grain) {
+    chunk = grain;
+  }
+
+  pool.busy = 1;
+  pool.func = func;
+  pool.userdata = userdata;
+  pool.next = begin;
+  pool.end = end;
+  pool.chunk = chunk;
+  pool.generation++;
+  SDL_CondBroadcast(pool.work_cond);
+
+  pool_run_chunks();
+  while (pool.active > 0) {
+    SDL_CondWait(pool.done_cond, pool.mutex);
+  }
+
+  pool.busy = 0;
+  pool.func = NULL;
+  pool.userdata = NULL;
+  SDL_mutexV(pool.mutex);
+}
+
+/* Time. */
+
+Uint32 sdlew_time_us(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (freq.QuadPart == 0) {
+    QueryPerformanceFrequency(&freq);
+  }
+  QueryPerformanceCounter(&count);
+  return (Uint32)(count.QuadPart / freq.QuadPart * 1000000 +
+                  count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (Uint32)((Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+/* Pixel conversion. */
+
+void sdlew_row_to_rgba(const SDL_PixelFormat *format,
+                       const Uint8 *src, Uint8 *dst, int width) {
+  const int bpp = format->BytesPerPixel;
+  int x;
+
+  if (bpp == 1 && format->palette != NULL) {
+    const SDL_Color *colors = format->palette->colors;
+    for (x = 0; x < width; x++, dst += 4) {
+      const SDL_Color *color = &colors[src[x]];
+      dst[0] = color->r;
+      dst[1] = color->g;
+      dst[2] = color->b;
+      dst[3] = 255;
+    }
+  }
+  else if (bpp == 4 && format->Rloss == 0 && format->Gloss == 0 &&
+           format->Bloss == 0)
+  {
+    /* 8 bits per channel, the vast majority of surfaces. */
+    const Uint32 *p = (const Uint32 *)src;
+    const int rshift = format->Rshift;
+    const int gshift = format->Gshift;
+    const int bshift = format->Bshift;
+    const int ashift = format->Ashift;
+
+    if (format->Amask) {
+      for (x = 0; x < width; x++, dst += 4) {
+        dst[0] = (Uint8)(p[x] >> rshift);
+        dst[1] = (Uint8)(p[x] >> gshift);
+        dst[2] = (Uint8)(p[x] >> bshift);
+        dst[3] = (Uint8)(p[x] >> ashift);
+      }
+    }
+    else {
+      for (x = 0; x < width; x++, dst += 4) {
+        dst[0] = (Uint8)(p[x] >> rshift);
+        dst[1] = (Uint8)(p[x] >> gshift);
+        dst[2] = (Uint8)(p[x] >> bshift);
+        dst[3] = 255;
+      }
+    }
+  }
+  else {
+    for (x = 0; x < width; x++, src += bpp, dst += 4) {
+      Uint32 pixel = sdlew_pixel_get(src, bpp);
+      dst[0] = sdlew_expand_channel((pixel & format->Rmask) >> format->Rshift,
+                                    format->Rloss);
+      dst[1] = sdlew_expand_channel((pixel & format->Gmask) >> format->Gshift,
+                                    format->Gloss);
+      dst[2] = sdlew_expand_channel((pixel & format->Bmask) >> format->Bshift,
+                                    format->Bloss);
+      if (format->Amask) {
+        dst[3] = sdlew_expand_channel((pixel & format->Amask) >> format->Ashift,
+                                      format->Aloss);
+      }
+      else {
+        dst[3] = 255;
+      }
+    }
+  }
+}
+
+void sdlew_row_from_rgba(const SDL_PixelFormat *format,
+                         const Uint8 *src, Uint8 *dst, int width) {
+  const int bpp = format->BytesPerPixel;
+  int x;
+
+  if (bpp == 1 && format->palette != NULL) {
+    SDL_PixelFormat *mutable_format = (SDL_PixelFormat *)format;
+    for (x = 0; x < width; x++, src += 4) {
+      dst[x] = (Uint8)SDL_MapRGB(mutable_format, src[0], src[1], src[2]);
+    }
+  }
+  else {
+    const Uint32 amask = format->Amask;
+    for (x = 0; x < width; x++, src += 4, dst += bpp) {
+      Uint32 pixel = ((Uint32)(src[0] >> format->Rloss) << format->Rshift) |
+                     ((Uint32)(src[1] >> format->Gloss) << format->Gshift) |
+                     ((Uint32)(src[2] >> format->Bloss) << format->Bshift);
+      if (amask) {
+        pixel |= ((Uint32)(src[3] >> format->Aloss) << format->Ashift) &
+                 amask;
+      }
+      sdlew_pixel_put(dst, bpp, pixel);
+    }
+  }
+}
+
+/* Blitting. */
+
+int sdlew_clip_blit(int src_w, int src_h, const SDL_Rect *srcrect,
+                    const SDL_Rect *clip, SDL_Rect *dstrect,
+                    int *r_srcx, int *r_srcy) {
+  int srcx, srcy, w, h, d;
+
+  if (srcrect != NULL) {
+    srcx = srcrect->x;
+    w = srcrect->w;
+    if (srcx < 0) {
+      w += srcx;
+      dstrect->x -= srcx;
+      srcx = 0;
+    }
+    if (w > src_w - srcx) {
+      w = src_w - srcx;
+    }
+    srcy = srcrect->y;
+    h = srcrect->h;
+    if (srcy < 0) {
+      h += srcy;
+      dstrect->y -= srcy;
+      srcy = 0;
+    }
+    if (h > src_h - srcy) {
+      h = src_h - srcy;
+    }
+  }
+  else {
+    srcx = srcy = 0;
+    w = src_w;
+    h = src_h;
+  }
+
+  d = clip->x - dstrect->x;
+  if (d > 0) {
+    w -= d;
+    dstrect->x += d;
+    srcx += d;
+  }
+  d = dstrect->x + w - clip->x - clip->w;
+  if (d > 0) {
+    w -= d;
+  }
+  d = clip->y - dstrect->y;
+  if (d > 0) {
+    h -= d;
+    dstrect->y += d;
+    srcy += d;
+  }
+  d = dstrect->y + h - clip->y - clip->h;
+  if (d > 0) {
+    h -= d;
+  }
+
+  if (w <= 0 || h <= 0) {
+    dstrect->w = dstrect->h = 0;
+    return 0;
+  }
+  dstrect->w = (Uint16)w;
+  dstrect->h = (Uint16)h;
+  *r_srcx = srcx;
+  *r_srcy = srcy;
+  return 1;
+}
+
+/* Audio samples. */
+
+int sdlew_sample_format(Uint16 format, SDLEW_SampleFormat *sf) {
+  switch (format) {
+    case AUDIO_U8:
+    case AUDIO_S8:
+      sf->bytes = 1;
+      sf->big_endian = 0;
+      sf->bias = format == AUDIO_U8 ? 0x80 : 0;
+      sf->min = -128;
+      sf->max = 127;
+      return 1;
+    case AUDIO_U16LSB:
+    case AUDIO_S16LSB:
+    case AUDIO_U16MSB:
+    case AUDIO_S16MSB:
+      sf->bytes = 2;
+      sf->big_endian = (format & 0x1000) != 0;
+      sf->bias = (format & 0x8000) ? 0 : 0x8000;
+      sf->min = -32768;
+      sf->max = 32767;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void sdlew_samples_to_s16(const SDLEW_SampleFormat *sf, const Uint8 *src,
+                          Sint16 *dst, int n) {
+  int i;
+
+  if (sf->bytes == 1) {
+    const Uint8 bias = (Uint8)sf->bias;
+    for (i = 0; i < n; i++) {
+      dst[i] = (Sint8)(src[i] ^ bias);
+    }
+  }
+  else if (sf->big_endian) {
+    for (i = 0; i < n; i++, src += 2) {
+      dst[i] = (Sint16)(((src[0] << 8) | src[1]) ^ sf->bias);
+    }
+  }
+  else {
+    for (i = 0; i < n; i++, src += 2) {
+      dst[i] = (Sint16)((src[0] | (src[1] << 8)) ^ sf->bias);
+    }
+  }
+}
+
+void sdlew_samples_from_s32(const SDLEW_SampleFormat *sf, const Sint32 *src,
+                            int shift, Uint8 *dst, int n) {
+  int i = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  if (sdlew_sample_native(sf)) {
+    /* Arithmetic shift and signed saturation, same as the scalar code. */
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for (; i + 8 <= n; i += 8) {
+      const __m128i a0 = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128i a1 = _mm_loadu_si128((const __m128i *)(src + i + 4));
+      _mm_storeu_si128((__m128i *)(dst + i * 2),
+                       _mm_packs_epi32(_mm_sra_epi32(a0, count),
+                                       _mm_sra_epi32(a1, count)));
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    int value = src[i] >> shift;
+    Uint16 bits;
+
+    value = value < sf->min ? sf->min : value > sf->max ? sf->max : value;
+    bits = (Uint16)(value ^ sf->bias);
+    if (sf->bytes == 1) {
+      dst[i] = (Uint8)bits;
+    }
+    else if (sf->big_endian) {
+      dst[i * 2] = (Uint8)(bits >> 8);
+      dst[i * 2 + 1] = (Uint8)bits;
+    }
+    else {
+      dst[i * 2] = (Uint8)bits;
+      dst[i * 2 + 1] = (Uint8)(bits >> 8);
+    }
+  }
+}
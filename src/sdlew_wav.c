@@ -0,0 +1,569 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Streaming WAV reader.
+ *
+ * Only the RIFF headers are parsed up front. PCM data is then read from
+ * the source straight into the caller's buffer, ADPCM is read one block at
+ * a time and decoded into a block sized buffer the caller drains. Both
+ * decoders follow the ones of SDL_LoadWAV_RW().
+ */
+
+#include "sdlew_audio.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_MS_ADPCM 0x0002
+#define WAVE_FORMAT_IMA_ADPCM 0x0011
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+/* Largest fmt chunk read: the 22 byte MS ADPCM header followed by up to
+ * 256 coefficient pairs.
+ */
+#define MAX_FMT_SIZE (22 + 256 * 4)
+
+/* Bytes decoded at once by sdlewWavFillStream(). */
+#define FILL_CHUNK 4096
+
+struct SDLEW_WavReader {
+  SDL_RWops *src;
+  int freesrc;
+
+  int encoding;
+  int channels;
+  int frame_size;
+  int block_align;
+  int samples_per_block;
+
+  /* MS ADPCM predictor coefficient pairs. */
+  Sint16 *coeffs;
+  int num_coeffs;
+
+  int data_start;
+  Uint32 data_len, data_pos;
+
+  /* ADPCM block and the samples decoded from it, little endian. */
+  Uint8 *block;
+  Uint8 *decoded;
+  int decoded_len, decoded_pos;
+};
+
+SDLEW_INLINE Uint32 read_le16(const Uint8 *p) {
+  return p[0] | (p[1] << 8);
+}
+
+SDLEW_INLINE Uint32 read_le32(const Uint8 *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((Uint32)p[3] << 24);
+}
+
+SDLEW_INLINE void write_le16(Uint8 *p, int value) {
+  p[0] = (Uint8)value;
+  p[1] = (Uint8)(value >> 8);
+}
+
+SDLEW_INLINE int clamp16(int value) {
+  return value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+}
+
+/* MS ADPCM. */
+
+static const int ms_adaptation[16] = {
+  230, 230, 230, 230, 307, 409, 512, 614,
+  768, 614, 512, 409, 307, 230, 230, 230,
+};
+
+typedef struct MSChannel {
+  int coeff1, coeff2;
+  int delta;
+  int sample1, sample2;
+} MSChannel;
+
+SDLEW_INLINE int ms_nibble(MSChannel *ch, int nibble) {
+  const int signed_nibble = nibble & 0x8 ? nibble - 0x10 : nibble;
+  const int predicted = (ch->sample1 * ch->coeff1 +
+                         ch->sample2 * ch->coeff2) / 256;
+  const int sample = clamp16(predicted + ch->delta * signed_nibble);
+
+  ch->delta = ch->delta * ms_adaptation[nibble] / 256;
+  if (ch->delta < 16) {
+    ch->delta = 16;
+  }
+  /* Kept in 16 bits like the decoder of SDL. */
+  ch->delta &= 0xffff;
+  ch->sample2 = ch->sample1;
+  ch->sample1 = sample;
+  return sample;
+}
+
+static int decode_ms_adpcm(SDLEW_WavReader *r, int block_len) {
+  MSChannel channels[2];
+  const int nch = r->channels;
+  const Uint8 *p = r->block;
+  Uint8 *out = r->decoded;
+  int c, i, samples;
+
+  if (block_len < 7 * nch) {
+    return 0;
+  }
+
+  for (c = 0; c < nch; c++) {
+    const int index = p[c] < r->num_coeffs ? p[c] : 0;
+    channels[c].coeff1 = r->coeffs[index * 2];
+    channels[c].coeff2 = r->coeffs[index * 2 + 1];
+  }
+  p += nch;
+  for (c = 0; c < nch; c++, p += 2) {
+    channels[c].delta = (int)read_le16(p);
+  }
+  for (c = 0; c < nch; c++, p += 2) {
+    channels[c].sample1 = (Sint16)read_le16(p);
+  }
+  for (c = 0; c < nch; c++, p += 2) {
+    channels[c].sample2 = (Sint16)read_le16(p);
+  }
+
+  /* The header holds the first two samples, oldest last. */
+  for (c = 0; c < nch; c++, out += 2) {
+    write_le16(out, channels[c].sample2);
+  }
+  for (c = 0; c < nch; c++, out += 2) {
+    write_le16(out, channels[c].sample1);
+  }
+
+  /* Nibbles interleave the channels, high nibble first. */
+  samples = (block_len - 7 * nch) * 2;
+  if (samples > (r->samples_per_block - 2) * nch) {
+    samples = (r->samples_per_block - 2) * nch;
+  }
+  for (i = 0; i < samples; i++, out += 2) {
+    const int nibble = i & 1 ? p[i / 2] & 0xf : p[i / 2] >> 4;
+    write_le16(out, ms_nibble(&channels[i % nch], nibble));
+  }
+
+  return (int)(out - r->decoded);
+}
+
+/* IMA ADPCM. */
+
+static const int ima_index[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int ima_step[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+  45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+  209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499,
+  2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845,
+  8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385,
+  24623, 27086, 29794, 32767,
+};
+
+typedef struct IMAChannel {
+  int sample;
+  int index;
+} IMAChannel;
+
+SDLEW_INLINE int ima_nibble(IMAChannel *ch, int nibble) {
+  const int step = ima_step[ch->index];
+  int diff = step >> 3;
+
+  if (nibble & 1) {
+    diff += step >> 2;
+  }
+  if (nibble & 2) {
+    diff += step >> 1;
+  }
+  if (nibble & 4) {
+    diff += step;
+  }
+  if (nibble & 8) {
+    diff = -diff;
+  }
+
+  ch->sample = clamp16(ch->sample + diff);
+  ch->index += ima_index[nibble];
+  ch->index = ch->index < 0 ? 0 : ch->index > 88 ? 88 : ch->index;
+  return ch->sample;
+}
+
+static int decode_ima_adpcm(SDLEW_WavReader *r, int block_len) {
+  IMAChannel channels[2];
+  const int nch = r->channels;
+  const Uint8 *p = r->block;
+  Uint8 *out = r->decoded;
+  int c, i, k, groups;
+
+  if (block_len < 4 * nch) {
+    return 0;
+  }
+
+  for (c = 0; c < nch; c++, p += 4) {
+    channels[c].sample = (Sint16)read_le16(p);
+    channels[c].index = p[2] > 88 ? 88 : p[2];
+    write_le16(out + c * 2, channels[c].sample);
+  }
+  out += nch * 2;
+
+  /* Groups of 4 bytes per channel hold 8 samples, low nibble first. */
+  groups = (block_len - 4 * nch) / (4 * nch);
+  if (groups > (r->samples_per_block - 1) / 8) {
+    groups = (r->samples_per_block - 1) / 8;
+  }
+  for (i = 0; i < groups; i++) {
+    for (c = 0; c < nch; c++, p += 4) {
+      for (k = 0; k < 8; k++) {
+        const int nibble = k & 1 ? p[k / 2] >> 4 : p[k / 2] & 0xf;
+        write_le16(out + (k * nch + c) * 2,
+                   ima_nibble(&channels[c], nibble));
+      }
+    }
+    out += 8 * nch * 2;
+  }
+
+  return (int)(out - r->decoded);
+}
+
+/* Header parsing. */
+
+static int parse_fmt(SDLEW_WavReader *r, const Uint8 *fmt, int size,
+                     SDL_AudioSpec *spec) {
+  int encoding, channels, bits, i;
+
+  if (size < 16) {
+    SDL_SetError("sdlewWavOpen: fmt chunk too short");
+    return 0;
+  }
+  encoding = (int)read_le16(fmt);
+  channels = (int)read_le16(fmt + 2);
+  r->block_align = (int)read_le16(fmt + 12);
+  bits = (int)read_le16(fmt + 14);
+
+  if (encoding == WAVE_FORMAT_EXTENSIBLE && size >= 26) {
+    /* First two bytes of the sub format GUID are the format tag. */
+    encoding = (int)read_le16(fmt + 24);
+  }
+
+  memset(spec, 0, sizeof(SDL_AudioSpec));
+  spec->freq = (int)read_le32(fmt + 4);
+  spec->channels = (Uint8)channels;
+  spec->samples = 4096;
+  r->encoding = encoding;
+  r->channels = channels;
+
+  if (channels < 1 || channels > 255 || r->block_align <= 0) {
+    SDL_SetError("sdlewWavOpen: invalid fmt chunk");
+    return 0;
+  }
+
+  switch (encoding) {
+    case WAVE_FORMAT_PCM:
+      if (bits != 8 && bits != 16) {
+        SDL_SetError("sdlewWavOpen: unsupported %d bit PCM", bits);
+        return 0;
+      }
+      spec->format = bits == 8 ? AUDIO_U8 : AUDIO_S16LSB;
+      break;
+    case WAVE_FORMAT_MS_ADPCM:
+      if (channels > 2 || size < 22 || bits != 4) {
+        SDL_SetError("sdlewWavOpen: invalid MS ADPCM format");
+        return 0;
+      }
+      r->samples_per_block = (int)read_le16(fmt + 18);
+      r->num_coeffs = (int)read_le16(fmt + 20);
+      if (r->num_coeffs < 1 || 22 + r->num_coeffs * 4 > size ||
+          r->samples_per_block < 2)
+      {
+        SDL_SetError("sdlewWavOpen: invalid MS ADPCM coefficients");
+        return 0;
+      }
+      r->coeffs = (Sint16 *)malloc(sizeof(Sint16) * 2 * r->num_coeffs);
+      if (r->coeffs == NULL) {
+        SDL_OutOfMemory();
+        return 0;
+      }
+      for (i = 0; i < r->num_coeffs * 2; i++) {
+        r->coeffs[i] = (Sint16)read_le16(fmt + 22 + i * 2);
+      }
+      spec->format = AUDIO_S16LSB;
+      break;
+    case WAVE_FORMAT_IMA_ADPCM:
+      if (channels > 2 || bits != 4) {
+        SDL_SetError("sdlewWavOpen: invalid IMA ADPCM format");
+        return 0;
+      }
+      /* Samples per block as implied by the block size. */
+      r->samples_per_block = (r->block_align - 4 * channels) * 8 /
+                             (4 * channels) + 1;
+      if (r->samples_per_block < 1) {
+        SDL_SetError("sdlewWavOpen: invalid IMA ADPCM block size");
+        return 0;
+      }
+      spec->format = AUDIO_S16LSB;
+      break;
+    default:
+      SDL_SetError("sdlewWavOpen: unsupported encoding 0x%.4x", encoding);
+      return 0;
+  }
+
+  spec->silence = spec->format == AUDIO_U8 ? 0x80 : 0x00;
+  r->frame_size = ((spec->format & 0xff) / 8) * channels;
+
+  if (encoding != WAVE_FORMAT_PCM) {
+    r->block = (Uint8 *)malloc(r->block_align);
+    r->decoded = (Uint8 *)malloc((size_t)r->samples_per_block *
+                                 r->frame_size);
+    if (r->block == NULL || r->decoded == NULL) {
+      SDL_OutOfMemory();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Skip a chunk, reading through it on sources which cannot seek. */
+static int skip_bytes(SDL_RWops *src, Uint32 len) {
+  Uint8 buf[256];
+
+  if (SDL_RWseek(src, (int)len, RW_SEEK_CUR) >= 0) {
+    return 1;
+  }
+  while (len > 0) {
+    const int n = len < sizeof(buf) ? (int)len : (int)sizeof(buf);
+    if (SDL_RWread(src, buf, 1, n) != n) {
+      return 0;
+    }
+    len -= n;
+  }
+  return 1;
+}
+
+static int parse_headers(SDLEW_WavReader *r, SDL_AudioSpec *spec) {
+  Uint8 header[12];
+  Uint8 *fmt = NULL;
+  int have_fmt = 0, ok = 0;
+
+  if (SDL_RWread(r->src, header, 1, 12) != 12 ||
+      memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+  {
+    SDL_SetError("sdlewWavOpen: not a WAV file");
+    return 0;
+  }
+
+  for (;;) {
+    Uint32 len, padded;
+
+    if (SDL_RWread(r->src, header, 1, 8) != 8) {
+      SDL_SetError("sdlewWavOpen: no data chunk");
+      goto finally;
+    }
+    len = read_le32(header + 4);
+    padded = len + (len & 1);
+
+    if (memcmp(header, "fmt ", 4) == 0 && !have_fmt) {
+      const int size = len < MAX_FMT_SIZE ? (int)len : MAX_FMT_SIZE;
+      fmt = (Uint8 *)malloc(size > 0 ? size : 1);
+      if (fmt == NULL) {
+        SDL_OutOfMemory();
+        goto finally;
+      }
+      if (SDL_RWread(r->src, fmt, 1, size) != size ||
+          !skip_bytes(r->src, padded - size))
+      {
+        SDL_SetError("sdlewWavOpen: truncated fmt chunk");
+        goto finally;
+      }
+      if (!parse_fmt(r, fmt, size, spec)) {
+        goto finally;
+      }
+      have_fmt = 1;
+    }
+    else if (memcmp(header, "data", 4) == 0) {
+      if (!have_fmt) {
+        SDL_SetError("sdlewWavOpen: data chunk before fmt chunk");
+        goto finally;
+      }
+      r->data_start = SDL_RWtell(r->src);
+      r->data_len = len;
+      ok = 1;
+      goto finally;
+    }
+    else if (!skip_bytes(r->src, padded)) {
+      SDL_SetError("sdlewWavOpen: truncated file");
+      goto finally;
+    }
+  }
+
+finally:
+  free(fmt);
+  return ok;
+}
+
+/* API. */
+
+SDLEW_WavReader *sdlewWavOpen(SDL_RWops *src, int freesrc,
+                              SDL_AudioSpec *spec) {
+  SDLEW_WavReader *reader;
+
+  if (src == NULL || spec == NULL) {
+    SDL_SetError("sdlewWavOpen: passed a NULL pointer");
+    if (src != NULL && freesrc) {
+      SDL_RWclose(src);
+    }
+    return NULL;
+  }
+
+  reader = (SDLEW_WavReader *)calloc(1, sizeof(SDLEW_WavReader));
+  if (reader == NULL) {
+    SDL_OutOfMemory();
+    if (freesrc) {
+      SDL_RWclose(src);
+    }
+    return NULL;
+  }
+  reader->src = src;
+  reader->freesrc = freesrc;
+
+  if (!parse_headers(reader, spec)) {
+    sdlewWavClose(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+void sdlewWavClose(SDLEW_WavReader *reader) {
+  if (reader != NULL) {
+    if (reader->freesrc) {
+      SDL_RWclose(reader->src);
+    }
+    free(reader->coeffs);
+    free(reader->block);
+    free(reader->decoded);
+    free(reader);
+  }
+}
+
+static int read_pcm(SDLEW_WavReader *r, Uint8 *buf, int len) {
+  const Uint32 left = r->data_len - r->data_pos;
+  int want = (Uint32)len < left ? len : (int)left;
+  int n;
+
+  want -= want % r->frame_size;
+  if (want <= 0) {
+    return 0;
+  }
+  n = SDL_RWread(r->src, buf, 1, want);
+  if (n < 0) {
+    return -1;
+  }
+
+  /* A truncated file ends early, keeping whole frames. */
+  r->data_pos += n;
+  if (n < want) {
+    r->data_pos = r->data_len;
+    n -= n % r->frame_size;
+  }
+  return n;
+}
+
+static int read_adpcm(SDLEW_WavReader *r, Uint8 *buf, int len) {
+  int written = 0;
+
+  len -= len % r->frame_size;
+  while (written < len) {
+    int n;
+
+    if (r->decoded_pos == r->decoded_len) {
+      const Uint32 left = r->data_len - r->data_pos;
+      int block_len = (Uint32)r->block_align < left ? r->block_align
+                                                     : (int)left;
+      if (block_len <= 0) {
+        break;
+      }
+      block_len = SDL_RWread(r->src, r->block, 1, block_len);
+      if (block_len <= 0) {
+        r->data_pos = r->data_len;
+        break;
+      }
+      r->data_pos += block_len;
+
+      r->decoded_pos = 0;
+      r->decoded_len = r->encoding == WAVE_FORMAT_MS_ADPCM
+                           ? decode_ms_adpcm(r, block_len)
+                           : decode_ima_adpcm(r, block_len);
+      if (r->decoded_len == 0) {
+        continue;
+      }
+    }
+
+    n = r->decoded_len - r->decoded_pos;
+    n = n < len - written ? n : len - written;
+    memcpy(buf + written, r->decoded + r->decoded_pos, n);
+    r->decoded_pos += n;
+    written += n;
+  }
+
+  return written;
+}
+
+int sdlewWavRead(SDLEW_WavReader *reader, Uint8 *buf, int len) {
+  if (buf == NULL || len <= 0) {
+    return 0;
+  }
+  if (reader->encoding == WAVE_FORMAT_PCM) {
+    return read_pcm(reader, buf, len);
+  }
+  return read_adpcm(reader, buf, len);
+}
+
+int sdlewWavFillStream(SDLEW_WavReader *reader, SDLEW_AudioStream *stream) {
+  Uint8 buf[FILL_CHUNK];
+  int queued = 0;
+
+  for (;;) {
+    const int space = sdlewAudioStreamSpace(stream);
+    int n;
+
+    if (space <= 0) {
+      break;
+    }
+    n = sdlewWavRead(reader, buf, space < FILL_CHUNK ? space : FILL_CHUNK);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    queued += sdlewAudioStreamWrite(stream, buf, n);
+  }
+
+  return queued;
+}
+
+int sdlewWavRewind(SDLEW_WavReader *reader) {
+  if (SDL_RWseek(reader->src, reader->data_start, RW_SEEK_SET) < 0) {
+    SDL_SetError("sdlewWavRewind: source is not seekable");
+    return -1;
+  }
+  reader->data_pos = 0;
+  reader->decoded_pos = 0;
+  reader->decoded_len = 0;
+  return 0;
+}
@@ -0,0 +1,473 @@
+/*
+ * Copyright 2014 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+/* Software YUV overlay to RGB conversion.
+ *
+ * Each row is first split into Y, U and V runs (packed formats are
+ * deinterleaved), converted into R, G and B runs and finally packed into
+ * the destination format. Coefficients are limited range with 6 bits of
+ * fraction, the SSE2 and scalar paths give identical results.
+ */
+
+#include "sdlew_video.h"
+#include "sdlew_intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define COEF_BITS 6
+#define MODE_MASK 0xff
+
+/* Rows per parallel chunk. */
+#define BAND_GRAIN 8
+
+typedef struct YUVMatrix {
+  short y, rv, gu, gv, bu;
+} YUVMatrix;
+
+static const YUVMatrix matrices[] = {
+  /* BT.601 */
+  {75, 102, 25, 52, 129},
+  /* BT.709 */
+  {75, 115, 14, 34, 135},
+};
+
+/* Row kernels. */
+
+/* Split a packed 4:2:2 row of at least two pixels into planar runs.
+ * Offsets give the position of the first Y, U and V byte within each four
+ * byte group.
+ */
+static void unpack_422_row(const Uint8 *src, int width,
+                           int yoff, int uoff, int voff,
+                           Uint8 *y, Uint8 *u, Uint8 *v) {
+  int x = 0, i;
+
+#ifdef SDLEW_HAVE_SSE2
+  /* The SIMD path assumes Y in either the even or the odd bytes. */
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  for (; x + 16 <= width; x += 16, src += 32) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)src);
+    const __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i luma, chroma, first, second;
+
+    if (yoff == 0) {
+      luma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+      chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    }
+    else {
+      luma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+      chroma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+    }
+    _mm_storeu_si128((__m128i *)(y + x), luma);
+
+    first = _mm_packus_epi16(_mm_and_si128(chroma, low), low);
+    second = _mm_packus_epi16(_mm_srli_epi16(chroma, 8), low);
+    if (uoff < voff) {
+      _mm_storel_epi64((__m128i *)(u + x / 2), first);
+      _mm_storel_epi64((__m128i *)(v + x / 2), second);
+    }
+    else {
+      _mm_storel_epi64((__m128i *)(v + x / 2), first);
+      _mm_storel_epi64((__m128i *)(u + x / 2), second);
+    }
+  }
+#endif
+
+  for (; x + 1 < width; x += 2, src += 4) {
+    i = x / 2;
+    y[x] = src[yoff];
+    y[x + 1] = src[yoff + 2];
+    u[i] = src[uoff];
+    v[i] = src[voff];
+  }
+  /* An odd row ends after the first Y of a group, its chroma may lie past
+   * the row, so the last pixel shares the chroma of the pair before.
+   */
+  if (x < width) {
+    i = x / 2;
+    y[x] = src[yoff];
+    u[i] = u[i - 1];
+    v[i] = v[i - 1];
+  }
+}
+
+SDLEW_INLINE Uint8 clamp_channel(int value) {
+  value >>= COEF_BITS;
+  return (Uint8)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+/* Planar runs to R, G and B runs, chroma shared by pixel pairs. */
+static void yuv_to_rgb_row(const YUVMatrix *m, const Uint8 *y,
+                           const Uint8 *u, const Uint8 *v, int width,
+                           Uint8 *r, Uint8 *g, Uint8 *b) {
+  int x = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias_y = _mm_set1_epi16(16);
+  const __m128i bias_c = _mm_set1_epi16(128);
+  const __m128i round = _mm_set1_epi16(1 << (COEF_BITS - 1));
+  const __m128i cy = _mm_set1_epi16(m->y);
+  const __m128i crv = _mm_set1_epi16(m->rv);
+  const __m128i cgu = _mm_set1_epi16(m->gu);
+  const __m128i cgv = _mm_set1_epi16(m->gv);
+  const __m128i cbu = _mm_set1_epi16(m->bu);
+
+  for (; x + 16 <= width; x += 16) {
+    const __m128i luma = _mm_loadu_si128((const __m128i *)(y + x));
+    const __m128i cu = _mm_sub_epi16(_mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(u + x / 2)), zero), bias_c);
+    const __m128i cv = _mm_sub_epi16(_mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(v + x / 2)), zero), bias_c);
+    const __m128i rc = _mm_mullo_epi16(cv, crv);
+    const __m128i gc = _mm_add_epi16(_mm_mullo_epi16(cu, cgu),
+                                     _mm_mullo_epi16(cv, cgv));
+    const __m128i bc = _mm_mullo_epi16(cu, cbu);
+    __m128i y0, y1, r0, r1, g0, g1, b0, b1;
+
+    y0 = _mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), bias_y);
+    y1 = _mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), bias_y);
+    y0 = _mm_add_epi16(_mm_mullo_epi16(y0, cy), round);
+    y1 = _mm_add_epi16(_mm_mullo_epi16(y1, cy), round);
+
+    /* Duplicate every chroma term for its pixel pair. */
+    r0 = _mm_adds_epi16(y0, _mm_unpacklo_epi16(rc, rc));
+    r1 = _mm_adds_epi16(y1, _mm_unpackhi_epi16(rc, rc));
+    g0 = _mm_subs_epi16(y0, _mm_unpacklo_epi16(gc, gc));
+    g1 = _mm_subs_epi16(y1, _mm_unpackhi_epi16(gc, gc));
+    b0 = _mm_adds_epi16(y0, _mm_unpacklo_epi16(bc, bc));
+    b1 = _mm_adds_epi16(y1, _mm_unpackhi_epi16(bc, bc));
+
+    _mm_storeu_si128((__m128i *)(r + x), _mm_packus_epi16(
+            _mm_srai_epi16(r0, COEF_BITS), _mm_srai_epi16(r1, COEF_BITS)));
+    _mm_storeu_si128((__m128i *)(g + x), _mm_packus_epi16(
+            _mm_srai_epi16(g0, COEF_BITS), _mm_srai_epi16(g1, COEF_BITS)));
+    _mm_storeu_si128((__m128i *)(b + x), _mm_packus_epi16(
+            _mm_srai_epi16(b0, COEF_BITS), _mm_srai_epi16(b1, COEF_BITS)));
+  }
+#endif
+
+  for (; x < width; x++) {
+    const int cu = u[x / 2] - 128, cv = v[x / 2] - 128;
+    const int luma = (y[x] - 16) * m->y + (1 << (COEF_BITS - 1));
+    r[x] = clamp_channel(luma + cv * m->rv);
+    g[x] = clamp_channel(luma - (cu * m->gu + cv * m->gv));
+    b[x] = clamp_channel(luma + cu * m->bu);
+  }
+}
+
+/* Pack R, G and B runs into 32 bit pixels with 8 bit channels. */
+static void pack_rgb32_row(const SDL_PixelFormat *format, const Uint8 *r,
+                           const Uint8 *g, const Uint8 *b, int width,
+                           Uint32 *dst) {
+  int x = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi32((int)format->Amask);
+  const __m128i rshift = _mm_cvtsi32_si128(format->Rshift);
+  const __m128i gshift = _mm_cvtsi32_si128(format->Gshift);
+  const __m128i bshift = _mm_cvtsi32_si128(format->Bshift);
+
+  for (; x + 16 <= width; x += 16) {
+    const __m128i rv = _mm_loadu_si128((const __m128i *)(r + x));
+    const __m128i gv = _mm_loadu_si128((const __m128i *)(g + x));
+    const __m128i bv = _mm_loadu_si128((const __m128i *)(b + x));
+    __m128i r16[2], g16[2], b16[2];
+    int i;
+
+    r16[0] = _mm_unpacklo_epi8(rv, zero);
+    r16[1] = _mm_unpackhi_epi8(rv, zero);
+    g16[0] = _mm_unpacklo_epi8(gv, zero);
+    g16[1] = _mm_unpackhi_epi8(gv, zero);
+    b16[0] = _mm_unpacklo_epi8(bv, zero);
+    b16[1] = _mm_unpackhi_epi8(bv, zero);
+
+    for (i = 0; i < 4; i++) {
+      const int half = i / 2;
+      __m128i rw, gw, bw, pixels;
+      if (i & 1) {
+        rw = _mm_unpackhi_epi16(r16[half], zero);
+        gw = _mm_unpackhi_epi16(g16[half], zero);
+        bw = _mm_unpackhi_epi16(b16[half], zero);
+      }
+      else {
+        rw = _mm_unpacklo_epi16(r16[half], zero);
+        gw = _mm_unpacklo_epi16(g16[half], zero);
+        bw = _mm_unpacklo_epi16(b16[half], zero);
+      }
+      pixels = _mm_or_si128(_mm_sll_epi32(rw, rshift),
+                            _mm_sll_epi32(gw, gshift));
+      pixels = _mm_or_si128(pixels, _mm_sll_epi32(bw, bshift));
+      pixels = _mm_or_si128(pixels, alpha);
+      _mm_storeu_si128((__m128i *)(dst + x + i * 4), pixels);
+    }
+  }
+#endif
+
+  for (; x < width; x++) {
+    dst[x] = ((Uint32)r[x] << format->Rshift) |
+             ((Uint32)g[x] << format->Gshift) |
+             ((Uint32)b[x] << format->Bshift) |
+             format->Amask;
+  }
+}
+
+/* Pack R, G and B runs into 16 bit pixels such as RGB565 or RGB555. */
+static void pack_rgb16_row(const SDL_PixelFormat *format, const Uint8 *r,
+                           const Uint8 *g, const Uint8 *b, int width,
+                           Uint16 *dst) {
+  int x = 0;
+
+#ifdef SDLEW_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rloss = _mm_cvtsi32_si128(format->Rloss);
+  const __m128i gloss = _mm_cvtsi32_si128(format->Gloss);
+  const __m128i bloss = _mm_cvtsi32_si128(format->Bloss);
+  const __m128i rshift = _mm_cvtsi32_si128(format->Rshift);
+  const __m128i gshift = _mm_cvtsi32_si128(format->Gshift);
+  const __m128i bshift = _mm_cvtsi32_si128(format->Bshift);
+
+  for (; x + 8 <= width; x += 8) {
+    const __m128i rv = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(r + x)), zero);
+    const __m128i gv = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(g + x)), zero);
+    const __m128i bv = _mm_unpacklo_epi8(
+            _mm_loadl_epi64((const __m128i *)(b + x)), zero);
+    __m128i pixels;
+
+    pixels = _mm_sll_epi16(_mm_srl_epi16(rv, rloss), rshift);
+    pixels = _mm_or_si128(pixels,
+                          _mm_sll_epi16(_mm_srl_epi16(gv, gloss), gshift));
+    pixels = _mm_or_si128(pixels,
+                          _mm_sll_epi16(_mm_srl_epi16(bv, bloss), bshift));
+    _mm_storeu_si128((__m128i *)(dst + x), pixels);
+  }
+#endif
+
+  for (; x < width; x++) {
+    dst[x] = (Uint16)(((r[x] >> format->Rloss) << format->Rshift) |
+                      ((g[x] >> format->Gloss) << format->Gshift) |
+                      ((b[x] >> format->Bloss) << format->Bshift));
+  }
+}
+
+/* Any other destination format, through RGBA. */
+static void pack_generic_row(const SDL_PixelFormat *format, const Uint8 *r,
+                             const Uint8 *g, const Uint8 *b, int width,
+                             Uint8 *rgba, Uint8 *dst) {
+  int x;
+
+  for (x = 0; x < width; x++) {
+    rgba[x * 4 + 0] = r[x];
+    rgba[x * 4 + 1] = g[x];
+    rgba[x * 4 + 2] = b[x];
+    rgba[x * 4 + 3] = 255;
+  }
+  sdlew_row_from_rgba(format, rgba, dst, width);
+}
+
+/* Conversion job. */
+
+typedef struct YUVJob {
+  const SDL_Overlay *overlay;
+  SDL_Surface *dst;
+  int x, y;
+  const YUVMatrix *matrix;
+  int error;
+} YUVJob;
+
+static int is_rgb32(const SDL_PixelFormat *format) {
+  return format->BytesPerPixel == 4 && format->Rloss == 0 &&
+         format->Gloss == 0 && format->Bloss == 0;
+}
+
+static int is_rgb16(const SDL_PixelFormat *format) {
+  return format->BytesPerPixel == 2 && format->palette == NULL;
+}
+
+static void convert_band(void *userdata, int begin, int end) {
+  YUVJob *job = (YUVJob *)userdata;
+  const SDL_Overlay *overlay = job->overlay;
+  const SDL_PixelFormat *format = job->dst->format;
+  const int width = overlay->w;
+  const int half = (width + 1) / 2;
+  /* Planar chroma planes hold w / 2 by h / 2 samples, the last column
+   * and row of odd sized overlays reuse the samples before them.
+   */
+  const int last_chroma_row = overlay->h / 2 - 1;
+  int planar_odd = 0;
+  Uint8 *scratch, *yrow, *urow, *vrow, *r, *g, *b, *rgba;
+  int row;
+
+  /* Runs are padded so the SIMD tails never step out of bounds. */
+  scratch = (Uint8 *)malloc((width + 16) * 4 + (half + 16) * 2 +
+                            width * 4);
+  if (scratch == NULL) {
+    sdlew_atomic_store(&job->error, 1);
+    return;
+  }
+  yrow = scratch;
+  r = yrow + width + 16;
+  g = r + width + 16;
+  b = g + width + 16;
+  urow = b + width + 16;
+  vrow = urow + half + 16;
+  rgba = vrow + half + 16;
+
+  for (row = begin; row < end; row++) {
+    const Uint8 *y, *u, *v;
+    Uint8 *dst = (Uint8 *)job->dst->pixels +
+                 (job->y + row) * job->dst->pitch +
+                 job->x * format->BytesPerPixel;
+
+    switch (overlay->format) {
+      case SDL_YV12_OVERLAY:
+      case SDL_IYUV_OVERLAY: {
+        const int uplane = overlay->format == SDL_IYUV_OVERLAY ? 1 : 2;
+        const int vplane = 3 - uplane;
+        const int crow = row / 2 < last_chroma_row ? row / 2
+                                                   : last_chroma_row;
+        y = overlay->pixels[0] + row * overlay->pitches[0];
+        u = overlay->pixels[uplane] + crow * overlay->pitches[uplane];
+        v = overlay->pixels[vplane] + crow * overlay->pitches[vplane];
+        planar_odd = width & 1;
+        break;
+      }
+      default: {
+        const Uint8 *src = overlay->pixels[0] + row * overlay->pitches[0];
+        if (overlay->format == SDL_YUY2_OVERLAY) {
+          unpack_422_row(src, width, 0, 1, 3, yrow, urow, vrow);
+        }
+        else if (overlay->format == SDL_UYVY_OVERLAY) {
+          unpack_422_row(src, width, 1, 0, 2, yrow, urow, vrow);
+        }
+        else {
+          unpack_422_row(src, width, 0, 3, 1, yrow, urow, vrow);
+        }
+        y = yrow;
+        u = urow;
+        v = vrow;
+        break;
+      }
+    }
+
+    if (planar_odd) {
+      const int last = width - 1;
+      yuv_to_rgb_row(job->matrix, y, u, v, last, r, g, b);
+      yuv_to_rgb_row(job->matrix, y + last, u + last / 2 - 1,
+                     v + last / 2 - 1, 1, r + last, g + last, b + last);
+    }
+    else {
+      yuv_to_rgb_row(job->matrix, y, u, v, width, r, g, b);
+    }
+
+    if (is_rgb32(format)) {
+      pack_rgb32_row(format, r, g, b, width, (Uint32 *)dst);
+    }
+    else if (is_rgb16(format)) {
+      pack_rgb16_row(format, r, g, b, width, (Uint16 *)dst);
+    }
+    else {
+      pack_generic_row(format, r, g, b, width, rgba, dst);
+    }
+  }
+
+  free(scratch);
+}
+
+int sdlewConvertYUVOverlay(SDL_Overlay *overlay, SDL_Surface *dst,
+                           const SDL_Rect *dstrect, int flags) {
+  YUVJob job;
+  const int mode = flags & MODE_MASK;
+  int dst_locked = 0;
+
+  if (overlay == NULL || dst == NULL) {
+    SDL_SetError("sdlewConvertYUVOverlay: passed a NULL pointer");
+    return -1;
+  }
+  if (mode > SDLEW_YUV_BT709) {
+    SDL_SetError("sdlewConvertYUVOverlay: unknown color matrix %d", mode);
+    return -1;
+  }
+  switch (overlay->format) {
+    case SDL_YV12_OVERLAY:
+    case SDL_IYUV_OVERLAY:
+      /* Less than a full chroma sample. */
+      if (overlay->w < 2 || overlay->h < 2) {
+        SDL_SetError("sdlewConvertYUVOverlay: planar overlay too small");
+        return -1;
+      }
+      break;
+    case SDL_YUY2_OVERLAY:
+    case SDL_UYVY_OVERLAY:
+    case SDL_YVYU_OVERLAY:
+      if (overlay->w < 2) {
+        SDL_SetError("sdlewConvertYUVOverlay: packed overlay too small");
+        return -1;
+      }
+      break;
+    default:
+      SDL_SetError("sdlewConvertYUVOverlay: unsupported overlay format");
+      return -1;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.overlay = overlay;
+  job.dst = dst;
+  job.matrix = &matrices[mode];
+  if (dstrect != NULL) {
+    job.x = dstrect->x;
+    job.y = dstrect->y;
+  }
+  if (job.x < 0 || job.y < 0 ||
+      job.x + overlay->w > dst->w || job.y + overlay->h > dst->h)
+  {
+    SDL_SetError("sdlewConvertYUVOverlay: overlay exceeds the surface");
+    return -1;
+  }
+
+  if (SDL_LockYUVOverlay(overlay) < 0) {
+    return -1;
+  }
+  if (SDL_MUSTLOCK(dst)) {
+    if (SDL_LockSurface(dst) < 0) {
+      SDL_UnlockYUVOverlay(overlay);
+      return -1;
+    }
+    dst_locked = 1;
+  }
+
+  if (flags & SDLEW_YUV_PARALLEL) {
+    sdlew_parallel_range(0, overlay->h, BAND_GRAIN, convert_band, &job);
+  }
+  else {
+    convert_band(&job, 0, overlay->h);
+  }
+
+  if (dst_locked) {
+    SDL_UnlockSurface(dst);
+  }
+  SDL_UnlockYUVOverlay(overlay);
+
+  if (job.error) {
+    SDL_OutOfMemory();
+    return -1;
+  }
+  return 0;
+}